@@ -4,6 +4,7 @@ qiLogCategory("test.qi.fileExample.imageStore");
 
 #include <map>
 
+#include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
 
 QI_TYPE_INTERFACE(alice::ImageStore);
@@ -28,7 +29,17 @@ public:
     // Note that ideally this would be implemented in an asynchronous way,
     // but for simplicity we will do it synchronously.
 
-    // First, make a local copy in a temporary files directory:
+    // Small images are copied straight in memory, without a round trip through the disk.
+    // This call will block until the end because it returns a FutureSync.
+    if (imageFile->size() <= static_cast<std::streamsize>(MAX_IN_MEMORY_IMAGE_SIZE))
+    {
+      qi::Buffer imageContent = qi::copyToMemory(imageFile, MAX_IN_MEMORY_IMAGE_SIZE).value();
+      imageFile.reset();
+      storeContentInDatabase(name, imageContent);
+      return;
+    }
+
+    // Bigger images are copied in a temporary files directory:
     const auto tempFilePath = generateTemporaryFilePath();
 
     // This call will block until the end because it returns a FutureSync.
@@ -51,8 +62,12 @@ public:
   }
 
 private:
+  static const std::size_t MAX_IN_MEMORY_IMAGE_SIZE = 4 * 1024 * 1024;
+
   using FileRegistry = std::map<std::string, qi::Path>;
   FileRegistry _fileRegistry;
+  using ContentRegistry = std::map<std::string, qi::Buffer>;
+  ContentRegistry _contentRegistry;
 
   qi::Path generateTemporaryFilePath()
   {
@@ -72,8 +87,26 @@ private:
     _fileRegistry[name] = path;
   }
 
+  void storeContentInDatabase(const std::string& name, const qi::Buffer& content)
+  {
+    //...fake it
+    _contentRegistry[name] = content;
+  }
+
   qi::Path findFileLocation(const std::string& name)
   {
+    // Images kept in memory are only written to a file when someone needs to read them.
+    const auto contentIt = _contentRegistry.find(name);
+    if (contentIt != _contentRegistry.end())
+    {
+      const auto tempFilePath = generateTemporaryFilePath();
+      {
+        boost::filesystem::ofstream file(tempFilePath, std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(static_cast<const char*>(contentIt->second.data()), contentIt->second.totalSize());
+      }
+      _contentRegistry.erase(contentIt);
+      storeFileInDatabase(name, tempFilePath);
+    }
     return _fileRegistry[name];
   }
 };
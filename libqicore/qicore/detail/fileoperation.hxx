@@ -2,32 +2,350 @@
 #ifndef _QICORE_FILEOPERATION_HPP_
 #define _QICORE_FILEOPERATION_HPP_
 
+#include <chrono>
 #include <memory>
+#include <string>
+#include <vector>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <qi/detail/warn_push_ignore_deprecated.hpp>
 
 namespace qi
 {
+  namespace detail
+  {
+    /** Uncompress a chunk of data provided by File::readCompressed().
+        Throws a std::runtime_error if the data cannot be uncompressed to the expected size.
+    **/
+    QICORE_API Buffer uncompressFileChunk(const Buffer& compressedData, std::streamsize uncompressedSize);
+
+    /// Copy of a local file to another local file performed by the system, the data never reaches the process.
+    class KernelFileCopy
+    {
+    public:
+      virtual ~KernelFileCopy() = default;
+
+      /** Copy up to countBytes more bytes.
+          When the destination shares the blocks of the source, the first call reports the whole file.
+          Throws a std::runtime_error if the system fails to copy the data.
+          @return The count of bytes copied, 0 once the whole file has been copied.
+      **/
+      virtual std::streamsize copy(std::streamsize countBytes) = 0;
+    };
+
+    /** Prepare the copy of a file by the system, creating the destination file.
+        Throws a std::runtime_error if the destination file cannot be created.
+        @return The copy, or null if the source is not a file opened in this process
+                or if the system cannot copy it.
+    **/
+    QICORE_API std::unique_ptr<KernelFileCopy> startKernelFileCopy(const FilePtr& sourceFile,
+                                                                   const Path& destinationPath);
+  }
+
+  /** Class of a file transfer for the transfer scheduler.
+      @see setTransferSchedulerLimits()
+  **/
+  enum TransferPriority
+  {
+    TransferPriority_Interactive, ///< Someone is waiting for the transfer, served first.
+    TransferPriority_Normal,      ///< Default class.
+    TransferPriority_Bulk,        ///< Background transfer, served when no other transfer is waiting.
+  };
+
+  /** Limits applied by the process-wide transfer scheduler to the reads of all the file operations.
+      @includename{qicore/file.hpp}
+  **/
+  struct TransferSchedulerLimits
+  {
+    /// Average count of bytes read per second by all the transfers, no limit if zero.
+    double maxBytesPerSecond = 0.0;
+
+    /// Count of bytes that can be read at once after a pause of the transfers, when the bandwidth is limited.
+    std::streamsize burstBytes = 1024 * 1024;
+
+    /// Count of transfers running at the same time, the next ones wait for one of them to end. No limit if zero.
+    unsigned int maxConcurrentTransfers = 0;
+  };
+
+  /** Counters of the process-wide transfer scheduler since the start of the process.
+      @includename{qicore/file.hpp}
+  **/
+  struct TransferSchedulerCounters
+  {
+    std::uint64_t bytesGranted = 0;       ///< Count of bytes of the reads allowed to proceed.
+    std::uint64_t readsGranted = 0;       ///< Count of reads allowed to proceed.
+    std::uint64_t readsThrottled = 0;     ///< Count of reads which had to wait for the bandwidth limit.
+    std::uint64_t transfersStarted = 0;   ///< Count of transfers allowed to start.
+    std::uint64_t transfersQueued = 0;    ///< Count of transfers which had to wait for another transfer to end.
+    unsigned int transfersRunning = 0;    ///< Count of transfers currently running.
+    unsigned int transfersWaiting = 0;    ///< Count of transfers currently waiting to start.
+    unsigned int readsWaiting = 0;        ///< Count of reads currently waiting for the bandwidth limit.
+  };
+
+  /** Change the limits of the process-wide transfer scheduler, effective immediately for the running transfers.
+      The transfers waiting are served by priority class, then in the order they arrived.
+      By default, transfers are not limited.
+  **/
+  QICORE_API void setTransferSchedulerLimits(const TransferSchedulerLimits& limits);
+
+  /// @return The current limits of the process-wide transfer scheduler.
+  QICORE_API TransferSchedulerLimits transferSchedulerLimits();
+
+  /// @return The current counters of the process-wide transfer scheduler.
+  QICORE_API TransferSchedulerCounters transferSchedulerCounters();
+
+  namespace detail
+  {
+    /** Wait for the transfer scheduler to allow a new transfer.
+        Once the future is set, releaseTransferSlot() must be called at the end of the transfer.
+        Canceling the future gives up waiting.
+    **/
+    QICORE_API Future<void> acquireTransferSlot(TransferPriority priority);
+
+    /// End a transfer allowed by acquireTransferSlot().
+    QICORE_API void releaseTransferSlot();
+
+    /** Wait for the transfer scheduler to allow reading byteCount more bytes.
+        The future is already set when the bandwidth is not limited. Canceling the future gives up waiting.
+    **/
+    QICORE_API Future<void> acquireReadBandwidth(TransferPriority priority, std::streamsize byteCount);
+
+    /** Compute the signatures of the consecutive blocks of a local file, for File::matchBlocks().
+        The last block is left out if it is smaller than blockSize.
+        @return The signatures, empty if the file cannot be read.
+    **/
+    QICORE_API std::vector<File::BlockSignature> computeBlockSignatures(const Path& localPath, std::streamsize blockSize);
+
+    /** Force the data written to a local file to reach the storage device.
+        @return false if the system failed to do it.
+    **/
+    QICORE_API bool syncLocalFile(const Path& localPath);
+
+    /** Keeps a local file open to force its data to reach the storage device repeatedly,
+        without opening it for each synchronization as syncLocalFile() does.
+    **/
+    class QICORE_API LocalFileSync
+    {
+    public:
+      /// The file is opened on the first synchronization.
+      explicit LocalFileSync(Path localPath);
+      ~LocalFileSync();
+
+      /** Force the data written to the file so far, by any descriptor, to reach the storage device.
+          @return false if the system failed to do it.
+      **/
+      bool sync();
+
+    private:
+      class Impl;
+      std::unique_ptr<Impl> _impl;
+    };
+  }
+
+  /** Settings of the process-wide cache of the contents copied to the local file system.
+      The cached contents are named after their digest (see File::digest()) and size.
+      A copy of a content already in the cache is made by sharing the blocks of the cached file
+      when the file system supports it, otherwise by a hard link, otherwise by a copy.
+      @warning A copy made by a hard link shares its storage with the cache: it should be replaced rather than
+               modified in place. Cached contents modified since they were cached are detected and dropped.
+      @see FileTransferOptions::useCopyCache
+
+      @includename{qicore/file.hpp}
+  **/
+  struct FileCopyCacheSettings
+  {
+    /// Directory of the cached contents, created if needed. The cache is disabled if empty.
+    Path directory;
+
+    /// Maximum total count of bytes of the cached contents, the least recently used contents are evicted beyond.
+    std::uint64_t maxSizeBytes = 256 * 1024 * 1024;
+  };
+
+  /** Counters of the process-wide copy cache since it was last configured.
+      @includename{qicore/file.hpp}
+  **/
+  struct FileCopyCacheCounters
+  {
+    std::uint64_t hits = 0;         ///< Count of copies made from the cache.
+    std::uint64_t misses = 0;       ///< Count of copies which had to be transferred.
+    std::uint64_t insertions = 0;   ///< Count of contents added to the cache.
+    std::uint64_t evictions = 0;    ///< Count of contents removed to respect the size bound.
+    std::uint64_t bytesSaved = 0;   ///< Count of bytes of the copies made from the cache.
+    std::uint64_t sizeBytes = 0;    ///< Current total count of bytes of the cached contents.
+    unsigned int entryCount = 0;    ///< Current count of cached contents.
+  };
+
+  /** Configure the process-wide copy cache, effective for the next copies.
+      The contents already in the directory are reused, the least recently modified being evicted first.
+      By default, there is no cache.
+  **/
+  QICORE_API void setFileCopyCache(const FileCopyCacheSettings& settings);
+
+  /// @return The current settings of the process-wide copy cache.
+  QICORE_API FileCopyCacheSettings fileCopyCacheSettings();
+
+  /// @return The current counters of the process-wide copy cache.
+  QICORE_API FileCopyCacheCounters fileCopyCacheCounters();
+
+  namespace detail
+  {
+    /// @return true if the process-wide copy cache is configured.
+    QICORE_API bool isFileCopyCacheEnabled();
+
+    /** Make a copy of a cached content at a local path, replacing any file there.
+        @return true if the content was in the cache and has been copied.
+    **/
+    QICORE_API bool copyFromFileCopyCache(const std::string& digest, std::streamsize size, const Path& localPath);
+
+    /// Add the content of a local file to the copy cache, if it is enabled and the content fits in it.
+    QICORE_API void addToFileCopyCache(const std::string& digest, std::streamsize size, const Path& localPath);
+  }
+
+  /** When the data written to a local file copy is forced to reach the storage device.
+      @see FileTransferOptions::syncPolicy
+  **/
+  enum FileSyncPolicy
+  {
+    FileSyncPolicy_None,        ///< The system writes the data to the device when it wants to.
+    FileSyncPolicy_AtEnd,       ///< The copy ends once all its data is on the device.
+    FileSyncPolicy_EveryChunk,  ///< Each chunk is on the device before the next one is written.
+  };
+
+  /** Tuning of the reads performed by the file operations to fetch the content of a file.
+      @includename{qicore/file.hpp}
+  **/
+  struct FileTransferOptions
+  {
+    /** Maximum count of reads waiting for their data at the same time.
+        Keeping several reads in flight hides the latency of the link to a remote file.
+        With 1, each read is only requested once the previous one has been processed.
+    **/
+    unsigned int maxReadsInFlight = 4;
+
+    /// Count of bytes requested by the first reads, before any bandwidth have been observed.
+    std::streamsize initialChunkSize = 512 * 1024;
+
+    /** Bounds of the count of bytes requested by each read.
+        The actual count is adapted to the observed bandwidth-delay product of the link,
+        so that the reads in flight are just enough to keep the link busy.
+    **/
+    std::streamsize minChunkSize = 64 * 1024;
+    std::streamsize maxChunkSize = File::MAX_READ_SIZE;
+
+    /** Let the source file push its content when it supports streaming (see File::openStream()),
+        instead of requesting each chunk. The count of chunks pushed without being acknowledged
+        is then maxReadsInFlight and their size is initialChunkSize.
+    **/
+    bool allowStreaming = true;
+
+    /** Time without any streamed chunk, while chunks are expected, after which the copy fails.
+        Zero disables the check.
+    **/
+    std::chrono::milliseconds streamStallTimeout{ 30000 };
+
+    /** Request the chunks compressed when the source file supports it (see File::readCompressed()).
+        Worth it for compressible content going through a slow link. Streaming is not used in that case.
+    **/
+    bool allowCompression = false;
+
+    /** Let the system copy the file when the source is a file opened in this process
+        (see openLocalFile()): the copy is done by cloning the file blocks or by the kernel,
+        without going through read().
+    **/
+    bool allowKernelCopy = true;
+
+    /// Class of the transfer for the process-wide transfer scheduler, see setTransferSchedulerLimits().
+    TransferPriority priority = TransferPriority_Normal;
+
+    /** Maximum count of received chunks waiting to be written to the local file.
+        The chunks are written by a dedicated stage so that receiving the next chunks overlaps the writes.
+        Once this count is reached, no more data is requested until the writes catch up.
+    **/
+    unsigned int maxQueuedWrites = 4;
+
+    /// When the data written to the local file must reach the storage device.
+    FileSyncPolicy syncPolicy = FileSyncPolicy_None;
+
+    /** Look the content of the source file up in the process-wide copy cache before transferring it,
+        and add it to the cache once transferred (see setFileCopyCache()). Only used for remote source files
+        providing their digest, when the cache is configured.
+    **/
+    bool useCopyCache = true;
+
+    /** Also publish the telemetry to the notifier of the source file (see File::operationProgress()),
+        along with each progress notification. Costs one more call to the source for each notification.
+    **/
+    bool publishRemoteTelemetry = false;
+  };
+
+  /** Limits on the rate of the progress notifications of a file operation.
+      A progress update is notified only once both limits are reached since the last notified progress,
+      otherwise it is held back and merged with the next updates. The completion of the operation
+      and the final state of the operation are always notified.
+      @see FileOperation::setProgressNotificationPolicy()
+
+      @includename{qicore/file.hpp}
+  **/
+  struct ProgressNotificationPolicy
+  {
+    /// Minimum time between two progress notifications, no limit if zero.
+    std::chrono::milliseconds minInterval{ 0 };
+
+    /// Minimum increase of progress between two progress notifications, no limit if zero.
+    double minProgressDelta = 0.0;
+  };
+
+  /** Combine the progress of several operations run as one job into a single notifier.
+      Each child notifier is attached with a weight, usually the count of bytes its operation transfers:
+      the combined progress is the weighted average of the progress of the children, the ended children
+      counting as complete. Only the combined notifier has to be observed, its progress being published
+      at the rate allowed by the notification policy.
+      The combined notifier is running once a child is running, and ends once all the children have ended:
+      failed if one of them failed, otherwise canceled if one of them was canceled, otherwise finished.
+      @remark Attach all the children before starting their operations, the job would end early otherwise.
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API ProgressAggregator
+  {
+  public:
+    /** Constructor.
+        @param policy   Limits on the rate of the progress notifications of the combined notifier.
+    **/
+    explicit ProgressAggregator(ProgressNotificationPolicy policy = {});
+
+    /// Stop following the children, the combined notifier keeps its last state.
+    ~ProgressAggregator();
+
+    ProgressAggregator(const ProgressAggregator&) = delete;
+    ProgressAggregator& operator=(const ProgressAggregator&) = delete;
+
+    /// @return The combined notifier, to share with the observers of the job.
+    ProgressNotifierPtr notifier() const;
+
+    /** Follow the progress and status of an operation of the job.
+        Throws a std::runtime_error if the job has already ended.
+        @param child    Notifier of the operation, local or remote.
+        @param weight   Share of the operation in the job, usually its count of bytes. Zero counts as one.
+    **/
+    void attach(ProgressNotifierPtr child, std::uint64_t weight);
+
+  private:
+    class Impl;
+    boost::shared_ptr<Impl> _impl;
+  };
+
   /** Base type for file operation exposing information about its progress state.
       Exposes a ProgressNotifier, associated to the operation.
 
       @includename{qicore/file.hpp}
   **/
-  class FileOperation
+  class QICORE_API FileOperation
   {
   public:
     /** Destructor.
         Cancel the operations's task if is still running and this object is valid.
     **/
-    virtual ~FileOperation()
-    {
-      auto task = std::move(_task);
-      if (task)
-      {
-        task->promise.future().cancel();
-      }
-    }
+    virtual ~FileOperation();
 
     // Move only
     FileOperation(const FileOperation&) = delete;
@@ -58,20 +376,7 @@ namespace qi
 
         @return A future corresponding to the end of the operation.
     **/
-    qi::Future<void> start()
-    {
-      if (!_task)
-      {
-        throw std::runtime_error{ "Tried to start an invalid FileOperation" };
-      }
-
-      if (_task->isLaunched.swap(true))
-      {
-        throw std::runtime_error{ "Called FileOperation::start() more than once!" };
-      }
-
-      return _task->run();
-    }
+    qi::Future<void> start();
 
     /** Detach the running operation from this object.
         Useful to dissociate the on-going operation from the lifetime of the object,
@@ -84,24 +389,7 @@ namespace qi
 
         @return A future corresponding to the end of the operation.
     **/
-    qi::Future<void> detach()
-    {
-      boost::shared_ptr<Task> sharedTask = std::move(_task);
-
-      if (!sharedTask)
-      {
-        throw std::runtime_error("Called FileOperation::detach() but no task is owned!");
-      }
-
-      if (!sharedTask->isLaunched._value)
-      {
-        throw std::runtime_error("Called FileOperation::detach() but task was not started!");
-      }
-
-      auto future = sharedTask->promise.future();
-      future.connect([sharedTask](const Future<void>&){}); // keep the task alive until it ends
-      return future;
-    }
+    qi::Future<void> detach();
 
     /// Call operator: calls start()
     auto operator()() -> decltype(start()) { return start(); }
@@ -109,7 +397,14 @@ namespace qi
     /** @returns A progress notifier associated to the operation if the operation's task is owned
                  and this object is valid, null otherwise.
     **/
-    ProgressNotifierPtr notifier() const { return _task ? _task->localNotifier : ProgressNotifierPtr{}; }
+    ProgressNotifierPtr notifier() const;
+
+    /** Limit the rate of the progress notifications, of both the notifier() of the operation
+        and the notifier of the source file, which is a remote call when the file is remote.
+        By default, every progress update is notified. Can be called while the operation is running.
+        Throws a std::runtime_error if this object is in an invalid state.
+    **/
+    void setProgressNotificationPolicy(const ProgressNotificationPolicy& policy);
 
     /** @returns True if this object is in a valid state, false otherwise.
                  In an invalid state, all of this object's member function calls will result in exception thrown
@@ -122,68 +417,7 @@ namespace qi
     explicit operator bool() const { return isValid(); }
 
   protected:
-    struct Task
-      : public boost::enable_shared_from_this<Task>
-    {
-      Task(FilePtr file)
-        : sourceFile{ std::move(file) }
-        , fileSize{ sourceFile->size() }
-        , promise{ PromiseNoop<void> }
-        , localNotifier{ createProgressNotifier(promise.future()) }
-        , remoteNotifier{ sourceFile->operationProgress() }
-        , isRemoteDeprecated(sourceFile.metaObject().findMethod("read").empty())
-      {
-      }
-
-      virtual ~Task() = default;
-
-      qi::Future<void> run()
-      {
-        localNotifier->reset();
-        isRemoteDeprecated ? remoteNotifier->_reset() : remoteNotifier->reset();
-        localNotifier->notifyRunning();
-        isRemoteDeprecated ? remoteNotifier->_notifyRunning() : remoteNotifier->notifyRunning();
-        start();
-        return promise.future();
-      }
-
-      void finish()
-      {
-        promise.setValue(0);
-        localNotifier->notifyFinished();
-        isRemoteDeprecated ? remoteNotifier->_notifyFinished() : remoteNotifier->notifyFinished();
-      }
-
-      void fail(const std::string& errorMessage)
-      {
-        promise.setError(errorMessage);
-        localNotifier->notifyFailed();
-        isRemoteDeprecated ? remoteNotifier->_notifyFailed() : remoteNotifier->notifyFailed();
-      }
-
-      void cancel()
-      {
-        promise.setCanceled();
-        localNotifier->notifyCanceled();
-        isRemoteDeprecated ? remoteNotifier->_notifyCanceled() : remoteNotifier->notifyCanceled();
-      }
-
-      void notifyProgressed(double newProgress)
-      {
-        localNotifier->notifyProgressed(newProgress);
-        isRemoteDeprecated ? remoteNotifier->_notifyProgressed(newProgress) : remoteNotifier->notifyProgressed(newProgress);
-      }
-
-      virtual void start() = 0;
-
-      qi::Atomic<bool> isLaunched{ false };
-      const FilePtr sourceFile;
-      const std::streamsize fileSize;
-      Promise<void> promise;
-      const ProgressNotifierPtr localNotifier;
-      const ProgressNotifierPtr remoteNotifier;
-      const bool isRemoteDeprecated;
-    };
+    struct Task;
 
     using TaskPtr = boost::shared_ptr<Task>;
 
@@ -194,6 +428,9 @@ namespace qi
         throw std::runtime_error("FileOperation requires a non-null task on constrution.");
     }
 
+    /// @returns The task of the operation, null if this object is in an invalid state.
+    const TaskPtr& task() const { return _task; }
+
   private:
     TaskPtr _task;
   };
@@ -203,119 +440,351 @@ namespace qi
   /// Pointer to a file operation with sharing semantic.
   using FileOperationPtr = Object<FileOperation>;
 
-  /** Copies a potentially remote file to the local file system. */
-  class FileCopyToLocal
+  /** Stage consuming the content of a file while it is copied, so that the content does not have to be
+      read again once copied. The content is provided in order, in pieces of any size.
+      @see FileCopyToLocal::addSink()
+      @includename{qicore/file.hpp}
+  **/
+  class FileSink
+  {
+  public:
+    virtual ~FileSink() = default;
+
+    /// Consume the next bytes of the content. Throws a std::runtime_error to make the operation fail.
+    virtual void write(const Buffer& data) = 0;
+
+    /// Called once the whole content has been consumed. Throws a std::runtime_error to make the operation fail.
+    virtual void finish() {}
+
+    /// Called instead of finish() when the operation fails or is canceled.
+    virtual void abort() {}
+  };
+
+  /// Pointer to a sink shared by the operation and the owner of the sink, to get its result.
+  using FileSinkPtr = boost::shared_ptr<FileSink>;
+
+  /** Compute the digest of the content, as returned by File::digest().
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API DigestFileSink : public FileSink
+  {
+  public:
+    DigestFileSink();
+    ~DigestFileSink();
+
+    void write(const Buffer& data) override;
+
+    /// @return The digest of the content consumed so far.
+    std::string digest() const;
+
+  private:
+    class Impl;
+    std::unique_ptr<Impl> _impl;
+  };
+
+  /** Keep the content in memory.
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API MemoryFileSink : public FileSink
+  {
+  public:
+    /// @param maxSize   Maximum count of bytes to keep, more content makes the operation fail.
+    explicit MemoryFileSink(std::size_t maxSize);
+
+    void write(const Buffer& data) override;
+    void abort() override;
+
+    /// @return The content consumed so far.
+    const Buffer& content() const;
+
+  private:
+    const std::size_t _maxSize;
+    Buffer _content;
+  };
+
+  /** Write the content to a second local file.
+      The file is written aside and only replaces the destination once the whole content has been written.
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API TeeFileSink : public FileSink
+  {
+  public:
+    /// Throws a std::runtime_error if the file cannot be created.
+    explicit TeeFileSink(const Path& localPath);
+    ~TeeFileSink();
+
+    void write(const Buffer& data) override;
+    void finish() override;
+    void abort() override;
+
+  private:
+    class Impl;
+    std::unique_ptr<Impl> _impl;
+  };
+
+  /** Uncompress the content, in the zlib or gzip format, and provide the uncompressed data to other sinks.
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API UncompressingFileSink : public FileSink
+  {
+  public:
+    /// @param sinks   Sinks consuming the uncompressed data.
+    explicit UncompressingFileSink(std::vector<FileSinkPtr> sinks);
+    ~UncompressingFileSink();
+
+    void write(const Buffer& data) override;
+    void finish() override;
+    void abort() override;
+
+  private:
+    class Impl;
+    std::unique_ptr<Impl> _impl;
+  };
+
+  /** Copies a potentially remote file to the local file system.
+      Several reads are kept in flight, as configured by the FileTransferOptions,
+      and their data is written at its position in the local file as soon as it is received.
+  **/
+  class QICORE_API FileCopyToLocal
     : public FileOperation
   {
+    friend class FileBatchCopyToLocal;
+
   public:
     /** Constructor.
         @param file        Access to a potentially remote file to copy to the local file system.
         @param localPath   Local file system location where the specified file will be copied.
                            No file or directory should be located at this path otherwise
                            the operation will fail.
+        @param options     Tuning of the reads fetching the content of the file.
+    **/
+    FileCopyToLocal(qi::FilePtr file, qi::Path localPath, FileTransferOptions options = {});
+
+    /** Provide the content to a sink while it is copied, in a single pass.
+        The sinks are fed in order once the data is written in the local file, and finished before the operation
+        ends: a sink failing makes the operation fail. The whole content is transferred when there are sinks,
+        the copy is neither made by the system nor taken from the copy cache.
+        Must be called before the operation starts. Throws a std::runtime_error if this object is in an invalid
+        state, if the operation does not transfer the whole content (resumed copies, synchronizations), or if it
+        does not receive the content in order (parallel copies).
+    **/
+    void addSink(FileSinkPtr sink);
+
+    /** @returns Count of bytes received through the link to the source file so far,
+                 which is less than receivedBytes() when chunks are compressed.
     **/
-    FileCopyToLocal(qi::FilePtr file, qi::Path localPath)
-      : FileOperation(boost::make_shared<Task>(std::move(file), std::move(localPath)))
+    std::streamsize receivedWireBytes() const;
+
+    /// @returns Count of bytes of the content of the source file received so far.
+    std::streamsize receivedBytes() const;
+
+  protected:
+    class Task;
+
+    explicit FileCopyToLocal(TaskPtr task)
+      : FileOperation(std::move(task))
     {
     }
 
   private:
-    class Task
-      : public FileOperation::Task
+    Task& copyTask() const;
+  };
+
+  /** Copies a potentially remote file to the local file system by fetching several
+      parts of the file concurrently.
+      The file is split in contiguous ranges of bytes which are each read sequentially,
+      all the ranges being fetched at the same time. The local file is first extended to the size
+      of the source file, then each received chunk is written at its own position.
+      Progress is reported for the whole file.
+  **/
+  class QICORE_API FileParallelCopyToLocal
+    : public FileCopyToLocal
+  {
+  public:
+    /** Constructor.
+        @param file         Access to a potentially remote file to copy to the local file system.
+        @param localPath    Local file system location where the specified file will be copied.
+                            No file or directory should be located at this path otherwise
+                            the operation will fail.
+        @param rangeCount   Count of ranges of the file to fetch concurrently.
+        @param options      Tuning of the reads fetching the content of the file.
+                            The count of reads in flight is the count of ranges.
+    **/
+    FileParallelCopyToLocal(qi::FilePtr file, qi::Path localPath, unsigned int rangeCount = 4,
+                            FileTransferOptions options = {});
+
+  private:
+    class Task;
+  };
+
+  /** Copies a potentially remote file to the local file system, in a way that can be resumed
+      after a failure without fetching again the data already received.
+      Next to the local file, a manifest records the checksum of each chunk written in the local file.
+      On failure or cancelation, the partial local file and its manifest are kept:
+      a new operation with the same source and local path checks the chunks already written
+      against the manifest and only fetches the missing or corrupted ones.
+      The manifest records the digest of the source (see File::digest()): the partial copy of
+      another content is discarded, as well as any partial copy when the source has no digest.
+      Once all the chunks are received, the whole local file is verified against the manifest
+      and against the digest of the source, then the manifest is removed.
+  **/
+  class QICORE_API FileResumableCopyToLocal
+    : public FileCopyToLocal
+  {
+  public:
+    /** Constructor.
+        @param file        Access to a potentially remote file to copy to the local file system.
+        @param localPath   Local file system location where the specified file will be copied.
+                           Can be the location of a partial copy made by a previous operation.
+        @param options     Tuning of the reads fetching the content of the file.
+                           The chunks have a fixed size: the initialChunkSize.
+    **/
+    FileResumableCopyToLocal(qi::FilePtr file, qi::Path localPath, FileTransferOptions options = {});
+
+    /// @returns The location of the manifest associated to a partial copy located at localPath.
+    static qi::Path manifestPath(const qi::Path& localPath)
     {
-    public:
-      Task(FilePtr sourceFile, qi::Path localFilePath)
-        : FileOperation::Task(std::move(sourceFile))
-        , localPath(std::move(localFilePath))
-      {
-      }
-
-      void start() override
-      {
-        if (makeLocalFile())
-        {
-          fetchData();
-        }
-      }
-
-      void stop()
-      {
-        localFile.close();
-        finish();
-      }
-
-      bool makeLocalFile()
-      {
-        if (localPath.isEmpty()) {
-          return true;
-        }
-
-        localFile.open(localPath.bfsPath(), std::ios::out | std::ios::binary);
-        if (!localFile.is_open())
-        {
-          fail("Failed to create local file copy.");
-          return false;
-        }
-        return true;
-      }
-
-      void write(Buffer buffer)
-      {
-        if (localFile.is_open())
-          localFile.write(static_cast<const char*>(buffer.data()), buffer.totalSize());
-        else
-          std::cout.write(static_cast<const char*>(buffer.data()), buffer.totalSize());
-        bytesWritten += buffer.totalSize();
-        assert(fileSize >= bytesWritten);
-
-        const double progress = static_cast<double>(bytesWritten) / static_cast<double>(fileSize);
-        notifyProgressed(progress);
-      }
-
-      void fetchData()
-      {
-        static const size_t ARBITRARY_BYTES_TO_READ_PER_CYCLE = 512 * 1024;
-        auto myself = shared_from_this();
-
-        const auto readFuncName = isRemoteDeprecated ? "_read" : "read";
-
-        sourceFile.async<Buffer>(readFuncName, bytesWritten, ARBITRARY_BYTES_TO_READ_PER_CYCLE)
-          .connect([this, myself](Future<Buffer> futureBuffer)
-        {
-          if (futureBuffer.hasError())
-          {
-            fail(futureBuffer.error());
-            clearLocalFile();
-            return;
-          }
-          if (promise.isCancelRequested())
-          {
-            clearLocalFile();
-            cancel();
-            return;
-          }
-
-          write(futureBuffer.value());
-          if (bytesWritten < fileSize)
-            fetchData();
-          else
-            stop();
-        }
-        );
-      }
-
-      void clearLocalFile()
-      {
-        if (localFile.is_open())
-          localFile.close();
-        boost::filesystem::remove(localPath);
-      }
-
-      boost::filesystem::ofstream localFile;
-      std::streamsize bytesWritten = 0;
-      const qi::Path localPath;
-    };
+      return qi::Path(localPath.str() + ".qicopy");
+    }
+
+  private:
+    class Task;
+  };
+
+  /** Copies a potentially remote file in memory, instead of the local file system.
+      The whole content is allocated at once, then each chunk received is written at its own position:
+      the reads are pipelined as for a copy to a local file.
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API FileCopyToMemory
+    : public FileCopyToLocal
+  {
+  public:
+    /// Maximum size of the copies made by default, in bytes.
+    static const std::size_t DEFAULT_MAX_SIZE = 64 * 1024 * 1024;
+
+    /** Constructor.
+        @param file        Access to a potentially remote file to copy in memory.
+        @param maxSize     Maximum count of bytes of the file: the operation fails if the file is bigger.
+        @param options     Tuning of the reads fetching the content of the file.
+    **/
+    FileCopyToMemory(qi::FilePtr file, std::size_t maxSize = DEFAULT_MAX_SIZE, FileTransferOptions options = {});
+
+    /** Starts the operation's task, see FileOperation::start().
+        @return A future set to the content of the file at the end of the operation.
+                Canceling it cancels the operation.
+    **/
+    qi::Future<Buffer> start();
+
+    /** Detach the running operation from this object, see FileOperation::detach().
+        @return A future set to the content of the file at the end of the operation.
+    **/
+    qi::Future<Buffer> detach();
+
+    /// Call operator: calls start()
+    auto operator()() -> decltype(start()) { return start(); }
+
+  private:
+    class Task;
+  };
+
+  /** Updates the local copy of a potentially remote file by transferring only the parts which changed, like rsync.
+      The signatures of the blocks of the local copy are sent to the source file, which finds them at any position
+      in its content (see File::matchBlocks()). The new version of the local copy is built aside, from the blocks
+      found and the data read for the rest, then replaces the local copy at once: the local copy is left untouched
+      if the operation fails or is canceled.
+      The whole file is transferred if there is no local copy yet or if the source file cannot match blocks.
+
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API FileSyncToLocal
+    : public FileCopyToLocal
+  {
+  public:
+    /** Constructor.
+        @param file        Access to a potentially remote file to synchronize the local copy with.
+        @param localPath   Local file system location of the copy to update, created if there is no file there.
+        @param blockSize   Count of bytes of the blocks looked up in the source file. Smaller blocks find more
+                           of the local copy but cost more signatures. Chosen from the size of the local copy if 0.
+        @param options     Tuning of the reads fetching the parts of the file which changed.
+    **/
+    FileSyncToLocal(qi::FilePtr file, qi::Path localPath, std::streamsize blockSize = 0, FileTransferOptions options = {});
+
+    /// @returns The location where the new version of a local copy located at localPath is built.
+    static qi::Path temporaryPath(const qi::Path& localPath)
+    {
+      return qi::Path(localPath.str() + ".qisync");
+    }
+
+    /// @returns Count of bytes of the local copy reused instead of being transferred, known once the data is fetched.
+    std::streamsize reusedBytes() const;
+
+  protected:
+    class Task;
+  };
+
+  /** Copies many potentially remote files to the local file system as a single operation.
+      The reads of all the copies share a single budget of reads in flight (FileTransferOptions::maxReadsInFlight),
+      and the copies with the fewest bytes left get the free reads first: small files are copied
+      while the reads of large files are in flight, instead of waiting for them.
+      At most maxReadsInFlight copies are running at the same time.
+
+      The operation fails if any copy fails, once all of them have ended. The result of each
+      copy is provided by itemResults(), and the source files notify the progress of their own copy.
+
+      @includename{qicore/file.hpp}
+  **/
+  class QICORE_API FileBatchCopyToLocal
+    : public FileOperation
+  {
+  public:
+    /// A file to copy and the local file system location where it will be copied.
+    using Item = std::pair<FilePtr, Path>;
 
+    /** Constructor.
+        @param items       Files to copy with their local destination. No file or directory should be
+                           located at the destinations, otherwise the copy of the corresponding file will fail.
+        @param options     Tuning of the reads fetching the content of the files, maxReadsInFlight
+                           bounds the reads in flight of all the copies. Streaming is not used.
+    **/
+    explicit FileBatchCopyToLocal(std::vector<Item> items, FileTransferOptions options = {});
+
+    /** @returns The futures of the copy of each item, in the order of the items.
+        Throws a std::runtime_error if this object is in an invalid state.
+    **/
+    std::vector<Future<void>> itemResults() const;
+
+  private:
+    class Task;
+    class ItemTask;
+
+    using ItemTaskPtr = boost::shared_ptr<ItemTask>;
+  };
+
+  /** Copies a potentially remote file to a potentially remote writable file, see WritableFile.
+      The chunks are read from the source file and pushed to the destination with several writes in flight,
+      as configured by the FileTransferOptions, so that the far end never has to request the data.
+      Once all the chunks are written, the destination is committed: its content replaces the destination file
+      at once. The destination is discarded if the operation fails or is canceled.
+  **/
+  class QICORE_API FileCopyToRemote
+    : public FileOperation
+  {
+  public:
+    /** Constructor.
+        @param file          Access to a potentially remote file to copy.
+        @param destination   Potentially remote file to write the content of the file to, which should not have
+                             been written yet. It is committed or discarded by the operation.
+        @param options       Tuning of the transfer: maxReadsInFlight bounds the count of chunks being read
+                             or written at the same time and initialChunkSize is the size of the chunks.
+    **/
+    FileCopyToRemote(FilePtr file, WritableFilePtr destination, FileTransferOptions options = {});
+
+    /// @returns Count of bytes of the content of the source file written to the destination so far.
+    std::streamsize sentBytes() const;
+
+  protected:
+    class Task;
   };
 
   /** Copy an open local or remote file to a local file system location.
@@ -326,6 +795,20 @@ namespace qi
   *   @return A synchronous future associated with the operation.
   **/
   QICORE_API FutureSync<void> copyToLocal(FilePtr file, Path localPath);
+
+  /** Copy an open local or remote file in memory.
+  *   @param file         Source file to copy.
+  *   @param maxSize      Maximum count of bytes of the file: the operation fails if the file is bigger.
+  *   @return A synchronous future set to the content of the file.
+  **/
+  QICORE_API FutureSync<Buffer> copyToMemory(FilePtr file, std::size_t maxSize = FileCopyToMemory::DEFAULT_MAX_SIZE);
+
+  /** Copy an open local or remote file to a potentially remote writable file, then commit it.
+  *   @param file         Source file to copy.
+  *   @param destination  File to write the content of the source file to, see WritableFile.
+  *   @return A synchronous future associated with the operation.
+  **/
+  QICORE_API FutureSync<void> copyToRemote(FilePtr file, WritableFilePtr destination);
 }
 
 #include <qi/detail/warn_pop_ignore_deprecated.hpp>
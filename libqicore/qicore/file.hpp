@@ -8,6 +8,10 @@
 
 #include <iosfwd>
 #include <cassert>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <qicore/api.hpp>
 #include <qi/anyobject.hpp>
@@ -20,6 +24,22 @@
 
 namespace qi
 {
+/** Measures of the data transfer performed by an operation.
+*   @see ProgressNotifier::telemetry
+*   @includename{qicore/file.hpp}
+**/
+struct TransferTelemetry
+{
+  std::int64_t bytesTransferred = 0;      ///< Count of bytes transferred by the operation so far.
+  double throughput = 0.0;                ///< Bytes per second since the previous measures.
+  double averageThroughput = 0.0;         ///< Bytes per second since the start of the operation.
+  double readLatencyMedian = 0.0;         ///< Seconds between a read request and its data, 50th percentile.
+  double readLatency90 = 0.0;             ///< Seconds between a read request and its data, 90th percentile.
+  double readLatency99 = 0.0;             ///< Seconds between a read request and its data, 99th percentile.
+  double localWriteTime = 0.0;            ///< Total seconds spent writing the data locally.
+  double estimatedTimeRemaining = -1.0;   ///< Seconds before the end of the transfer, negative if unknown.
+};
+
 /** Provide information about the state of a potentially long remote or async operation.
 *   @includename{qicore/file.hpp}
 **/
@@ -53,6 +73,12 @@ public:
   *   and could be different from the default but should then be documented.
   **/
   Property<double> progress;
+
+  /** Measures of the data transfer performed by the operation associated with this notifier,
+  *   updated along with its progress. Operations which do not transfer data leave it untouched.
+  **/
+  Property<TransferTelemetry> telemetry;
+
   /** @returns true if the operation associated to this notifier has started
   *            and is neither finished nor canceled nor failed yet, false otherwise.
   **/
@@ -99,6 +125,12 @@ public:
   **/
   virtual void notifyProgressed(double newProgress) = 0;
 
+  /** Notify the observers of new measures of the transfer performed by the operation.
+      By default, sets the telemetry property.
+      @remark This function is reserved to be used by the implementation of the associated operations.
+  **/
+  virtual void notifyTelemetry(const TransferTelemetry& newTelemetry);
+
   /**
    * @deprecated since 2.5
    **/
@@ -119,6 +151,40 @@ using ProgressNotifierPtr = qi::Object<ProgressNotifier>;
 */
 QICORE_API ProgressNotifierPtr createProgressNotifier(Future<void> operationFuture = {});
 
+/** Content of a file pushed chunk by chunk to the receiver which opened the stream, see File::openStream().
+*   Chunks are only emitted in exchange of credits granted with addCredits(), one credit per chunk,
+*   which lets the receiver control the amount of data in flight.
+*   The stream ends by itself once its last chunk has been emitted, when it is stopped,
+*   when its file is closed or when the last reference to it is released.
+*   @includename{qicore/file.hpp}
+**/
+class QICORE_API FileStream
+{
+protected:
+  FileStream() = default;
+
+public:
+  virtual ~FileStream() = default;
+
+  /** Allow the stream to emit more chunks.
+  *   The chunks are emitted before this call returns. Does nothing if the stream ended.
+  *
+  *   @param credits                Count of additional chunks the stream is allowed to emit.
+  **/
+  virtual void addCredits(unsigned int credits) = 0;
+
+  /// Stop the stream before its end. Does nothing if the stream already ended.
+  virtual void stop() = 0;
+
+  /** Emitted with each chunk of the stream: position of the chunk in the file and content of the chunk.
+  *   @remark To receive chunks of a remote stream, connect through the object: `stream.connect("chunkStreamed", ...)`.
+  **/
+  Signal<std::streamoff, Buffer> chunkStreamed;
+};
+
+/// Pointer to a file stream with shared/remote semantic.
+using FileStreamPtr = qi::Object<FileStream>;
+
 /** Provide access to the content of a local or remote file.
 *   @includename{qicore/file.hpp}
 *   @remark Should be obtained using openLocalFile()
@@ -142,6 +208,18 @@ public:
   /** @return true if the file is located on a remote filesystem, false otherwise. */
   virtual bool isRemote() const = 0;
 
+  /** Identify the content of the file: files with the same content have the same digest.
+  *   The digest is computed with SHA-256 once per opened file: the first call reads and hashes
+  *   the whole file, which takes about as long as reading it from the disk, the next ones return
+  *   the same digest.
+  *   @warning Throws a std::runtime_error if the file is closed.
+  *
+  *   The default implementation reads the whole file through read() at each call.
+  *
+  *   @return "sha256-" followed by the hash of the content in 64 hexadecimal digits.
+  **/
+  virtual std::string digest();
+
   /** Provide the progress notifier used by the operations manipulating this file.
   *   The notifier is associated with this file. Therefore, no concurrent operation should be
   *   used by this notifier object, as it is not safe to have concurrent operations
@@ -169,11 +247,12 @@ public:
   virtual Buffer read(std::streamsize countBytesToRead) = 0;
 
   /** Read a specified count of bytes starting from a specified byte position in the file.
+  *   This read is positional: the read cursor is neither used nor modified,
+  *   which makes it safe to call concurrently on the same file.
   *   @warning If you try to read more than _MAX_READ_SIZE bytes, this call will throw a std::runtime_error.
   *
   *   @param beginOffset            Position in the file to start reading from.
-  *   @param countBytesToRead       Count of bytes to read from the file starting at the current position
-  *                                 of the file cursor.
+  *   @param countBytesToRead       Count of bytes to read from the file starting at beginOffset.
   *   @return A buffer of data read from the file, empty if:
   *           - there is no data in the specified byte range to read
   *           - if the file have been closed;
@@ -184,6 +263,80 @@ public:
   **/
   virtual Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) = 0;
 
+  /** Read a specified count of bytes starting from a specified byte position in the file, without blocking.
+  *   Behaves like read(std::streamoff, std::streamsize). Local files are read by the process-wide disk reader
+  *   threads, which serve the File objects with pending reads in turn: the caller is never blocked by the disk,
+  *   and a client reading through its own File object is not delayed by the bulk reads of other clients.
+  *   The remote calls to the other reads, digest and matchBlocks of a local file are served the same way.
+  *   Errors, including reading more than MAX_READ_SIZE bytes, are reported through the returned future.
+  *
+  *   @param beginOffset            Position in the file to start reading from.
+  *   @param countBytesToRead       Count of bytes to read from the file starting at beginOffset.
+  *   The default implementation calls read(std::streamoff, std::streamsize) before returning.
+  *
+  *   @return A future set to the data read from the file once the read is done.
+  **/
+  virtual Future<Buffer> readAsync(std::streamoff beginOffset, std::streamsize countBytesToRead);
+
+  /// Range of bytes in a file: position of the first byte and count of bytes.
+  using ByteRange = std::pair<std::streamoff, std::streamsize>;
+
+  /** Read several ranges of bytes at once, in a single call.
+  *   Each range is read like with read(std::streamoff, std::streamsize): the read cursor is neither
+  *   used nor modified.
+  *   @warning If the sum of the requested counts of bytes is more than MAX_READ_SIZE,
+  *            this call will throw a std::runtime_error.
+  *
+  *   @param ranges                 Ranges of bytes to read, in any order, overlapping or not.
+  *   @return One buffer per requested range, in the same order than the requested ranges.
+  *           Each buffer contains the available data of its range, as returned by a positional read().
+  *   The default implementation calls read(std::streamoff, std::streamsize) for each range.
+  **/
+  virtual std::vector<Buffer> readMany(const std::vector<ByteRange>& ranges);
+
+  /** Read a specified count of bytes starting from a specified byte position in the file,
+  *   compressed with zlib (deflate format) to reduce the count of bytes to transfer.
+  *   Behaves like read(std::streamoff, std::streamsize), except for the format of the returned data.
+  *   @warning If you try to read more than _MAX_READ_SIZE bytes, this call will throw a std::runtime_error.
+  *
+  *   @param beginOffset            Position in the file to start reading from.
+  *   @param countBytesToRead       Count of bytes to read from the file starting at beginOffset.
+  *   @return A flag set if the data is compressed and the data itself.
+  *           When compressing the data does not make it smaller, it is provided uncompressed.
+  *           The uncompressed size is the count of bytes that read(beginOffset, countBytesToRead)
+  *           would return. The default implementation never compresses the data.
+  **/
+  virtual std::pair<bool, Buffer> readCompressed(std::streamoff beginOffset, std::streamsize countBytesToRead);
+
+  /// Signature of a block of bytes: weak rolling checksum and XXH64 hash of the bytes.
+  using BlockSignature = std::pair<std::uint32_t, std::uint64_t>;
+
+  /// Block found in the file: position of the block in the file and index of its signature.
+  using BlockMatch = std::pair<std::streamoff, std::uint32_t>;
+
+  /** Find in this file the blocks of another version of the file, at any position, like rsync does:
+  *   the blocks are looked up at every byte position with a rolling checksum, then confirmed with their hash.
+  *   @warning Throws a std::runtime_error if blockSize is not in the range ]0, MAX_READ_SIZE].
+  *
+  *   @param blockSize              Count of bytes of each block.
+  *   @param signatures             Signatures of the consecutive blocks of the other version of the file,
+  *                                 as computed by detail::computeBlockSignatures().
+  *   @return The blocks found, by increasing position in this file and not overlapping.
+  *   The default implementation reads the whole file through read().
+  **/
+  virtual std::vector<BlockMatch> matchBlocks(std::streamsize blockSize, const std::vector<BlockSignature>& signatures);
+
+  /** Open a stream pushing the content of the file, chunk by chunk, to the caller only.
+  *   Each stream is its own object: the chunks of a stream are only received by the subscribers of that stream.
+  *   @warning Throws a std::runtime_error if the file is closed, if the chunk size is not in the range
+  *            ]0, MAX_READ_SIZE] or if the file cannot be streamed, which is the case with the default implementation.
+  *
+  *   @param beginOffset            Position in the file of the first chunk of the stream.
+  *   @param chunkSize              Count of bytes of each chunk, only the last chunk can be smaller.
+  *   @return The stream, which starts without any credit.
+  **/
+  virtual FileStreamPtr openStream(std::streamoff beginOffset, std::streamsize chunkSize);
+
   /** Move the read cursor to the specified position in the file.
   *   @param offsetFromBegin      New position of the read cursor in the file.
   *                               If it is out of the range of data in the file,
@@ -212,6 +365,16 @@ public:
 /// Pointer to a file with shared/remote semantic.
 using FilePtr = qi::Object<File>;
 
+/** Strategy used to access the content of a local file.
+*   @see openLocalFile()
+**/
+enum FileAccessMode
+{
+  FileAccessMode_Stream,  ///< The content is read through a file stream.
+  FileAccessMode_Mapped,  ///< Read as a stream: a Buffer owns its storage, so the bytes of a mapping would be
+                          ///< copied as well, and a file truncated while mapped would crash the reader.
+};
+
 /** Open a local file located at the specified path and provide it for reading as a sharable file access.
 *   @warning Throws a std::runtime_exception if the provided path is not an existing file path.
 *
@@ -220,11 +383,160 @@ using FilePtr = qi::Object<File>;
 **/
 QICORE_API FilePtr openLocalFile(const qi::Path& localPath);
 
+/** Open a local file located at the specified path and provide it for reading as a sharable file access.
+*   @warning Throws a std::runtime_exception if the provided path is not an existing file path.
+*
+*   @param localPath              Path to a file on the local file system that can be open.
+*   @param accessMode             Strategy used to access the content of the file.
+*   @return A shareable access to the opened local file.
+**/
+QICORE_API FilePtr openLocalFile(const qi::Path& localPath, FileAccessMode accessMode);
+
+/** Limits of the process-wide pool of the read handles of the local files opened in stream mode.
+*   The local files opened several times share one descriptor per file (same device and inode).
+*   Descriptors not used by a read are kept open for the next reads, the least recently used ones being closed
+*   once the budget is exceeded: they are reopened by path on the next read of their file.
+*   The descriptor of a file renamed, removed or replaced since it was opened is never closed by the pool,
+*   since it could not be reopened: reading such a file goes on with its original content.
+*   @remark Only used on POSIX systems.
+**/
+struct FileHandlePoolLimits
+{
+  /** Count of descriptors kept open, exceeded only while all of them are used by reads
+  *   or lead to files which cannot be reopened.
+  **/
+  unsigned int maxOpenDescriptors = 64;
+};
+
+/// Counters of the process-wide pool of read handles since the start of the process.
+struct FileHandlePoolCounters
+{
+  std::uint64_t opens = 0;          ///< Count of files opened by the pool.
+  std::uint64_t sharedOpens = 0;    ///< Count of openings of a file already opened, served by its shared handle.
+  std::uint64_t reopens = 0;        ///< Count of descriptors reopened after being closed by the pool.
+  std::uint64_t evictions = 0;      ///< Count of idle descriptors closed to respect the budget.
+  unsigned int openDescriptors = 0; ///< Current count of open descriptors.
+  unsigned int fileCount = 0;       ///< Current count of files with a handle in the pool.
+};
+
+/// Change the limits of the process-wide pool of read handles, effective immediately.
+QICORE_API void setFileHandlePoolLimits(const FileHandlePoolLimits& limits);
+
+/// @return The current limits of the process-wide pool of read handles.
+QICORE_API FileHandlePoolLimits fileHandlePoolLimits();
+
+/// @return The current counters of the process-wide pool of read handles.
+QICORE_API FileHandlePoolCounters fileHandlePoolCounters();
+
+/** Counters of the sequential reads of a remote file served by its read-ahead cache.
+*   @see enableReadAhead()
+**/
+struct FileReadAheadStatistics
+{
+  std::uint64_t cacheHits = 0;    ///< Reads served from data already fetched or being fetched.
+  std::uint64_t cacheMisses = 0;  ///< Reads which had to request their data.
+};
+
+/** Serve the sequential reads (File::read(count)) of a remote file from a local cache.
+*   When consecutive reads are detected, the next windows of the file are requested in advance,
+*   so that small sequential reads do not wait for a round trip each.
+*   The read cursor is then tracked locally: enabling read-ahead moves it to the beginning of the file,
+*   the reads served from the cache do not move the cursor of the remote file until read-ahead is disabled.
+*   Positional reads are not affected.
+*
+*   @param file                   A remote file, there is nothing to do for a local file.
+*   @param windowSize             Count of bytes requested by each read-ahead.
+*   @param windowCount            Count of windows kept in the cache, which bounds its memory usage.
+*   @return true if read-ahead has been enabled, false if the file is not a remote file.
+**/
+QICORE_API bool enableReadAhead(const FilePtr& file, std::streamsize windowSize = 256 * 1024,
+                                unsigned int windowCount = 4);
+
+/** Stop serving the reads of a remote file from a local cache and drop the cached data.
+*   The cursor of the remote file is moved to the position of the locally tracked cursor.
+**/
+QICORE_API void disableReadAhead(const FilePtr& file);
+
+/// @return The counters of the read-ahead cache of a remote file since read-ahead was enabled.
+QICORE_API FileReadAheadStatistics readAheadStatistics(const FilePtr& file);
+
+/** Destination of the content of a file, potentially remote, written chunk by chunk.
+*   The content is written to a temporary location and only replaces the destination file once committed,
+*   so that readers of the destination never see a partially written file.
+*   Writes are positional: several writes can be in flight at the same time and complete in any order.
+*   @includename{qicore/file.hpp}
+*   @remark Should be obtained using createLocalFile() or through a service API if the file is potentially remote.
+**/
+class QICORE_API WritableFile
+{
+protected:
+  WritableFile() = default;
+
+public:
+  virtual ~WritableFile() = default;
+
+  /// Maximum count of bytes that you can write by write() call.
+  static const std::streamsize MAX_WRITE_SIZE = File::MAX_READ_SIZE;
+
+  /** Write data at a specified byte position in the file.
+  *   Writing past the end of the file extends it, filling the gap with zeros.
+  *   @warning Throws a std::runtime_error if the data is bigger than MAX_WRITE_SIZE,
+  *            if the file has been committed or discarded or if the data cannot be written.
+  *
+  *   @param beginOffset            Position in the file of the first byte of the data.
+  *   @param data                   Data to write.
+  **/
+  virtual void write(std::streamoff beginOffset, Buffer data) = 0;
+
+  /** Set the size of the file, dropping the data past the new size or filling the new bytes with zeros.
+  *   @warning Throws a std::runtime_error if the file has been committed or discarded or if it cannot be resized.
+  *
+  *   @param newSize                New count of bytes of the file.
+  **/
+  virtual void truncate(std::streamsize newSize) = 0;
+
+  /** Make the written content the content of the destination file, atomically replacing any existing file.
+  *   The content is forced to reach the storage device before the replacement.
+  *   Once committed, the file cannot be written anymore.
+  *   @warning Throws a std::runtime_error if the content cannot be committed, in which case it is discarded.
+  **/
+  virtual void commit() = 0;
+
+  /** Drop the written content, leaving the destination file untouched.
+  *   Does nothing if the file has already been committed or discarded.
+  **/
+  virtual void discard() = 0;
+
+  /// @return Count of bytes of the content written so far, 0 once committed or discarded.
+  virtual std::streamsize size() const = 0;
+
+  /// @return true if the file can still be written, false once it has been committed or discarded.
+  virtual bool isOpen() const = 0;
+};
+
+/// Pointer to a writable file with shared/remote semantic.
+using WritableFilePtr = qi::Object<WritableFile>;
+
+/** Create a file to be written at the specified path of the local file system, as a shareable file access.
+*   The content is written to a temporary file in the same directory, which replaces the file located
+*   at the specified path once committed. Dropping the last reference without committing discards the content.
+*   @warning Throws a std::runtime_error if the temporary file cannot be created.
+*
+*   @param localPath              Path of the file on the local file system once committed.
+*   @return A shareable access to the file to write.
+**/
+QICORE_API WritableFilePtr createLocalFile(const qi::Path& localPath);
+
 }
 
+QI_TYPE_STRUCT(::qi::TransferTelemetry, bytesTransferred, throughput, averageThroughput,
+               readLatencyMedian, readLatency90, readLatency99, localWriteTime, estimatedTimeRemaining);
 QI_TYPE_INTERFACE(File);
+QI_TYPE_INTERFACE(FileStream);
+QI_TYPE_INTERFACE(WritableFile);
 QI_TYPE_INTERFACE(ProgressNotifier);
 QI_TYPE_ENUM(ProgressNotifier::Status);
+QI_TYPE_ENUM(FileAccessMode);
 
 #include <qicore/detail/fileoperation.hxx>
 
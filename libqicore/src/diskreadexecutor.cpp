@@ -0,0 +1,95 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include "diskreadexecutor.hpp"
+
+#include <deque>
+#include <map>
+#include <utility>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+qiLogCategory("qicore.file.diskreadexecutor");
+
+namespace qi
+{
+namespace
+{
+  /** Threads dedicated to the reads of local files, so that a slow storage device blocks neither
+      the event loop threads nor the threads of the messaging layer.
+      Each queue holds the pending jobs of one client, the clients with pending jobs take turns
+      in a round robin. Jobs are always run out of the mutex.
+  **/
+  class DiskReadExecutor
+  {
+  public:
+    static const unsigned int THREAD_COUNT = 4;
+
+    // Never destroyed: the threads may still wait for reads while the static objects are destroyed.
+    static DiskReadExecutor& instance()
+    {
+      static DiskReadExecutor* const executor = new DiskReadExecutor;
+      return *executor;
+    }
+
+    void schedule(const void* clientKey, boost::function<void()> job)
+    {
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        std::deque<boost::function<void()>>& queue = _queues[clientKey];
+        if (queue.empty())
+          _turns.push_back(clientKey);
+        queue.push_back(std::move(job));
+      }
+      _jobScheduled.notify_one();
+    }
+
+  private:
+    DiskReadExecutor()
+    {
+      for (unsigned int threadIndex = 0; threadIndex < THREAD_COUNT; ++threadIndex)
+        boost::thread(&DiskReadExecutor::serve, this).detach();
+    }
+
+    void serve()
+    {
+      while (true)
+        takeNextJob()();
+    }
+
+    boost::function<void()> takeNextJob()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      while (_turns.empty())
+        _jobScheduled.wait(lock);
+
+      const void* const clientKey = _turns.front();
+      _turns.pop_front();
+      const auto queueIt = _queues.find(clientKey);
+      boost::function<void()> job = std::move(queueIt->second.front());
+      queueIt->second.pop_front();
+      if (queueIt->second.empty())
+        _queues.erase(queueIt);
+      else
+        _turns.push_back(clientKey);
+      return job;
+    }
+
+    boost::mutex _mutex;
+    boost::condition_variable _jobScheduled;
+    std::map<const void*, std::deque<boost::function<void()>>> _queues; // only the clients with pending jobs
+    std::deque<const void*> _turns; // keys of the clients with pending jobs, next to serve first
+  };
+}
+
+namespace detail
+{
+  void scheduleDiskJob(const void* clientKey, boost::function<void()> job)
+  {
+    DiskReadExecutor::instance().schedule(clientKey, std::move(job));
+  }
+}
+}
@@ -0,0 +1,58 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#pragma once
+#ifndef _QICORE_SRC_DISKREADEXECUTOR_HPP_
+#define _QICORE_SRC_DISKREADEXECUTOR_HPP_
+
+#include <boost/function.hpp>
+#include <qicore/file.hpp>
+
+namespace qi
+{
+  namespace detail
+  {
+    /// Run a job on the disk reader threads, in the queue of the client. The job must not throw.
+    void scheduleDiskJob(const void* clientKey, boost::function<void()> job);
+  }
+
+  /** Run a read of a local file on the process-wide disk reader threads, out of the calling thread.
+      Each client has its own queue: the reads of a client are run in the order they were scheduled,
+      and the clients with pending reads are served in turn, so a client with many pending reads
+      does not delay the reads of the other clients.
+      Reads whose cancellation is requested before they start are not run.
+      @param clientKey  Identifies the client of the read. Only compared to other keys.
+      @param read       Performs the read, can throw.
+      @return A future set to the result of the read once it is done.
+  **/
+  template <typename T>
+  Future<T> scheduleDiskRead(const void* clientKey, boost::function<T()> read)
+  {
+    Promise<T> promise{ PromiseNoop<T> };
+    detail::scheduleDiskJob(clientKey, [promise, read]() mutable {
+      if (promise.isCancelRequested())
+      {
+        promise.setCanceled();
+        return;
+      }
+
+      try
+      {
+        promise.setValue(read());
+      }
+      catch (const std::exception& ex)
+      {
+        promise.setError(ex.what());
+      }
+      catch (...)
+      {
+        promise.setError("Unknown error while reading a local file.");
+      }
+    });
+    return promise.future();
+  }
+}
+
+#endif
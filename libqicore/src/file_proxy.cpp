@@ -1,9 +1,163 @@
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <boost/thread/mutex.hpp>
 #include <qicore/file.hpp>
 #include <qi/anymodule.hpp>
 #include <qi/detail/warn_push_ignore_deprecated.hpp>
 
 namespace qi
 {
+namespace
+{
+  /** Cache of windows of a remote file, requested ahead of sequential reads.
+      Not thread-safe, calls must be serialized by the owner. The owner waits for the data of a read
+      out of its lock: a read is planned, its data waited for, then it is completed.
+  **/
+  class FileReadAhead
+  {
+  public:
+    struct Window
+    {
+      std::streamoff offset;
+      Future<Buffer> data;
+    };
+
+    struct PlannedRead
+    {
+      std::streamoff beginOffset;
+      std::streamoff endOffset;
+      std::vector<Window> windows; ///< In order, covering the bytes to read.
+      bool isSequential;
+    };
+
+    FileReadAhead(AnyObject file, std::streamsize fileSize, std::streamsize windowSize, unsigned int windowCount)
+      : _file(std::move(file))
+      , _fileSize(fileSize)
+      , _windowSize(std::max<std::streamsize>(windowSize, 1))
+      , _windowCount(std::max(windowCount, 1u))
+    {
+    }
+
+    /// Request the windows which are not cached yet.
+    PlannedRead plan(std::streamoff beginOffset, std::streamsize countBytesToRead)
+    {
+      const std::streamoff endOffset = std::min(beginOffset + std::max(countBytesToRead, std::streamsize(0)), _fileSize);
+      PlannedRead read{ beginOffset, std::max(beginOffset, endOffset), {}, beginOffset == _sequentialEnd };
+      dropWindowsBefore(beginOffset);
+
+      if (countBytesToRead > _windowSize)
+      {
+        // Too big to be worth caching, read it straight.
+        ++_statistics.cacheMisses;
+        read.windows.push_back(Window{ beginOffset, _file.async<Buffer>("read", beginOffset, countBytesToRead) });
+        return read;
+      }
+
+      bool isHit = true;
+      for (std::streamoff offset = beginOffset; offset < read.endOffset;)
+      {
+        auto window = findWindow(offset);
+        if (window == _windows.end())
+        {
+          isHit = false;
+          window = _windows.insert(_windows.end(), Window{ offset, fetch(offset) });
+        }
+        read.windows.push_back(*window);
+        offset = window->offset + _windowSize;
+      }
+      isHit ? ++_statistics.cacheHits : ++_statistics.cacheMisses;
+      return read;
+    }
+
+    /// Wait for the data of a planned read. Throws if a window cannot be fetched.
+    static Buffer waitFor(const PlannedRead& read)
+    {
+      Buffer output;
+      std::streamoff offset = read.beginOffset;
+      for (const auto& window : read.windows)
+      {
+        const Buffer data = window.data.value();
+        const std::streamoff windowEnd = window.offset + static_cast<std::streamsize>(data.totalSize());
+        if (offset >= windowEnd)
+          break; // the file have been truncated since it was opened
+        const std::streamsize byteCount = std::min(read.endOffset, windowEnd) - offset;
+        output.write(static_cast<const char*>(data.data()) + (offset - window.offset), static_cast<size_t>(byteCount));
+        offset += byteCount;
+      }
+      return output;
+    }
+
+    /// Prefetch the next windows after a sequential read, given the count of bytes read.
+    void complete(const PlannedRead& read, std::streamsize byteCount)
+    {
+      _sequentialEnd = read.beginOffset + byteCount;
+      if (read.isSequential)
+        prefetchFrom(_sequentialEnd);
+    }
+
+    /// Drop the windows of a read which failed, so that they are fetched again by the next reads.
+    void abort(const PlannedRead& read)
+    {
+      for (const auto& failedWindow : read.windows)
+      {
+        _windows.erase(std::remove_if(_windows.begin(), _windows.end(), [&](const Window& window) {
+          return window.offset == failedWindow.offset;
+        }), _windows.end());
+      }
+    }
+
+    const FileReadAheadStatistics& statistics() const
+    {
+      return _statistics;
+    }
+
+  private:
+    Future<Buffer> fetch(std::streamoff offset)
+    {
+      return _file.async<Buffer>("read", offset, _windowSize);
+    }
+
+    std::deque<Window>::iterator findWindow(std::streamoff offset)
+    {
+      return std::find_if(_windows.begin(), _windows.end(), [&](const Window& window) {
+        return window.offset <= offset && offset < window.offset + _windowSize;
+      });
+    }
+
+    void dropWindowsBefore(std::streamoff offset)
+    {
+      _windows.erase(std::remove_if(_windows.begin(), _windows.end(), [&](const Window& window) {
+        return window.offset + _windowSize <= offset || window.offset > offset + _windowCount * _windowSize;
+      }), _windows.end());
+    }
+
+    void prefetchFrom(std::streamoff offset)
+    {
+      while (_windows.size() < _windowCount && offset < _fileSize)
+      {
+        const auto window = findWindow(offset);
+        if (window != _windows.end())
+        {
+          offset = window->offset + _windowSize;
+          continue;
+        }
+        _windows.push_back(Window{ offset, fetch(offset) });
+        offset += _windowSize;
+      }
+    }
+
+    AnyObject _file;
+    const std::streamsize _fileSize;
+    const std::streamsize _windowSize;
+    const unsigned int _windowCount;
+    std::deque<Window> _windows;
+    std::streamoff _sequentialEnd = -1;
+    FileReadAheadStatistics _statistics;
+  };
+}
+
 class FileProxy : public File, public qi::Proxy
 {
 public:
@@ -14,9 +168,42 @@ public:
 
   ~FileProxy() = default;
 
+  // The mutex only protects the cursor and the windows: the data is waited for with the mutex unlocked.
   Buffer read(std::streamsize countBytesToRead) override
   {
-    return _obj.call<Buffer>("read", countBytesToRead);
+    boost::mutex::scoped_lock lock(_readAheadMutex);
+    // The remote cursor is used: the other calls must not wait for the remote read.
+    if (!_readAhead)
+    {
+      lock.unlock();
+      return _obj.call<Buffer>("read", countBytesToRead);
+    }
+
+    // The bytes to read are reserved: concurrent reads go on after them.
+    const FileReadAhead::PlannedRead plannedRead = _readAhead->plan(_cursor, countBytesToRead);
+    _cursor = plannedRead.endOffset;
+    lock.unlock();
+
+    Buffer output;
+    try
+    {
+      output = FileReadAhead::waitFor(plannedRead);
+    }
+    catch (...)
+    {
+      lock.lock();
+      if (_readAhead)
+        _readAhead->abort(plannedRead);
+      throw;
+    }
+
+    lock.lock();
+    const std::streamoff readEnd = plannedRead.beginOffset + static_cast<std::streamsize>(output.totalSize());
+    if (_cursor == plannedRead.endOffset)
+      _cursor = readEnd; // the file was truncated, unless another read or a seek moved the cursor since
+    if (_readAhead)
+      _readAhead->complete(plannedRead, static_cast<std::streamsize>(output.totalSize()));
+    return output;
   }
 
   Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) override
@@ -24,13 +211,58 @@ public:
     return _obj.call<Buffer>("read", beginOffset, countBytesToRead);
   }
 
+  Future<Buffer> readAsync(std::streamoff beginOffset, std::streamsize countBytesToRead) override
+  {
+    // Files served by an older version only provide the blocking read.
+    const auto readFuncName = hasMethod("readAsync") ? "readAsync" : "read";
+    return _obj.async<Buffer>(readFuncName, beginOffset, countBytesToRead);
+  }
+
+  // Files served by an older version lack the following members: the default implementations use read().
+
+  std::vector<Buffer> readMany(const std::vector<ByteRange>& ranges) override
+  {
+    if (!hasMethod("readMany"))
+      return File::readMany(ranges);
+    return _obj.call<std::vector<Buffer>>("readMany", ranges);
+  }
+
+  std::pair<bool, Buffer> readCompressed(std::streamoff beginOffset, std::streamsize countBytesToRead) override
+  {
+    if (!hasMethod("readCompressed"))
+      return File::readCompressed(beginOffset, countBytesToRead);
+    return _obj.call<std::pair<bool, Buffer>>("readCompressed", beginOffset, countBytesToRead);
+  }
+
+  std::vector<BlockMatch> matchBlocks(std::streamsize blockSize, const std::vector<BlockSignature>& signatures) override
+  {
+    if (!hasMethod("matchBlocks"))
+      return File::matchBlocks(blockSize, signatures);
+    return _obj.call<std::vector<BlockMatch>>("matchBlocks", blockSize, signatures);
+  }
+
+  FileStreamPtr openStream(std::streamoff beginOffset, std::streamsize chunkSize) override
+  {
+    if (!hasMethod("openStream"))
+      return File::openStream(beginOffset, chunkSize);
+    return _obj.call<FileStreamPtr>("openStream", beginOffset, chunkSize);
+  }
+
   bool seek(std::streamoff offsetFromBegin) override
   {
-    return _obj.call<bool>("seek", offsetFromBegin);
+    if (!_obj.call<bool>("seek", offsetFromBegin))
+      return false;
+    boost::mutex::scoped_lock lock(_readAheadMutex);
+    _cursor = offsetFromBegin;
+    return true;
   }
 
   void close() override
   {
+    {
+      boost::mutex::scoped_lock lock(_readAheadMutex);
+      _readAhead.reset();
+    }
     return _obj.call<void>("close");
   }
 
@@ -54,6 +286,13 @@ public:
     return _obj.call<ProgressNotifierPtr>("operationProgress");
   }
 
+  std::string digest() override
+  {
+    if (!hasMethod("digest"))
+      return File::digest();
+    return _obj.call<std::string>("digest");
+  }
+
   // Deprecated members
   Buffer _read(std::streamsize countBytesToRead) override
   {
@@ -74,12 +313,99 @@ public:
   {
     return _obj.call<void>("_close");
   }
+
+  void enableReadAhead(std::streamsize windowSize, unsigned int windowCount)
+  {
+    _obj.call<bool>("seek", std::streamoff(0));
+    std::unique_ptr<FileReadAhead> readAhead(
+        new FileReadAhead(_obj, _obj.call<std::streamsize>("size"), windowSize, windowCount));
+
+    boost::mutex::scoped_lock lock(_readAheadMutex);
+    _cursor = 0;
+    _readAhead = std::move(readAhead);
+  }
+
+  void disableReadAhead()
+  {
+    std::streamoff cursor = 0;
+    {
+      boost::mutex::scoped_lock lock(_readAheadMutex);
+      if (!_readAhead)
+        return;
+      _readAhead.reset();
+      cursor = _cursor;
+    }
+    _obj.call<bool>("seek", cursor);
+  }
+
+  FileReadAheadStatistics readAheadStatistics() const
+  {
+    boost::mutex::scoped_lock lock(_readAheadMutex);
+    return _readAhead ? _readAhead->statistics() : FileReadAheadStatistics{};
+  }
+
+private:
+  bool hasMethod(const std::string& name) const
+  {
+    return !_obj.metaObject().findMethod(name).empty();
+  }
+
+  mutable boost::mutex _readAheadMutex;
+  std::unique_ptr<FileReadAhead> _readAhead;
+  std::streamoff _cursor = 0; // only used while read-ahead is enabled
+};
+
+bool enableReadAhead(const FilePtr& file, std::streamsize windowSize, unsigned int windowCount)
+{
+  FileProxy* const proxy = dynamic_cast<FileProxy*>(file.operator->());
+  if (!proxy)
+    return false;
+  proxy->enableReadAhead(windowSize, windowCount);
+  return true;
+}
+
+void disableReadAhead(const FilePtr& file)
+{
+  if (FileProxy* const proxy = dynamic_cast<FileProxy*>(file.operator->()))
+    proxy->disableReadAhead();
+}
+
+FileReadAheadStatistics readAheadStatistics(const FilePtr& file)
+{
+  const FileProxy* const proxy = dynamic_cast<const FileProxy*>(file.operator->());
+  return proxy ? proxy->readAheadStatistics() : FileReadAheadStatistics{};
+}
+
+class FileStreamProxy : public FileStream, public qi::Proxy
+{
+public:
+  explicit FileStreamProxy(qi::AnyObject obj)
+    : qi::Proxy(std::move(obj))
+  {
+  }
+
+  ~FileStreamProxy() = default;
+
+  void addCredits(unsigned int credits) override
+  {
+    return _obj.call<void>("addCredits", credits);
+  }
+
+  void stop() override
+  {
+    return _obj.call<void>("stop");
+  }
 };
 
 void _qiregisterFileProxy()
 {
   ::qi::registerProxyInterface<FileProxy, File>();
 }
+
+void _qiregisterFileStreamProxy()
+{
+  ::qi::registerProxyInterface<FileStreamProxy, FileStream>();
+}
 }
 
 #include <qi/detail/warn_pop_ignore_deprecated.hpp>
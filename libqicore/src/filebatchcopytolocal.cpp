@@ -0,0 +1,333 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <boost/weak_ptr.hpp>
+
+#include "filecopytolocal.hpp"
+
+namespace qi
+{
+  class FileBatchCopyToLocal::ItemTask
+    : public FileCopyToLocal::Task
+  {
+  public:
+    ItemTask(Item item, FileTransferOptions transferOptions, std::size_t itemIndex)
+      : FileCopyToLocal::Task(std::move(item.first), std::move(item.second), std::move(transferOptions))
+      , index(itemIndex)
+    {
+    }
+
+    bool takeNextRequest(ReadRequest& request) override;
+    void releaseRequest(const ReadRequest& request) override;
+    void conclude(ChunkOutcome outcome, const std::string& errorMessage, double progress) override;
+
+    const std::size_t index;
+    boost::weak_ptr<FileBatchCopyToLocal::Task> batch;
+  };
+
+  class FileBatchCopyToLocal::Task
+    : public FileOperation::Task
+  {
+  public:
+    static boost::shared_ptr<Task> create(std::vector<Item> items, FileTransferOptions options)
+    {
+      options.maxReadsInFlight = std::max(options.maxReadsInFlight, 1u);
+      options.allowStreaming = false;
+
+      std::vector<ItemTaskPtr> itemTasks;
+      std::streamsize totalSize = 0;
+      for (auto& item : items)
+      {
+        itemTasks.push_back(boost::make_shared<ItemTask>(std::move(item), options, itemTasks.size()));
+        totalSize += itemTasks.back()->fileSize;
+      }
+
+      auto batchTask = boost::make_shared<Task>(std::move(itemTasks), totalSize, options.maxReadsInFlight);
+      for (const auto& itemTask : batchTask->items)
+        itemTask->batch = batchTask;
+      return batchTask;
+    }
+
+    Task(std::vector<ItemTaskPtr> itemTasks, std::streamsize totalSize, unsigned int maxReadsInFlight)
+      : FileOperation::Task(totalSize)
+      , items(std::move(itemTasks))
+      , readBudget(maxReadsInFlight)
+      , itemBytesWritten(items.size(), 0)
+    {
+      // The smallest files are started first.
+      for (std::size_t itemIdx = 0; itemIdx < items.size(); ++itemIdx)
+        itemsToStart.push_back(itemIdx);
+      std::sort(itemsToStart.begin(), itemsToStart.end(), [this](std::size_t left, std::size_t right) {
+        return items[left]->fileSize > items[right]->fileSize;
+      });
+    }
+
+    void start() override
+    {
+      if (items.empty())
+      {
+        finish();
+        return;
+      }
+
+      boost::weak_ptr<Task> weakSelf = boost::static_pointer_cast<Task>(shared_from_this());
+      // Out of the caller, which may be an observer of the progress called with the notification mutex locked.
+      promise.setOnCancel([weakSelf](Promise<void>&) {
+        qi::async<void>([weakSelf] {
+          if (auto self = weakSelf.lock())
+            self->cancelItems();
+        });
+      });
+
+      std::vector<ItemTaskPtr> itemsStarted;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        while (itemsStarted.size() < readBudget && !itemsToStart.empty())
+        {
+          itemsStarted.push_back(items[itemsToStart.back()]);
+          itemsToStart.pop_back();
+        }
+      }
+      for (const auto& item : itemsStarted)
+        startItem(item);
+    }
+
+    void startItem(const ItemTaskPtr& item)
+    {
+      auto myself = shared_from_this();
+      item->promise.future().connect([this, myself](const Future<void>&) { onItemEnded(); });
+      item->run();
+    }
+
+    /** Take a read from the budget shared by the items, or queue the item until one is available.
+        Called with the mutex of the item locked.
+    **/
+    bool acquireRead(ItemTask& item)
+    {
+      const auto itemPtr = boost::static_pointer_cast<ItemTask>(item.shared_from_this());
+      boost::mutex::scoped_lock lock(mutex);
+      const auto granted = std::find(grantedItems.begin(), grantedItems.end(), itemPtr);
+      if (granted != grantedItems.end())
+      {
+        grantedItems.erase(granted);
+        return true;
+      }
+
+      if (readsInFlight < readBudget)
+      {
+        ++readsInFlight;
+        return true;
+      }
+
+      const auto waiting = std::find_if(waitingItems.begin(), waitingItems.end(),
+                                        [&](const WaitingItem& waitingItem) { return waitingItem.item == itemPtr; });
+      if (waiting == waitingItems.end())
+        waitingItems.push_back(WaitingItem{ item.fileSize - item.nextOffset, itemPtr });
+      return false;
+    }
+
+    /** Give a read back to the budget, or to the waiting item with the fewest bytes left.
+        May be called with the mutex of an item locked.
+    **/
+    void releaseRead()
+    {
+      ItemTaskPtr nextItem;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (waitingItems.empty())
+        {
+          --readsInFlight;
+          return;
+        }
+
+        const auto next = std::min_element(waitingItems.begin(), waitingItems.end(),
+                                           [](const WaitingItem& left, const WaitingItem& right) {
+          return left.bytesLeft < right.bytesLeft;
+        });
+        nextItem = next->item;
+        waitingItems.erase(next);
+        grantedItems.push_back(nextItem);
+      }
+
+      // Out of the caller's lock: the item fetches its data under its own mutex.
+      auto myself = shared_from_this();
+      qi::async<void>([this, myself, nextItem] {
+        nextItem->fetchData();
+        revokeGrant(nextItem);
+      });
+    }
+
+    // A granted read that the item did not use, because it ended meanwhile, goes to the next item.
+    void revokeGrant(const ItemTaskPtr& item)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        const auto granted = std::find(grantedItems.begin(), grantedItems.end(), item);
+        if (granted == grantedItems.end())
+          return;
+        grantedItems.erase(granted);
+      }
+      releaseRead();
+    }
+
+    void onItemProgressed(std::size_t itemIdx, double itemProgress)
+    {
+      std::streamsize newBytes = 0;
+      double progress = 1.0;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        const auto itemBytes = static_cast<std::streamsize>(itemProgress * static_cast<double>(items[itemIdx]->fileSize));
+        if (itemBytes > itemBytesWritten[itemIdx])
+        {
+          newBytes = itemBytes - itemBytesWritten[itemIdx];
+          itemBytesWritten[itemIdx] = itemBytes;
+          bytesWritten += newBytes;
+        }
+        if (fileSize > 0)
+          progress = static_cast<double>(bytesWritten) / static_cast<double>(fileSize);
+      }
+
+      meter.addTransferredBytes(newBytes);
+      if (promise.isCancelRequested())
+        cancelItems();
+      else
+        notifyProgressed(progress);
+    }
+
+    void onItemEnded()
+    {
+      ItemTaskPtr nextItem;
+      bool isLastItem = false;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        isLastItem = ++endedItemCount == items.size();
+        if (!itemsToStart.empty() && !promise.isCancelRequested())
+        {
+          nextItem = items[itemsToStart.back()];
+          itemsToStart.pop_back();
+        }
+      }
+
+      if (nextItem)
+        startItem(nextItem);
+      else if (promise.isCancelRequested())
+        cancelItems();
+
+      if (isLastItem)
+        concludeBatch();
+    }
+
+    void cancelItems()
+    {
+      std::vector<ItemTaskPtr> itemsNotStarted;
+      bool isLastItem = false;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        for (const auto itemIdx : itemsToStart)
+          itemsNotStarted.push_back(items[itemIdx]);
+        itemsToStart.clear();
+        // The waiting items are canceled below: no read is handed to them anymore.
+        waitingItems.clear();
+        endedItemCount += itemsNotStarted.size();
+        isLastItem = !itemsNotStarted.empty() && endedItemCount == items.size();
+      }
+
+      for (const auto& item : items)
+        item->promise.future().cancel();
+      for (const auto& item : itemsNotStarted)
+        item->promise.setCanceled();
+      if (isLastItem)
+        concludeBatch();
+    }
+
+    void concludeBatch()
+    {
+      std::size_t failedItemCount = 0;
+      for (const auto& item : items)
+      {
+        if (!item->promise.future().hasValue())
+          ++failedItemCount;
+      }
+
+      if (promise.isCancelRequested())
+      {
+        cancel();
+      }
+      else if (failedItemCount > 0)
+      {
+        std::stringstream message;
+        message << "Failed to copy " << failedItemCount << " of " << items.size() << " files.";
+        fail(message.str());
+      }
+      else
+      {
+        finish();
+      }
+    }
+
+    struct WaitingItem
+    {
+      std::streamsize bytesLeft;
+      ItemTaskPtr item;
+    };
+
+    const std::vector<ItemTaskPtr> items;
+    const unsigned int readBudget;
+    boost::mutex mutex;
+    std::vector<std::size_t> itemsToStart;
+    std::size_t endedItemCount = 0;
+    unsigned int readsInFlight = 0;
+    std::vector<WaitingItem> waitingItems;
+    std::vector<ItemTaskPtr> grantedItems;
+    std::vector<std::streamsize> itemBytesWritten;
+    std::streamsize bytesWritten = 0;
+  };
+
+  bool FileBatchCopyToLocal::ItemTask::takeNextRequest(ReadRequest& request)
+  {
+    const auto batchTask = batch.lock();
+    if (!batchTask || nextOffset >= fileSize || !batchTask->acquireRead(*this))
+      return false;
+
+    if (FileCopyToLocal::Task::takeNextRequest(request))
+      return true;
+    batchTask->releaseRead();
+    return false;
+  }
+
+  void FileBatchCopyToLocal::ItemTask::releaseRequest(const ReadRequest& request)
+  {
+    FileCopyToLocal::Task::releaseRequest(request);
+    if (const auto batchTask = batch.lock())
+      batchTask->releaseRead();
+  }
+
+  void FileBatchCopyToLocal::ItemTask::conclude(ChunkOutcome outcome, const std::string& errorMessage, double progress)
+  {
+    FileCopyToLocal::Task::conclude(outcome, errorMessage, progress);
+    if (const auto batchTask = batch.lock())
+      batchTask->onItemProgressed(index, progress);
+  }
+
+  FileBatchCopyToLocal::FileBatchCopyToLocal(std::vector<Item> items, FileTransferOptions options)
+    : FileOperation(Task::create(std::move(items), std::move(options)))
+  {
+  }
+
+  std::vector<Future<void>> FileBatchCopyToLocal::itemResults() const
+  {
+    if (!task())
+      throw std::runtime_error("Tried to access the results of an invalid FileOperation");
+
+    std::vector<Future<void>> results;
+    for (const auto& item : static_cast<Task&>(*task()).items)
+      results.push_back(item->promise.future());
+    return results;
+  }
+}
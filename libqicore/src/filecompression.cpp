@@ -0,0 +1,55 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include "filecompression.hpp"
+
+#include <sstream>
+#include <vector>
+#include <zlib.h>
+
+namespace qi
+{
+  Buffer compressFileChunk(const Buffer& data)
+  {
+    const uLong dataSize = static_cast<uLong>(data.totalSize());
+    if (dataSize == 0)
+      return {};
+
+    // Favor speed: the data is compressed on the fly for each read.
+    std::vector<Bytef> compressedData(compressBound(dataSize));
+    uLongf compressedSize = static_cast<uLongf>(compressedData.size());
+    const int result = compress2(compressedData.data(), &compressedSize,
+                                 static_cast<const Bytef*>(data.data()), dataSize, Z_BEST_SPEED);
+    if (result != Z_OK || compressedSize >= dataSize)
+      return {};
+
+    Buffer output;
+    output.write(compressedData.data(), compressedSize);
+    return output;
+  }
+
+namespace detail
+{
+  Buffer uncompressFileChunk(const Buffer& compressedData, std::streamsize uncompressedSize)
+  {
+    Buffer output;
+    if (uncompressedSize <= 0)
+      return output;
+
+    Bytef* const data = static_cast<Bytef*>(output.reserve(static_cast<size_t>(uncompressedSize)));
+    uLongf dataSize = static_cast<uLongf>(uncompressedSize);
+    const int result = uncompress(data, &dataSize,
+                                  static_cast<const Bytef*>(compressedData.data()),
+                                  static_cast<uLong>(compressedData.totalSize()));
+    if (result != Z_OK || dataSize != static_cast<uLongf>(uncompressedSize))
+    {
+      std::stringstream message;
+      message << "Failed to uncompress a file chunk (zlib error " << result << ").";
+      throw std::runtime_error(message.str());
+    }
+    return output;
+  }
+}
+}
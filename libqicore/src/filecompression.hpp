@@ -0,0 +1,20 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#pragma once
+#ifndef _QICORE_SRC_FILECOMPRESSION_HPP_
+#define _QICORE_SRC_FILECOMPRESSION_HPP_
+
+#include <qicore/file.hpp>
+
+namespace qi
+{
+  /** Compress a chunk of a file with zlib.
+      @return The compressed data or an empty buffer if compressing does not reduce the size of the data.
+  **/
+  Buffer compressFileChunk(const Buffer& data);
+}
+
+#endif
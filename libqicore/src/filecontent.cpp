@@ -0,0 +1,258 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include "filecontent.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/mutex.hpp>
+
+#ifndef _WIN32
+# include <cerrno>
+# include <cstring>
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#ifdef __linux__
+# include <linux/fs.h>
+# include <sys/ioctl.h>
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+#endif
+
+qiLogCategory("qicore.file.filecontent");
+
+namespace qi
+{
+namespace
+{
+  std::streamsize clampedCount(std::streamsize fileSize, std::streamoff beginOffset, std::streamsize countBytesToRead)
+  {
+    if (beginOffset < 0 || beginOffset >= fileSize || countBytesToRead <= 0)
+      return 0;
+    return std::min(countBytesToRead, fileSize - beginOffset);
+  }
+
+  std::runtime_error openError(const Path& localFilePath, const std::string& reason)
+  {
+    std::stringstream message;
+    message << "Failed to open file " << localFilePath.str() << ": " << reason;
+    return std::runtime_error(message.str());
+  }
+
+#ifndef _WIN32
+  /** Reads are done with pread() which does not use the file descriptor offset.
+      The descriptor is shared with the other openings of the file and pinned only during the reads.
+  **/
+  class DescriptorFileContent : public FileContent
+  {
+  public:
+    explicit DescriptorFileContent(const Path& localFilePath)
+      : _handle(openPooledFile(localFilePath, _size))
+    {
+    }
+
+    PinnedDescriptor pinDescriptor() const override
+    {
+      return pinPooledDescriptor(_handle);
+    }
+
+    std::streamsize size() const override
+    {
+      return _size;
+    }
+
+    Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) const override
+    {
+      const std::streamsize byteCount = clampedCount(_size, beginOffset, countBytesToRead);
+      Buffer output;
+      if (byteCount == 0)
+        return output;
+
+      const PinnedDescriptor fd = pinPooledDescriptor(_handle);
+      char* const data = static_cast<char*>(output.reserve(static_cast<size_t>(byteCount)));
+      std::streamsize bytesRead = 0;
+      while (bytesRead < byteCount)
+      {
+        const ssize_t result = ::pread(*fd, data + bytesRead, static_cast<size_t>(byteCount - bytesRead),
+                                       static_cast<off_t>(beginOffset + bytesRead));
+        if (result < 0 && errno == EINTR)
+          continue;
+        if (result < 0)
+          throw std::runtime_error(std::string("Failed to read file: ") + std::strerror(errno));
+        if (result == 0)
+          break; // the file have been truncated since it was opened
+        bytesRead += result;
+      }
+
+      if (bytesRead == byteCount)
+        return output;
+
+      Buffer truncatedOutput;
+      truncatedOutput.write(data, static_cast<size_t>(bytesRead));
+      return truncatedOutput;
+    }
+
+  private:
+    std::streamsize _size; // set by the opening of the handle
+    const PooledFileHandlePtr _handle;
+  };
+#endif
+
+  /// Portable fallback: the stream cursor is protected so that each read stays positional.
+  class StreamFileContent : public FileContent
+  {
+  public:
+    explicit StreamFileContent(const Path& localFilePath)
+    {
+      _fileStream.open(localFilePath, std::ios::in | std::ios::binary);
+      if (!_fileStream.is_open())
+        throw openError(localFilePath, "cannot open file stream");
+
+      _fileStream.seekg(0, _fileStream.end);
+      _size = _fileStream.tellg();
+      _fileStream.seekg(0, _fileStream.beg);
+    }
+
+    std::streamsize size() const override
+    {
+      return _size;
+    }
+
+    Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) const override
+    {
+      const std::streamsize byteCount = clampedCount(_size, beginOffset, countBytesToRead);
+      Buffer output;
+      if (byteCount == 0)
+        return output;
+
+      boost::mutex::scoped_lock lock(_mutex);
+      _fileStream.clear();
+      _fileStream.seekg(beginOffset);
+      _readBuffer.resize(static_cast<size_t>(byteCount), '\0');
+      _fileStream.read(_readBuffer.data(), byteCount);
+      output.write(_readBuffer.data(), static_cast<size_t>(_fileStream.gcount()));
+      return output;
+    }
+
+  private:
+    mutable boost::mutex _mutex;
+    mutable boost::filesystem::ifstream _fileStream;
+    mutable std::vector<char> _readBuffer;
+    std::streamsize _size;
+  };
+
+#ifdef __linux__
+  /** The data never goes through the process memory: the destination shares the blocks of the source
+      when the file system supports it, otherwise the data is copied by copy_file_range() or sendfile().
+  **/
+  class LinuxKernelFileCopy : public detail::KernelFileCopy
+  {
+  public:
+    LinuxKernelFileCopy(FileContentPtr content, PinnedDescriptor sourceFd, const Path& destinationPath)
+      : _content(std::move(content))
+      , _sourceFd(std::move(sourceFd))
+      , _destinationFd(::open(destinationPath.bfsPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+    {
+      if (_destinationFd < 0)
+        throw openError(destinationPath, std::strerror(errno));
+
+#ifdef FICLONE
+      // The whole file is reported by the first copy.
+      if (::ioctl(_destinationFd, FICLONE, *_sourceFd) == 0)
+        _clonedBytes = _content->size();
+#endif
+    }
+
+    ~LinuxKernelFileCopy()
+    {
+      ::close(_destinationFd);
+    }
+
+    std::streamsize copy(std::streamsize countBytes) override
+    {
+      if (_clonedBytes > 0)
+      {
+        const std::streamsize clonedBytes = _clonedBytes;
+        _offset = clonedBytes;
+        _clonedBytes = 0;
+        return clonedBytes;
+      }
+
+      const std::streamsize byteCount = std::min(countBytes, _content->size() - _offset);
+      if (byteCount <= 0)
+        return 0;
+
+      ssize_t result = -1;
+#ifdef __NR_copy_file_range
+      if (_useCopyFileRange)
+      {
+        loff_t sourceOffset = _offset;
+        loff_t destinationOffset = _offset;
+        result = ::syscall(__NR_copy_file_range, *_sourceFd, &sourceOffset,
+                           _destinationFd, &destinationOffset, static_cast<size_t>(byteCount), 0u);
+        // Not supported by the kernel or between these file systems.
+        if (result < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+          _useCopyFileRange = false;
+      }
+#endif
+      if (!_useCopyFileRange)
+      {
+        off_t sourceOffset = _offset;
+        if (::lseek(_destinationFd, _offset, SEEK_SET) == _offset)
+          result = ::sendfile(_destinationFd, *_sourceFd, &sourceOffset, static_cast<size_t>(byteCount));
+      }
+
+      if (result < 0)
+      {
+        if (errno == EINTR)
+          return copy(countBytes);
+        throw std::runtime_error(std::string("Failed to copy local file: ") + std::strerror(errno));
+      }
+
+      _offset += result;
+      return result;
+    }
+
+  private:
+    const FileContentPtr _content;
+    const PinnedDescriptor _sourceFd;
+    const int _destinationFd;
+    std::streamoff _offset = 0;
+    std::streamsize _clonedBytes = 0; // shared with the source but not reported yet
+    bool _useCopyFileRange = true;
+  };
+#endif
+
+}
+
+// A qi::Buffer owns its storage: the data read from a mapping would be copied as well, so the files are
+// never mapped. A descriptor read fills the buffer with a single copy, without the risk of SIGBUS when
+// the file is truncated while mapped.
+FileContentPtr openFileContent(const Path& localFilePath, FileAccessMode)
+{
+#ifndef _WIN32
+  return boost::make_shared<DescriptorFileContent>(localFilePath);
+#else
+  return boost::make_shared<StreamFileContent>(localFilePath);
+#endif
+}
+
+std::unique_ptr<detail::KernelFileCopy> openKernelFileCopy(FileContentPtr content, const Path& destinationPath)
+{
+#ifdef __linux__
+  // The descriptor stays pinned until the end of the copy.
+  if (PinnedDescriptor sourceFd = content->pinDescriptor())
+    return std::unique_ptr<detail::KernelFileCopy>(
+        new LinuxKernelFileCopy(std::move(content), std::move(sourceFd), destinationPath));
+#endif
+  return {};
+}
+}
@@ -0,0 +1,57 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#pragma once
+#ifndef _QICORE_SRC_FILECONTENT_HPP_
+#define _QICORE_SRC_FILECONTENT_HPP_
+
+#include <iosfwd>
+#include <memory>
+#include <boost/shared_ptr.hpp>
+#include <qicore/file.hpp>
+#include "filehandlepool.hpp"
+
+namespace qi
+{
+  /** Read-only access to the content of an opened local file.
+      Reads are positional: no cursor is stored, therefore an instance can be used
+      concurrently from any number of threads.
+      The underlying system resources are released on destruction.
+  **/
+  class FileContent
+  {
+  public:
+    virtual ~FileContent() = default;
+
+    /// @return Total count of bytes of the file at the time it was opened.
+    virtual std::streamsize size() const = 0;
+
+    /** Read up to countBytesToRead bytes starting at beginOffset.
+        @return The bytes read, less than requested if the end of the file is reached,
+                empty if beginOffset is out of the file.
+    **/
+    virtual Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) const = 0;
+
+    /// @return The POSIX file descriptor giving access to the content, null if there is none.
+    virtual PinnedDescriptor pinDescriptor() const { return {}; }
+  };
+
+  using FileContentPtr = boost::shared_ptr<const FileContent>;
+
+  /** Open the content of a local file.
+      Throws a std::runtime_error if the file cannot be opened.
+      @param localFilePath   Path of an existing file.
+      @param accessMode      Strategy requested to access the content, all of them are read the same way.
+  **/
+  FileContentPtr openFileContent(const Path& localFilePath, FileAccessMode accessMode);
+
+  /** Prepare the copy of a file content to a new local file, performed by the system.
+      Throws a std::runtime_error if the destination file cannot be created.
+      @return The copy, or null if the system cannot perform the copy of this content.
+  **/
+  std::unique_ptr<detail::KernelFileCopy> openKernelFileCopy(FileContentPtr content, const Path& destinationPath);
+}
+
+#endif
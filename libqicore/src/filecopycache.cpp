@@ -0,0 +1,410 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <list>
+#include <map>
+#include <boost/filesystem/operations.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "filecontent.hpp"
+#include "filedigest.hpp"
+
+#ifndef _WIN32
+# include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+# include <fcntl.h>
+# include <linux/fs.h>
+# include <sys/ioctl.h>
+# include <unistd.h>
+#endif
+
+qiLogCategory("qicore.file.filecopycache");
+
+namespace qi
+{
+namespace
+{
+  namespace fs = boost::filesystem;
+
+  /** Contents stored in a directory, one file per content named after its digest and size.
+      The least recently used contents are evicted first once the size bound is exceeded.
+      All the operations are serialized by the mutex, including the copies of the cached files,
+      which are expected to be made by sharing blocks or by hard links.
+  **/
+  class FileCopyCache
+  {
+  public:
+    // Never destroyed: copies may still end while the static objects are destroyed.
+    static FileCopyCache& instance()
+    {
+      static FileCopyCache* const cache = new FileCopyCache;
+      return *cache;
+    }
+
+    void setSettings(const FileCopyCacheSettings& newSettings)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _settings = newSettings;
+      _counters = FileCopyCacheCounters{};
+      _entries.clear();
+      _recentlyUsed.clear();
+      if (_settings.directory.isEmpty())
+        return;
+
+      boost::system::error_code error;
+      fs::create_directories(_settings.directory.bfsPath(), error);
+      if (error)
+      {
+        qiLogWarning() << "Cannot create the copy cache directory " << _settings.directory.str() << ": "
+                       << error.message();
+        _settings.directory = Path();
+        return;
+      }
+      loadEntries();
+      evictOverflow();
+    }
+
+    FileCopyCacheSettings settings()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _settings;
+    }
+
+    FileCopyCacheCounters counters()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      FileCopyCacheCounters counters = _counters;
+      counters.entryCount = static_cast<unsigned int>(_entries.size());
+      return counters;
+    }
+
+    bool isEnabled()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      return !_settings.directory.isEmpty();
+    }
+
+    bool copyTo(const std::string& digest, std::streamsize size, const Path& localPath)
+    {
+      const std::string name = entryName(digest, size);
+      boost::mutex::scoped_lock lock(_mutex);
+      if (_settings.directory.isEmpty() || name.empty())
+        return false;
+
+      const auto entryIt = _entries.find(name);
+      if (entryIt == _entries.end() || !isUnmodified(entryIt->second, digest))
+      {
+        if (entryIt != _entries.end())
+          removeEntry(entryIt);
+        ++_counters.misses;
+        return false;
+      }
+
+      // Made aside then renamed, so that a failed copy leaves the destination untouched.
+      fs::path temporaryPath = localPath.bfsPath();
+      temporaryPath += ".qicache";
+      boost::system::error_code error;
+      if (!shareOrCopy(entryIt->second.path, temporaryPath))
+      {
+        fs::remove(temporaryPath, error);
+        ++_counters.misses;
+        return false;
+      }
+      fs::rename(temporaryPath, localPath.bfsPath(), error);
+      if (error)
+      {
+        fs::remove(temporaryPath, error);
+        ++_counters.misses;
+        return false;
+      }
+
+      touch(entryIt->second);
+      ++_counters.hits;
+      _counters.bytesSaved += static_cast<std::uint64_t>(size);
+      return true;
+    }
+
+    void add(const std::string& digest, std::streamsize size, const Path& localPath)
+    {
+      const std::string name = entryName(digest, size);
+      boost::mutex::scoped_lock lock(_mutex);
+      if (_settings.directory.isEmpty() || name.empty() || static_cast<std::uint64_t>(size) > _settings.maxSizeBytes)
+        return;
+
+      const auto entryIt = _entries.find(name);
+      if (entryIt != _entries.end())
+      {
+        if (isUnmodified(entryIt->second, digest))
+        {
+          touch(entryIt->second);
+          return;
+        }
+        removeEntry(entryIt);
+      }
+
+      const fs::path entryPath = _settings.directory.bfsPath() / name;
+      fs::path temporaryPath = entryPath;
+      temporaryPath += ".part";
+      boost::system::error_code error;
+      if (!shareOrCopy(localPath.bfsPath(), temporaryPath))
+      {
+        fs::remove(temporaryPath, error);
+        return;
+      }
+      fs::rename(temporaryPath, entryPath, error);
+      if (error)
+      {
+        qiLogWarning() << "Cannot add " << localPath.str() << " to the copy cache: " << error.message();
+        fs::remove(temporaryPath, error);
+        return;
+      }
+
+      Entry& entry = _entries[name];
+      entry.path = entryPath;
+      entry.size = static_cast<std::uint64_t>(size);
+      entry.stamp = readStamp(entryPath);
+      entry.stampTime = std::time(nullptr);
+      entry.isVerified = true; // the content was verified against its digest before being added
+      entry.recentlyUsedIt = _recentlyUsed.insert(_recentlyUsed.begin(), name);
+      _counters.sizeBytes += entry.size;
+      ++_counters.insertions;
+      evictOverflow();
+    }
+
+  private:
+    /// Metadata of a cached file, changed when the file is modified.
+    struct Stamp
+    {
+      std::uint64_t size = 0;
+      std::time_t writeSeconds = 0;
+      long writeNanoseconds = 0;
+      std::uint64_t inode = 0;
+      bool isValid = false;
+
+      bool operator==(const Stamp& other) const
+      {
+        return isValid && other.isValid && size == other.size && writeSeconds == other.writeSeconds
+            && writeNanoseconds == other.writeNanoseconds && inode == other.inode;
+      }
+    };
+
+    struct Entry
+    {
+      fs::path path;
+      std::uint64_t size = 0;
+      Stamp stamp;
+      std::time_t stampTime = 0; // when the stamp was read
+      bool isVerified = false;   // the content is known to match its digest
+      std::list<std::string>::iterator recentlyUsedIt;
+    };
+    using Entries = std::map<std::string, Entry>;
+
+    FileCopyCache() = default;
+
+    // The digest comes from the source file: it must not be able to name a file out of the cache directory.
+    static std::string entryName(const std::string& digest, std::streamsize size)
+    {
+      const bool isValidDigest = !digest.empty() && digest.size() <= 128
+          && std::all_of(digest.begin(), digest.end(), [](char c) {
+               return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
+             });
+      if (!isValidDigest || size < 0)
+        return {};
+      return digest + "-" + std::to_string(size);
+    }
+
+    // Shares the blocks if the file system supports it, otherwise makes a hard link, otherwise copies.
+    static bool shareOrCopy(const fs::path& sourcePath, const fs::path& destinationPath)
+    {
+      boost::system::error_code error;
+      fs::remove(destinationPath, error);
+#if defined(__linux__) && defined(FICLONE)
+      const int sourceFd = ::open(sourcePath.c_str(), O_RDONLY | O_CLOEXEC);
+      if (sourceFd >= 0)
+      {
+        const int destinationFd = ::open(destinationPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        const bool isCloned = destinationFd >= 0 && ::ioctl(destinationFd, FICLONE, sourceFd) == 0;
+        if (destinationFd >= 0)
+          ::close(destinationFd);
+        ::close(sourceFd);
+        if (isCloned)
+          return true;
+        fs::remove(destinationPath, error);
+      }
+#endif
+      fs::create_hard_link(sourcePath, destinationPath, error);
+      if (!error)
+        return true;
+
+      fs::copy_file(sourcePath, destinationPath, error);
+      if (error)
+        qiLogWarning() << "Cannot copy " << sourcePath.string() << " to " << destinationPath.string() << ": "
+                       << error.message();
+      return !error;
+    }
+
+    // The following functions must be called with the mutex locked.
+
+    static Stamp readStamp(const fs::path& path)
+    {
+      Stamp stamp;
+#ifndef _WIN32
+      struct stat status;
+      if (::stat(path.c_str(), &status) != 0)
+        return stamp;
+      stamp.size = static_cast<std::uint64_t>(status.st_size);
+# ifdef __APPLE__
+      stamp.writeSeconds = status.st_mtimespec.tv_sec;
+      stamp.writeNanoseconds = status.st_mtimespec.tv_nsec;
+# else
+      stamp.writeSeconds = status.st_mtim.tv_sec;
+      stamp.writeNanoseconds = status.st_mtim.tv_nsec;
+# endif
+      stamp.inode = static_cast<std::uint64_t>(status.st_ino);
+#else
+      boost::system::error_code error;
+      stamp.size = fs::file_size(path, error);
+      if (error)
+        return stamp;
+      stamp.writeSeconds = fs::last_write_time(path, error);
+      if (error)
+        return stamp;
+#endif
+      stamp.isValid = true;
+      return stamp;
+    }
+
+    /** Cached files shared by hard links can be modified through the copies.
+        A file rewritten in place keeps its size, and its modification time only changes at the granularity
+        of the file system clock: the content is hashed again when it was modified shortly before its
+        stamp was read, as well as when it was left by a previous process.
+    **/
+    static bool isUnmodified(Entry& entry, const std::string& digest)
+    {
+      static const std::time_t AMBIGUOUS_WRITE_DELAY_SECONDS = 2;
+
+      const Stamp stamp = readStamp(entry.path);
+      if (!(stamp == entry.stamp))
+        return false;
+      if (entry.isVerified && entry.stampTime - stamp.writeSeconds >= AMBIGUOUS_WRITE_DELAY_SECONDS)
+        return true;
+
+      try
+      {
+        if (digestFileContent(*openFileContent(Path(entry.path), FileAccessMode_Stream)) != digest)
+          return false;
+      }
+      catch (const std::exception& ex)
+      {
+        qiLogVerbose() << "Cannot verify the cached file " << entry.path.string() << ": " << ex.what();
+        return false;
+      }
+      entry.isVerified = true;
+      entry.stamp = readStamp(entry.path);
+      entry.stampTime = std::time(nullptr);
+      return entry.stamp == stamp;
+    }
+
+    void touch(Entry& entry)
+    {
+      _recentlyUsed.splice(_recentlyUsed.begin(), _recentlyUsed, entry.recentlyUsedIt);
+    }
+
+    void removeEntry(Entries::iterator entryIt)
+    {
+      boost::system::error_code error;
+      fs::remove(entryIt->second.path, error);
+      _counters.sizeBytes -= entryIt->second.size;
+      _recentlyUsed.erase(entryIt->second.recentlyUsedIt);
+      _entries.erase(entryIt);
+    }
+
+    void evictOverflow()
+    {
+      while (_counters.sizeBytes > _settings.maxSizeBytes && !_recentlyUsed.empty())
+      {
+        removeEntry(_entries.find(_recentlyUsed.back()));
+        ++_counters.evictions;
+      }
+    }
+
+    // The contents left by a previous process are ordered by modification time, the most recent first.
+    void loadEntries()
+    {
+      std::vector<std::pair<std::time_t, std::string>> loadedEntries;
+      boost::system::error_code iterationError;
+      for (fs::directory_iterator fileIt(_settings.directory.bfsPath(), iterationError), end;
+           !iterationError && fileIt != end; fileIt.increment(iterationError))
+      {
+        const fs::path path = fileIt->path();
+        const std::string name = path.filename().string();
+        boost::system::error_code error;
+        if (!fs::is_regular_file(path, error) || path.extension() == ".part")
+          continue;
+
+        Entry entry;
+        entry.path = path;
+        entry.stamp = readStamp(path);
+        entry.stampTime = std::time(nullptr);
+        entry.size = entry.stamp.size;
+        if (!entry.stamp.isValid)
+          continue;
+        loadedEntries.emplace_back(entry.stamp.writeSeconds, name);
+        _entries[name] = entry;
+        _counters.sizeBytes += entry.size;
+      }
+
+      std::sort(loadedEntries.begin(), loadedEntries.end());
+      for (const auto& loadedEntry : loadedEntries)
+        _entries[loadedEntry.second].recentlyUsedIt = _recentlyUsed.insert(_recentlyUsed.begin(), loadedEntry.second);
+    }
+
+    boost::mutex _mutex;
+    FileCopyCacheSettings _settings;
+    FileCopyCacheCounters _counters;
+    Entries _entries;
+    std::list<std::string> _recentlyUsed; // most recently used first
+  };
+}
+
+void setFileCopyCache(const FileCopyCacheSettings& settings)
+{
+  FileCopyCache::instance().setSettings(settings);
+}
+
+FileCopyCacheSettings fileCopyCacheSettings()
+{
+  return FileCopyCache::instance().settings();
+}
+
+FileCopyCacheCounters fileCopyCacheCounters()
+{
+  return FileCopyCache::instance().counters();
+}
+
+namespace detail
+{
+  bool isFileCopyCacheEnabled()
+  {
+    return FileCopyCache::instance().isEnabled();
+  }
+
+  bool copyFromFileCopyCache(const std::string& digest, std::streamsize size, const Path& localPath)
+  {
+    return FileCopyCache::instance().copyTo(digest, size, localPath);
+  }
+
+  void addToFileCopyCache(const std::string& digest, std::streamsize size, const Path& localPath)
+  {
+    FileCopyCache::instance().add(digest, size, localPath);
+  }
+}
+}
@@ -0,0 +1,42 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include "filecopytolocal.hpp"
+
+namespace qi
+{
+  FileCopyToLocal::FileCopyToLocal(qi::FilePtr file, qi::Path localPath, FileTransferOptions options)
+    : FileOperation(boost::make_shared<Task>(std::move(file), std::move(localPath), std::move(options)))
+  {
+  }
+
+  void FileCopyToLocal::addSink(FileSinkPtr sink)
+  {
+    if (!task())
+      throw std::runtime_error("Tried to add a sink to an invalid FileOperation");
+    static_cast<Task&>(*task()).addSink(std::move(sink));
+  }
+
+  std::streamsize FileCopyToLocal::receivedWireBytes() const
+  {
+    return copyTask().wireBytes.load();
+  }
+
+  std::streamsize FileCopyToLocal::receivedBytes() const
+  {
+    Task& task = copyTask();
+    boost::mutex::scoped_lock lock(task.mutex);
+    return task.bytesWritten;
+  }
+
+  FileCopyToLocal::Task& FileCopyToLocal::copyTask() const
+  {
+    if (!task())
+      throw std::runtime_error("Tried to access the statistics of an invalid FileOperation");
+    return static_cast<Task&>(*task());
+  }
+}
@@ -0,0 +1,1055 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#pragma once
+#ifndef _QICORE_SRC_FILECOPYTOLOCAL_HPP_
+#define _QICORE_SRC_FILECOPYTOLOCAL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/weak_ptr.hpp>
+#include <qi/eventloop.hpp>
+
+#include "fileoperationtask.hpp"
+
+namespace qi
+{
+  class FileCopyToLocal::Task
+    : public FileOperation::Task
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    Task(FilePtr sourceFile, qi::Path localFilePath, FileTransferOptions transferOptions)
+      : FileOperation::Task(std::move(sourceFile))
+      , localPath(std::move(localFilePath))
+      , options(std::move(transferOptions))
+      , chunkSize(std::max(options.minChunkSize, std::min(options.initialChunkSize, options.maxChunkSize)))
+    {
+      isRemoteTelemetryEnabled = options.publishRemoteTelemetry;
+      // Data written to the standard output cannot be reordered.
+      if (localPath.isEmpty() || options.maxReadsInFlight == 0)
+        options.maxReadsInFlight = 1;
+      options.maxQueuedWrites = std::max(options.maxQueuedWrites, 1u);
+    }
+
+    void start() override
+    {
+      auto myself = shared_from_this();
+      boost::weak_ptr<Task> weakSelf = boost::static_pointer_cast<Task>(myself);
+      Future<void> transferSlot = detail::acquireTransferSlot(options.priority);
+      // Out of the caller, which may be an observer of the progress called with the notification mutex locked.
+      promise.setOnCancel([weakSelf, transferSlot](Promise<void>&) mutable {
+        transferSlot.cancel(); // no more waiting for the transfer scheduler
+        qi::async<void>([weakSelf] {
+          if (auto self = weakSelf.lock())
+            self->cancelFetch();
+        });
+      });
+
+      whenReady(transferSlot, [this, myself](const Future<void>& futureSlot) {
+        if (futureSlot.hasError())
+        {
+          fail(futureSlot.error());
+          return;
+        }
+        if (futureSlot.isCanceled())
+        {
+          cancel();
+          return;
+        }
+
+        promise.future().connect([](const Future<void>&) { detail::releaseTransferSlot(); });
+        if (promise.isCancelRequested())
+          cancel();
+        else
+          startTransfer();
+      });
+    }
+
+    virtual void startTransfer()
+    {
+      if (startKernelCopy())
+        return;
+
+      if (lookUpCopyCache())
+        return;
+
+      fetchContent();
+    }
+
+    void fetchContent()
+    {
+      if (!makeLocalFile())
+        return;
+
+      startTime = Clock::now();
+      if (bytesWritten == fileSize)
+      {
+        stop();
+        return;
+      }
+
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        isFetching = true;
+      }
+      // Canceled while the local file was being made.
+      if (promise.isCancelRequested())
+        cancelFetch();
+      else if (canStream())
+        startStreaming();
+      else
+        fetchData();
+    }
+
+    /** End the fetch of the content as soon as the cancellation is requested, without waiting for
+        the reads in flight: they are canceled, and the reads not sent yet are dropped.
+    **/
+    void cancelFetch()
+    {
+      std::map<std::uint64_t, boost::function<void()>> readsToCancel;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!isFetching || isOver)
+          return;
+        isOver = true;
+        readsToCancel.swap(readCancelers);
+      }
+
+      for (auto& read : readsToCancel)
+        read.second();
+      conclude(ChunkOutcome::Canceled, std::string(), 0.0);
+    }
+
+    /** Keep a read in flight to cancel it with the operation.
+        @return The identifier to pass to untrackRead() once the read completes,
+                zero if the operation is already over: the read is canceled right away.
+    **/
+    template <typename T>
+    std::uint64_t trackRead(Future<T> futureRead)
+    {
+      boost::function<void()> cancelRead = [futureRead]() mutable { futureRead.cancel(); };
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!isOver)
+        {
+          const std::uint64_t readId = ++lastReadId;
+          readCancelers.emplace(readId, std::move(cancelRead));
+          return readId;
+        }
+      }
+      cancelRead();
+      return 0;
+    }
+
+    void untrackRead(std::uint64_t readId)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      readCancelers.erase(readId);
+    }
+
+    virtual void stop()
+    {
+      {
+        boost::mutex::scoped_lock writeLock(writeMutex);
+        closeLocalFile();
+      }
+
+      const bool isSynced = options.syncPolicy == FileSyncPolicy_None || localPath.isEmpty()
+          || detail::syncLocalFile(localPath);
+      std::string sinkError;
+
+      if (!isSynced)
+      {
+        abortSinks();
+        fail("Failed to write the local file copy to the storage device.");
+        clearLocalFile();
+      }
+      else if (!finishSinks(sinkError))
+      {
+        abortSinks();
+        fail("Failed to process the local file copy: " + sinkError);
+        clearLocalFile();
+      }
+      else
+      {
+        if (!contentDigest.empty() && digestReceivedContent() == contentDigest)
+          detail::addToFileCopyCache(contentDigest, fileSize, localPath);
+        finish();
+      }
+    }
+
+    virtual bool makeLocalFile()
+    {
+      if (localPath.isEmpty()) {
+        return true;
+      }
+
+      localFile.open(localPath.bfsPath(), std::ios::out | std::ios::binary);
+      if (!localFile.is_open())
+      {
+        fail("Failed to create local file copy.");
+        return false;
+      }
+      return true;
+    }
+
+    /// Must be called before the operation starts.
+    virtual void addSink(FileSinkPtr sink)
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      sinks.push_back(std::move(sink));
+    }
+
+    bool hasSinks()
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      return !sinks.empty();
+    }
+
+    /////////////////////////////////////////////////////////////////////
+    // Sinks: the written chunks are provided to the sinks in order of position, the chunks written
+    // before the previous ones are kept until the gap is filled. Only accessed with the write mutex locked.
+
+    /** Provide a written chunk to the sinks, with the write mutex locked.
+        @return false if a sink failed, errorMessage is then set.
+    **/
+    bool feedSinks(std::streamoff offset, const Buffer& chunk, std::string& errorMessage)
+    {
+      if (sinks.empty())
+        return true;
+
+      unorderedSinkChunks.emplace(offset, chunk);
+      try
+      {
+        auto chunkIt = unorderedSinkChunks.begin();
+        while (chunkIt != unorderedSinkChunks.end() && chunkIt->first == sinkOffset)
+        {
+          for (const auto& sink : sinks)
+            sink->write(chunkIt->second);
+          sinkOffset += static_cast<std::streamoff>(chunkIt->second.totalSize());
+          chunkIt = unorderedSinkChunks.erase(chunkIt);
+        }
+      }
+      catch (const std::exception& ex)
+      {
+        errorMessage = ex.what();
+        return false;
+      }
+      return true;
+    }
+
+    /// @return false if a sink failed, errorMessage is then set.
+    bool finishSinks(std::string& errorMessage)
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      try
+      {
+        for (const auto& sink : sinks)
+          sink->finish();
+      }
+      catch (const std::exception& ex)
+      {
+        errorMessage = ex.what();
+        return false;
+      }
+      return true;
+    }
+
+    void abortSinks()
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      for (const auto& sink : sinks)
+        sink->abort();
+      unorderedSinkChunks.clear();
+    }
+
+    /////////////////////////////////////////////////////////////////////
+    // Writer stage: the received chunks are queued and written one at a time, in their order of arrival,
+    // out of the continuations receiving the data. The local file is only accessed with the write mutex locked.
+
+    struct QueuedWrite
+    {
+      std::streamoff offset;
+      Buffer chunk;
+    };
+
+    // Must be called with the mutex locked.
+    void queueWrite(std::streamoff offset, Buffer chunk)
+    {
+      queuedWrites.push_back(QueuedWrite{ offset, std::move(chunk) });
+      if (isWriting)
+        return;
+
+      isWriting = true;
+      auto myself = shared_from_this();
+      qi::async<void>([this, myself] { writeQueuedChunks(); });
+    }
+
+    // Must be called with the mutex locked.
+    bool isWriteQueueFull() const
+    {
+      return queuedWrites.size() >= options.maxQueuedWrites;
+    }
+
+    void writeQueuedChunks()
+    {
+      while (true)
+      {
+        ChunkOutcome outcome = ChunkOutcome::Continue;
+        std::string errorMessage;
+        double progress = 0.0;
+        unsigned int creditsToGrant = 0;
+        AnyObject currentStream;
+        {
+          boost::mutex::scoped_lock writeLock(writeMutex);
+          QueuedWrite queuedWrite;
+          {
+            boost::mutex::scoped_lock lock(mutex);
+            if (isOver || queuedWrites.empty())
+            {
+              queuedWrites.clear();
+              isWriting = false;
+              return;
+            }
+            queuedWrite = std::move(queuedWrites.front());
+            queuedWrites.pop_front();
+          }
+
+          const bool isWritten = writeChunk(queuedWrite.offset, queuedWrite.chunk);
+          std::string sinkError;
+          const bool isConsumed = isWritten && feedSinks(queuedWrite.offset, queuedWrite.chunk, sinkError);
+
+          boost::mutex::scoped_lock lock(mutex);
+          if (isOver)
+            continue;
+
+          if (isWritten && !isConsumed)
+          {
+            outcome = ChunkOutcome::Failed;
+            errorMessage = "Failed to process the local file copy: " + sinkError;
+          }
+          else if (isWritten)
+          {
+            bytesWritten += queuedWrite.chunk.totalSize();
+            assert(fileSize >= bytesWritten);
+            onChunkWritten(queuedWrite.offset, queuedWrite.chunk);
+            if (bytesWritten == fileSize)
+              outcome = ChunkOutcome::Finished;
+          }
+          else
+          {
+            outcome = ChunkOutcome::Failed;
+            errorMessage = "Failed to write the local file copy.";
+          }
+
+          isOver = outcome != ChunkOutcome::Continue;
+          progress = currentProgress();
+          creditsToGrant = takeStreamCredits();
+          currentStream = stream;
+        }
+
+        conclude(outcome, errorMessage, progress);
+        if (outcome != ChunkOutcome::Continue)
+          continue; // the queue is dropped by the next iteration
+
+        // The writes caught up, the data can be requested again.
+        if (!currentStream.isValid())
+          fetchData();
+        else if (creditsToGrant > 0)
+          grantStreamCredits(currentStream, creditsToGrant);
+      }
+    }
+
+    // Must be called with the write mutex locked. @return false if the data could not be written.
+    bool writeChunk(std::streamoff offset, const Buffer& chunk)
+    {
+      const auto writeStart = Clock::now();
+      const bool isWritten = writeLocalData(offset, chunk);
+      meter.addLocalWriteTime(Clock::now() - writeStart);
+      meter.addTransferredBytes(static_cast<std::streamsize>(chunk.totalSize()));
+      return isWritten;
+    }
+
+    /// Store the data at its position in the copy, with the write mutex locked.
+    virtual bool writeLocalData(std::streamoff offset, const Buffer& chunk)
+    {
+      bool isWritten = true;
+      if (localFile.is_open())
+      {
+        localFile.seekp(offset);
+        localFile.write(static_cast<const char*>(chunk.data()), chunk.totalSize());
+        if (options.syncPolicy == FileSyncPolicy_EveryChunk)
+        {
+          if (!localFileSync)
+            localFileSync.reset(new detail::LocalFileSync(localPath));
+          isWritten = localFile.flush() && localFileSync->sync();
+        }
+        isWritten = isWritten && !localFile.fail();
+      }
+      else if (localPath.isEmpty())
+      {
+        std::cout.write(static_cast<const char*>(chunk.data()), chunk.totalSize());
+        isWritten = !std::cout.fail();
+      }
+      else
+      {
+        isWritten = false; // closed because the operation ended meanwhile
+      }
+      return isWritten;
+    }
+
+    struct ReadRequest
+    {
+      std::streamoff offset;
+      std::streamsize size;
+    };
+
+    /** Select the next range of bytes to read, if any.
+        Must be called with the mutex locked.
+        @return false if no read should be requested until a read in flight completes.
+    **/
+    virtual bool takeNextRequest(ReadRequest& request)
+    {
+      if (readsInFlight >= options.maxReadsInFlight || nextOffset >= fileSize)
+        return false;
+
+      request.offset = nextOffset;
+      request.size = std::min(chunkSize, fileSize - nextOffset);
+      nextOffset += request.size;
+      return true;
+    }
+
+    /// Called with the mutex locked when a read requested through takeNextRequest() completes.
+    virtual void releaseRequest(const ReadRequest&) {}
+
+    /// Called with the mutex and the write mutex locked once a received chunk have been written in the local file.
+    virtual void onChunkWritten(std::streamoff /*offset*/, const Buffer& /*chunk*/) {}
+
+    // Request as many reads as allowed by the options.
+    void fetchData()
+    {
+      std::vector<ReadRequest> requests;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        ReadRequest request;
+        while (!isOver && !isWriteQueueFull() && takeNextRequest(request))
+        {
+          requests.push_back(request);
+          ++readsInFlight;
+        }
+      }
+
+      for (const auto& request : requests)
+        fetchChunk(request);
+    }
+
+    void fetchChunk(const ReadRequest& request)
+    {
+      auto myself = shared_from_this();
+      // The wait is canceled with the operation, the read is then dropped by requestChunk().
+      const Future<void> readBandwidth = detail::acquireReadBandwidth(options.priority, request.size);
+      const std::uint64_t waitId = trackRead(readBandwidth);
+      whenReady(readBandwidth, [this, myself, request, waitId](const Future<void>& futureBandwidth) {
+        untrackRead(waitId);
+        if (futureBandwidth.hasError())
+          onChunkReceived(request, Clock::now(), makeFutureError<Buffer>(futureBandwidth.error()));
+        else
+          requestChunk(request);
+      });
+    }
+
+    void requestChunk(const ReadRequest& request)
+    {
+      auto myself = shared_from_this();
+      const auto requestTime = Clock::now();
+
+      // Not sent if the operation ended while the read was waiting for the bandwidth.
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver)
+        {
+          --readsInFlight;
+          releaseRequest(request);
+          return;
+        }
+      }
+
+      if (useCompression)
+      {
+        using CompressedChunk = std::pair<bool, Buffer>;
+        const Future<CompressedChunk> futureRead =
+            sourceFile.async<CompressedChunk>("readCompressed", request.offset, request.size);
+        const std::uint64_t readId = trackRead(futureRead);
+        futureRead.connect([this, myself, request, requestTime, readId](Future<CompressedChunk> futureChunk)
+        {
+          untrackRead(readId);
+          onChunkReceived(request, requestTime, uncompressChunk(futureChunk, request.size));
+        });
+        return;
+      }
+
+      const Future<Buffer> futureRead = sourceFile.async<Buffer>(readFuncName, request.offset, request.size);
+      const std::uint64_t readId = trackRead(futureRead);
+      futureRead.connect([this, myself, request, requestTime, readId](Future<Buffer> futureBuffer)
+      {
+        untrackRead(readId);
+        if (futureBuffer.hasValue())
+          wireBytes += futureBuffer.value().totalSize();
+        onChunkReceived(request, requestTime, futureBuffer);
+      });
+    }
+
+    // Done out of the mutex to let several chunks be uncompressed at the same time.
+    Future<Buffer> uncompressChunk(const Future<std::pair<bool, Buffer>>& futureChunk, std::streamsize expectedSize)
+    {
+      if (futureChunk.hasError())
+        return makeFutureError<Buffer>(futureChunk.error());
+
+      const auto& chunk = futureChunk.value();
+      wireBytes += chunk.second.totalSize();
+      if (!chunk.first)
+        return Future<Buffer>(chunk.second);
+
+      try
+      {
+        return Future<Buffer>(detail::uncompressFileChunk(chunk.second, expectedSize));
+      }
+      catch (const std::exception& ex)
+      {
+        return makeFutureError<Buffer>(ex.what());
+      }
+    }
+
+    void onChunkReceived(const ReadRequest& request, Clock::time_point requestTime, Future<Buffer> futureBuffer)
+    {
+      ChunkOutcome outcome = ChunkOutcome::Continue;
+      std::string errorMessage;
+      double progress = 0.0;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        --readsInFlight;
+        releaseRequest(request);
+        if (isOver)
+          return;
+
+        outcome = storeChunk(request.offset, request.size, futureBuffer, errorMessage);
+        if (outcome == ChunkOutcome::Continue || outcome == ChunkOutcome::Finished)
+        {
+          const auto readLatency = Clock::now() - requestTime;
+          meter.addReadLatency(readLatency);
+          adaptChunkSize(request.size, readLatency);
+        }
+        progress = currentProgress();
+      }
+
+      conclude(outcome, errorMessage, progress);
+      if (outcome == ChunkOutcome::Continue)
+        fetchData();
+    }
+
+    enum class ChunkOutcome { Continue, Finished, Failed, Canceled };
+
+    /** Check a received chunk and queue it to be written at its position in the local file.
+        Must be called with the mutex locked.
+        @return What the operation should do next, any outcome but Continue ends the operation.
+    **/
+    ChunkOutcome storeChunk(std::streamoff offset, std::streamsize expectedSize, const Future<Buffer>& futureBuffer,
+                            std::string& errorMessage)
+    {
+      ChunkOutcome outcome = ChunkOutcome::Continue;
+      if (futureBuffer.hasError())
+      {
+        outcome = ChunkOutcome::Failed;
+        errorMessage = futureBuffer.error();
+      }
+      else if (promise.isCancelRequested())
+      {
+        outcome = ChunkOutcome::Canceled;
+      }
+      else if (static_cast<std::streamsize>(futureBuffer.value().totalSize()) != expectedSize)
+      {
+        outcome = ChunkOutcome::Failed;
+        errorMessage = "Received an unexpected count of bytes, the file may have been modified during the copy.";
+      }
+      else
+      {
+        queueWrite(offset, futureBuffer.value());
+      }
+
+      isOver = outcome != ChunkOutcome::Continue;
+      return outcome;
+    }
+
+    // Must be called with the mutex locked.
+    double currentProgress() const
+    {
+      return static_cast<double>(bytesWritten) / static_cast<double>(fileSize);
+    }
+
+    // Apply the outcome of a received chunk, must be called without the mutex locked.
+    virtual void conclude(ChunkOutcome outcome, const std::string& errorMessage, double progress)
+    {
+      if (outcome != ChunkOutcome::Continue)
+        releaseStream(outcome != ChunkOutcome::Finished);
+
+      switch (outcome)
+      {
+      case ChunkOutcome::Continue:
+        notifyProgressed(progress);
+        break;
+      case ChunkOutcome::Finished:
+        notifyProgressed(progress);
+        stop();
+        break;
+      case ChunkOutcome::Failed:
+        abortSinks();
+        fail(errorMessage);
+        clearLocalFile();
+        break;
+      case ChunkOutcome::Canceled:
+        abortSinks();
+        clearLocalFile();
+        cancel();
+        break;
+      }
+    }
+
+    void failBeforeAnyChunk(const std::string& errorMessage)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver)
+          return;
+        isOver = true;
+      }
+      conclude(ChunkOutcome::Failed, errorMessage, 0.0);
+    }
+
+    /////////////////////////////////////////////////////////////////////
+    // Streaming mode: a stream opened on the source file pushes the chunks through its
+    // `chunkStreamed` signal, each chunk consuming one credit granted by this task.
+
+    bool canStream() const
+    {
+      return options.allowStreaming && !useCompression && !localPath.isEmpty() && !isRemoteDeprecated
+          && !sourceFile.metaObject().findMethod("openStream").empty();
+    }
+
+    void startStreaming()
+    {
+      auto myself = shared_from_this();
+      const std::streamsize streamChunkSize = std::min(chunkSize, options.maxChunkSize);
+      sourceFile.async<AnyObject>("openStream", std::streamoff(0), streamChunkSize)
+        .connect([this, myself, streamChunkSize](Future<AnyObject> futureStream)
+      {
+        // The file may not be streamed after all: its content is requested instead.
+        if (futureStream.hasError() || !futureStream.value().isValid())
+        {
+          fetchData();
+          return;
+        }
+
+        AnyObject openedStream = futureStream.value();
+        boost::function<void(std::streamoff, Buffer)> onChunk = [this, myself](std::streamoff offset, Buffer chunk)
+        {
+          onChunkStreamed(offset, std::move(chunk));
+        };
+
+        openedStream.connect("chunkStreamed", SignalSubscriber(AnyFunction::from(onChunk))).async()
+          .connect([this, myself, openedStream, streamChunkSize](Future<SignalLink> futureLink) mutable
+        {
+          if (futureLink.hasError())
+          {
+            openedStream.async<void>("stop");
+            failBeforeAnyChunk(futureLink.error());
+            return;
+          }
+
+          bool isStillRunning = false;
+          {
+            boost::mutex::scoped_lock lock(mutex);
+            isStillRunning = !isOver;
+            if (isStillRunning)
+            {
+              stream = openedStream;
+              streamLink = futureLink.value();
+              chunkSize = streamChunkSize;
+              lastStreamActivity = Clock::now();
+            }
+          }
+
+          // Ended while the stream was being opened.
+          if (!isStillRunning)
+          {
+            openedStream.disconnect(futureLink.value()).async();
+            openedStream.async<void>("stop");
+            return;
+          }
+
+          watchStream();
+          grantStreamCredits(openedStream, options.maxReadsInFlight);
+        });
+      });
+    }
+
+    // The credits are granted once the transfer scheduler allows the reads of their chunks.
+    void grantStreamCredits(AnyObject grantedStream, unsigned int credits)
+    {
+      auto myself = shared_from_this();
+      std::streamsize streamChunkSize = 0;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        streamChunkSize = chunkSize;
+      }
+
+      whenReady(detail::acquireReadBandwidth(options.priority, credits * streamChunkSize),
+                [this, myself, grantedStream, credits](const Future<void>& futureBandwidth) mutable {
+        if (futureBandwidth.hasError())
+        {
+          failBeforeAnyChunk(futureBandwidth.error());
+          return;
+        }
+
+        {
+          boost::mutex::scoped_lock lock(mutex);
+          if (isOver)
+            return;
+          // The stall timeout only runs from the moment chunks are expected.
+          if (pendingStreamCredits == 0)
+            lastStreamActivity = Clock::now();
+          pendingStreamCredits += credits;
+        }
+
+        grantedStream.async<void>("addCredits", credits)
+          .connect([this, myself](Future<void> futureGrant)
+        {
+          if (futureGrant.hasError())
+            failBeforeAnyChunk(futureGrant.error());
+        });
+      });
+    }
+
+    void onChunkStreamed(std::streamoff offset, Buffer chunk)
+    {
+      ChunkOutcome outcome = ChunkOutcome::Continue;
+      std::string errorMessage;
+      double progress = 0.0;
+      unsigned int creditsToGrant = 0;
+      AnyObject currentStream;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver || !stream.isValid())
+          return;
+
+        if (pendingStreamCredits > 0)
+          --pendingStreamCredits;
+        lastStreamActivity = Clock::now();
+        streamedEnd = std::max(streamedEnd, offset + static_cast<std::streamoff>(chunk.totalSize()));
+
+        const std::streamsize expectedSize = std::min(chunkSize, fileSize - offset);
+        wireBytes += chunk.totalSize();
+        outcome = storeChunk(offset, expectedSize, Future<Buffer>(chunk), errorMessage);
+        progress = currentProgress();
+        if (outcome == ChunkOutcome::Continue)
+          ++consumedCredits;
+        creditsToGrant = takeStreamCredits();
+        currentStream = stream;
+      }
+
+      conclude(outcome, errorMessage, progress);
+      if (creditsToGrant > 0)
+        grantStreamCredits(currentStream, creditsToGrant);
+    }
+
+    /** Credits are given back by batches to limit the count of calls,
+        and held back while the writes are late. Must be called with the mutex locked.
+    **/
+    unsigned int takeStreamCredits()
+    {
+      const unsigned int creditBatchSize = std::max(1u, options.maxReadsInFlight / 2);
+      if (!stream.isValid() || isOver || consumedCredits < creditBatchSize || isWriteQueueFull())
+        return 0;
+
+      const unsigned int credits = consumedCredits;
+      consumedCredits = 0;
+      return credits;
+    }
+
+    // Check periodically that the stream still pushes the chunks it was granted credits for.
+    void watchStream()
+    {
+      if (options.streamStallTimeout <= std::chrono::milliseconds::zero())
+        return;
+
+      boost::weak_ptr<Task> weakSelf = boost::static_pointer_cast<Task>(shared_from_this());
+      qi::asyncDelay([weakSelf] {
+        if (auto self = weakSelf.lock())
+          self->checkStreamStall();
+      }, qi::MilliSeconds(options.streamStallTimeout.count()));
+    }
+
+    void checkStreamStall()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver || !stream.isValid())
+          return;
+
+        const bool isExpectingChunks = pendingStreamCredits > 0 && streamedEnd < fileSize;
+        if (!isExpectingChunks || Clock::now() - lastStreamActivity < options.streamStallTimeout)
+        {
+          lock.unlock();
+          watchStream();
+          return;
+        }
+      }
+      failBeforeAnyChunk("The source file stopped streaming its content.");
+    }
+
+    // Stop receiving streamed chunks, must be called without the mutex locked.
+    void releaseStream(bool stopSourceStream)
+    {
+      SignalLink link = SignalBase::invalidSignalLink;
+      AnyObject releasedStream;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        std::swap(link, streamLink);
+        std::swap(releasedStream, stream);
+      }
+
+      if (!releasedStream.isValid())
+        return;
+      if (link != SignalBase::invalidSignalLink)
+        releasedStream.disconnect(link).async();
+      if (stopSourceStream)
+        releasedStream.async<void>("stop");
+    }
+
+    // Size the next reads so that the bytes in flight cover the bandwidth-delay product of the link.
+    // Must be called with the mutex locked.
+    void adaptChunkSize(std::streamsize receivedSize, Clock::duration readLatency)
+    {
+      static const double LATENCY_SMOOTHING = 0.25;
+      const double latency = std::chrono::duration<double>(readLatency).count();
+      smoothedLatency = smoothedLatency == 0.0
+          ? latency
+          : (1.0 - LATENCY_SMOOTHING) * smoothedLatency + LATENCY_SMOOTHING * latency;
+
+      receivedBytes += receivedSize;
+      const double elapsed = std::chrono::duration<double>(Clock::now() - startTime).count();
+      if (elapsed <= 0.0)
+        return;
+
+      const double bandwidth = static_cast<double>(receivedBytes) / elapsed;
+      const double bandwidthDelayProduct = bandwidth * smoothedLatency;
+      const auto targetChunkSize = static_cast<std::streamsize>(bandwidthDelayProduct / options.maxReadsInFlight);
+      chunkSize = std::max(options.minChunkSize, std::min(targetChunkSize, options.maxChunkSize));
+    }
+
+    virtual void clearLocalFile()
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      kernelCopy.reset();
+      closeLocalFile();
+      boost::filesystem::remove(localPath);
+    }
+
+    // Must be called with the write mutex locked.
+    void closeLocalFile()
+    {
+      localFileSync.reset();
+      if (localFile.is_open())
+        localFile.close();
+    }
+
+    /////////////////////////////////////////////////////////////////////
+    // Copy cache: the digest of the source file identifies its content, which is not transferred
+    // when it is already in the cache. The digest costs a round trip before the transfer starts.
+    // The cache is shared by all the sources: the transferred content is only added under the digest
+    // reported by the source once the same digest has been computed from the received data.
+
+    // @return True if the content is looked up in the copy cache, the transfer is then continued from the lookup.
+    bool lookUpCopyCache()
+    {
+      if (!options.useCopyCache || localPath.isEmpty() || isRemoteDeprecated || hasSinks()
+          || !detail::isFileCopyCacheEnabled()
+          || sourceFile.metaObject().findMethod("digest").empty())
+        return false;
+
+      auto myself = shared_from_this();
+      sourceFile.async<std::string>("digest").connect([this, myself](Future<std::string> futureDigest) {
+        // Without digest, the content is just transferred.
+        if (futureDigest.hasValue() && detail::copyFromFileCopyCache(futureDigest.value(), fileSize, localPath))
+        {
+          {
+            boost::mutex::scoped_lock lock(mutex);
+            if (isOver)
+              return;
+            isOver = true;
+            bytesWritten = fileSize;
+          }
+          conclude(ChunkOutcome::Finished, {}, 1.0);
+          return;
+        }
+
+        if (futureDigest.hasValue())
+        {
+          boost::mutex::scoped_lock writeLock(writeMutex);
+          contentDigest = futureDigest.value();
+          startDigestingReceivedContent();
+        }
+
+        if (promise.isCancelRequested())
+          cancel();
+        else
+          fetchContent();
+      });
+      return true;
+    }
+
+    /// The received content is digested by a sink as it is written. Called with the writeMutex locked.
+    virtual void startDigestingReceivedContent()
+    {
+      receivedDigestSink = boost::make_shared<DigestFileSink>();
+      sinks.push_back(receivedDigestSink);
+    }
+
+    /// @return The digest of the received content, compared to the digest of the source.
+    virtual std::string digestReceivedContent()
+    {
+      return receivedDigestSink->digest();
+    }
+
+    /////////////////////////////////////////////////////////////////////
+    // Kernel mode: the source file is opened in this process, the system copies it
+    // one cycle at a time so that progress is reported and cancellation is checked.
+
+    // @return True if the copy is handled by the system.
+    bool startKernelCopy()
+    {
+      if (!options.allowKernelCopy || localPath.isEmpty() || isRemoteDeprecated || hasSinks())
+        return false;
+
+      try
+      {
+        kernelCopy = detail::startKernelFileCopy(sourceFile, localPath);
+      }
+      catch (const std::exception& ex)
+      {
+        fail(ex.what());
+        return true;
+      }
+
+      if (!kernelCopy)
+        return false;
+
+      startTime = Clock::now();
+      scheduleKernelCopy();
+      return true;
+    }
+
+    void scheduleKernelCopy()
+    {
+      auto myself = shared_from_this();
+      qi::async<void>([this, myself] { copyInKernel(); });
+    }
+
+    void copyInKernel()
+    {
+      static const std::streamsize BYTES_PER_KERNEL_COPY = 8 * 1024 * 1024;
+
+      ChunkOutcome outcome = ChunkOutcome::Continue;
+      std::string errorMessage;
+      double progress = 0.0;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver)
+          return;
+
+        if (promise.isCancelRequested())
+        {
+          outcome = ChunkOutcome::Canceled;
+        }
+        else
+        {
+          try
+          {
+            const std::streamsize copiedBytes = kernelCopy->copy(BYTES_PER_KERNEL_COPY);
+            bytesWritten += copiedBytes;
+            receivedBytes += copiedBytes;
+            meter.addTransferredBytes(copiedBytes);
+            if (bytesWritten >= fileSize)
+            {
+              outcome = ChunkOutcome::Finished;
+            }
+            else if (copiedBytes == 0)
+            {
+              outcome = ChunkOutcome::Failed;
+              errorMessage = "Reached the end of the file too early, it may have been modified during the copy.";
+            }
+          }
+          catch (const std::exception& ex)
+          {
+            outcome = ChunkOutcome::Failed;
+            errorMessage = ex.what();
+          }
+        }
+
+        if (outcome == ChunkOutcome::Finished)
+          kernelCopy.reset();
+        isOver = outcome != ChunkOutcome::Continue;
+        progress = currentProgress();
+      }
+
+      conclude(outcome, errorMessage, progress);
+      if (outcome == ChunkOutcome::Continue)
+        scheduleKernelCopy();
+    }
+
+    boost::mutex mutex;
+    boost::mutex writeMutex; // locked before the mutex when both are needed
+    boost::filesystem::ofstream localFile;
+    std::unique_ptr<detail::LocalFileSync> localFileSync; // kept open while each chunk is synchronized
+    std::streamsize bytesWritten = 0;
+    const qi::Path localPath;
+    FileTransferOptions options;
+    std::streamsize chunkSize;
+    std::streamoff nextOffset = 0;
+    unsigned int readsInFlight = 0;
+    bool isOver = false;
+    Clock::time_point startTime;
+    std::streamsize receivedBytes = 0;
+    double smoothedLatency = 0.0;
+    const bool useCompression = options.allowCompression && !isRemoteDeprecated
+        && !sourceFile.metaObject().findMethod("readCompressed").empty();
+    std::atomic<std::streamsize> wireBytes{ 0 };
+    AnyObject stream;                                  // set while the content is streamed
+    SignalLink streamLink = SignalBase::invalidSignalLink;
+    unsigned int consumedCredits = 0;                  // credits used by the chunks but not given back yet
+    unsigned int pendingStreamCredits = 0;             // credits granted to the stream but not used yet
+    Clock::time_point lastStreamActivity;
+    std::streamoff streamedEnd = 0;                    // end of the furthest streamed chunk
+    std::unique_ptr<detail::KernelFileCopy> kernelCopy;
+    std::deque<QueuedWrite> queuedWrites;
+    bool isWriting = false;
+    std::string contentDigest; // set before the transfer starts if the content should be added to the copy cache
+    boost::shared_ptr<DigestFileSink> receivedDigestSink; // digest of the received content, set with contentDigest unless the local file is digested
+    bool isFetching = false;   // the content is being fetched: a cancellation ends the operation at once
+    std::map<std::uint64_t, boost::function<void()>> readCancelers; // reads in flight, by identifier
+    std::uint64_t lastReadId = 0;
+    std::vector<FileSinkPtr> sinks;
+    std::map<std::streamoff, Buffer> unorderedSinkChunks; // written chunks not provided to the sinks yet
+    std::streamoff sinkOffset = 0;                       // position of the next byte to provide to the sinks
+  };
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "filecopytolocal.hpp"
+
+namespace qi
+{
+  class FileCopyToMemory::Task
+    : public FileCopyToLocal::Task
+  {
+  public:
+    Task(FilePtr sourceFile, std::size_t maxContentSize, FileTransferOptions transferOptions)
+      : FileCopyToLocal::Task(std::move(sourceFile), qi::Path(), transferOptions)
+      , maxSize(maxContentSize)
+    {
+      // Unlike the standard output, the content is written at the position of each chunk.
+      options.maxReadsInFlight = std::max(transferOptions.maxReadsInFlight, 1u);
+    }
+
+    void start() override
+    {
+      auto myself = boost::static_pointer_cast<Task>(shared_from_this());
+      boost::weak_ptr<Task> weakSelf = myself;
+      contentPromise.setOnCancel([weakSelf](Promise<Buffer>&) {
+        if (auto self = weakSelf.lock())
+          self->promise.future().cancel();
+      });
+      promise.future().connect([myself](const Future<void>& futureCopy) {
+        if (futureCopy.hasError())
+          myself->contentPromise.setError(futureCopy.error());
+        else if (futureCopy.isCanceled())
+          myself->contentPromise.setCanceled();
+        else
+          myself->contentPromise.setValue(myself->takeContent());
+      });
+      FileCopyToLocal::Task::start();
+    }
+
+    bool makeLocalFile() override
+    {
+      if (static_cast<std::uint64_t>(fileSize) > maxSize)
+      {
+        std::stringstream message;
+        message << "Failed to copy the file in memory: its size of " << fileSize
+                << " bytes exceeds the maximum of " << maxSize << " bytes.";
+        fail(message.str());
+        return false;
+      }
+
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      content = Buffer();
+      contentData = fileSize > 0 ? static_cast<char*>(content.reserve(static_cast<std::size_t>(fileSize)))
+                                 : nullptr;
+      return true;
+    }
+
+    bool writeLocalData(std::streamoff offset, const Buffer& chunk) override
+    {
+      const auto chunkSize = static_cast<std::streamsize>(chunk.totalSize());
+      if (!contentData || offset < 0 || offset + chunkSize > fileSize)
+        return false; // released because the operation ended meanwhile, or the source file grew
+      std::memcpy(contentData + offset, chunk.data(), chunk.totalSize());
+      return true;
+    }
+
+    void clearLocalFile() override
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      content = Buffer();
+      contentData = nullptr;
+    }
+
+    Buffer takeContent()
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      Buffer fullContent = std::move(content);
+      content = Buffer();
+      contentData = nullptr;
+      return fullContent;
+    }
+
+    const std::size_t maxSize;
+    Promise<Buffer> contentPromise;
+    Buffer content;               // allocated to the size of the file, guarded by the write mutex
+    char* contentData = nullptr;  // first byte of the content, null once released
+  };
+
+  FileCopyToMemory::FileCopyToMemory(qi::FilePtr file, std::size_t maxSize, FileTransferOptions options)
+    : FileCopyToLocal(boost::make_shared<Task>(std::move(file), maxSize, std::move(options)))
+  {
+  }
+
+  qi::Future<Buffer> FileCopyToMemory::start()
+  {
+    FileOperation::start();
+    return static_cast<Task&>(*task()).contentPromise.future();
+  }
+
+  qi::Future<Buffer> FileCopyToMemory::detach()
+  {
+    if (!task())
+      throw std::runtime_error("Called FileOperation::detach() but no task is owned!");
+
+    qi::Future<Buffer> futureContent = static_cast<Task&>(*task()).contentPromise.future();
+    FileOperation::detach();
+    return futureContent;
+  }
+}
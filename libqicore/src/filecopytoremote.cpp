@@ -0,0 +1,353 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <map>
+#include <boost/function.hpp>
+#include <boost/weak_ptr.hpp>
+#include <qi/eventloop.hpp>
+
+#include "fileoperationtask.hpp"
+
+namespace qi
+{
+  class FileCopyToRemote::Task
+    : public FileOperation::Task
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    Task(FilePtr sourceFile, WritableFilePtr destinationFile, FileTransferOptions transferOptions)
+      : FileOperation::Task(std::move(sourceFile))
+      , destination(std::move(destinationFile))
+      , options(std::move(transferOptions))
+      , chunkSize(std::max(std::streamsize(1),
+                           std::min(options.initialChunkSize,
+                                    std::min(options.maxChunkSize,
+                                             static_cast<std::streamsize>(WritableFile::MAX_WRITE_SIZE)))))
+    {
+      options.maxReadsInFlight = std::max(options.maxReadsInFlight, 1u);
+      isRemoteTelemetryEnabled = options.publishRemoteTelemetry;
+    }
+
+    void start() override
+    {
+      auto myself = shared_from_this();
+      boost::weak_ptr<Task> weakSelf = boost::static_pointer_cast<Task>(myself);
+      Future<void> transferSlot = detail::acquireTransferSlot(options.priority);
+      // Out of the caller, which may be an observer of the progress called with the notification mutex locked.
+      promise.setOnCancel([weakSelf, transferSlot](Promise<void>&) mutable {
+        transferSlot.cancel(); // no more waiting for the transfer scheduler
+        qi::async<void>([weakSelf] {
+          if (auto self = weakSelf.lock())
+            self->cancelPush();
+        });
+      });
+      whenReady(transferSlot, [this, myself](const Future<void>& futureSlot) {
+        if (futureSlot.hasError())
+        {
+          endBeforeAnyChunk(ChunkOutcome::Failed, futureSlot.error());
+          return;
+        }
+        if (futureSlot.isCanceled())
+        {
+          endBeforeAnyChunk(ChunkOutcome::Canceled, {});
+          return;
+        }
+
+        promise.future().connect([](const Future<void>&) { detail::releaseTransferSlot(); });
+        if (promise.isCancelRequested())
+        {
+          endBeforeAnyChunk(ChunkOutcome::Canceled, {});
+          return;
+        }
+
+        // The destination gets its final size first, the chunks then fill it in any order.
+        const Future<void> futureTruncate = destination.async<void>("truncate", fileSize);
+        const std::uint64_t resizeId = trackCall(futureTruncate);
+        futureTruncate.connect([this, myself, resizeId](Future<void> futureResize) {
+          untrackCall(resizeId);
+          if (futureResize.hasError())
+            endBeforeAnyChunk(ChunkOutcome::Failed, futureResize.error());
+          else if (futureResize.isCanceled())
+            endBeforeAnyChunk(ChunkOutcome::Canceled, {});
+          else if (fileSize == 0)
+            commitEmptyDestination();
+          else
+            pushData();
+        });
+      });
+    }
+
+    enum class ChunkOutcome { Continue, Finished, Failed, Canceled };
+
+    struct ChunkRequest
+    {
+      std::streamoff offset;
+      std::streamsize size;
+    };
+
+    // Start as many chunks as allowed by the options.
+    void pushData()
+    {
+      std::vector<ChunkRequest> requests;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        while (!isOver && chunksInFlight < options.maxReadsInFlight && nextOffset < fileSize)
+        {
+          const ChunkRequest request{ nextOffset, std::min(chunkSize, fileSize - nextOffset) };
+          requests.push_back(request);
+          nextOffset += request.size;
+          ++chunksInFlight;
+        }
+      }
+
+      for (const auto& request : requests)
+        pushChunk(request);
+    }
+
+    void pushChunk(const ChunkRequest& request)
+    {
+      auto myself = shared_from_this();
+      // The wait is canceled with the operation, the chunk then ends as canceled.
+      const Future<void> readBandwidth = detail::acquireReadBandwidth(options.priority, request.size);
+      const std::uint64_t waitId = trackCall(readBandwidth);
+      whenReady(readBandwidth, [this, myself, request, waitId](const Future<void>& futureBandwidth) {
+        untrackCall(waitId);
+        if (futureBandwidth.hasError() || futureBandwidth.isCanceled())
+        {
+          onChunkWritten(request, futureBandwidth);
+          return;
+        }
+
+        // Not sent if the operation ended while the chunk was waiting for the bandwidth.
+        {
+          boost::mutex::scoped_lock lock(mutex);
+          if (isOver)
+          {
+            --chunksInFlight;
+            return;
+          }
+        }
+
+        const auto requestTime = Clock::now();
+        const Future<Buffer> futureRead = sourceFile.async<Buffer>(readFuncName, request.offset, request.size);
+        const std::uint64_t readId = trackCall(futureRead);
+        futureRead.connect([this, myself, request, requestTime, readId](Future<Buffer> futureBuffer)
+        {
+          untrackCall(readId);
+          meter.addReadLatency(Clock::now() - requestTime);
+          onChunkRead(request, futureBuffer);
+        });
+      });
+    }
+
+    void onChunkRead(const ChunkRequest& request, const Future<Buffer>& futureBuffer)
+    {
+      if (futureBuffer.hasError())
+      {
+        onChunkWritten(request, makeFutureError<void>(futureBuffer.error()));
+        return;
+      }
+      if (futureBuffer.isCanceled())
+      {
+        Promise<void> canceledWrite;
+        canceledWrite.setCanceled();
+        onChunkWritten(request, canceledWrite.future());
+        return;
+      }
+      if (static_cast<std::streamsize>(futureBuffer.value().totalSize()) != request.size)
+      {
+        onChunkWritten(request, makeFutureError<void>(
+            "Read an unexpected count of bytes, the file may have been modified during the copy."));
+        return;
+      }
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver)
+        {
+          --chunksInFlight;
+          return;
+        }
+      }
+
+      auto myself = shared_from_this();
+      const Future<void> futureWrite = destination.async<void>("write", request.offset, futureBuffer.value());
+      const std::uint64_t writeId = trackCall(futureWrite);
+      futureWrite.connect([this, myself, request, writeId](Future<void> futureWritten)
+      {
+        untrackCall(writeId);
+        onChunkWritten(request, futureWritten);
+      });
+    }
+
+    void onChunkWritten(const ChunkRequest& request, const Future<void>& futureWrite)
+    {
+      ChunkOutcome outcome = ChunkOutcome::Continue;
+      std::string errorMessage;
+      double progress = 0.0;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        --chunksInFlight;
+        if (isOver)
+          return;
+
+        if (futureWrite.hasError())
+        {
+          outcome = ChunkOutcome::Failed;
+          errorMessage = futureWrite.error();
+        }
+        else if (futureWrite.isCanceled() || promise.isCancelRequested())
+        {
+          outcome = ChunkOutcome::Canceled;
+        }
+        else
+        {
+          bytesWritten += request.size;
+          meter.addTransferredBytes(request.size);
+          if (bytesWritten == fileSize)
+            outcome = ChunkOutcome::Finished;
+        }
+
+        isOver = outcome != ChunkOutcome::Continue;
+        progress = static_cast<double>(bytesWritten) / static_cast<double>(fileSize);
+      }
+
+      conclude(outcome, errorMessage, progress);
+      if (outcome == ChunkOutcome::Continue)
+        pushData();
+    }
+
+    // Apply the outcome of a written chunk, must be called without the mutex locked.
+    void conclude(ChunkOutcome outcome, const std::string& errorMessage, double progress)
+    {
+      switch (outcome)
+      {
+      case ChunkOutcome::Continue:
+        notifyProgressed(progress);
+        break;
+      case ChunkOutcome::Finished:
+        notifyProgressed(progress);
+        commitDestination();
+        break;
+      case ChunkOutcome::Failed:
+        fail(errorMessage);
+        destination.async<void>("discard");
+        break;
+      case ChunkOutcome::Canceled:
+        destination.async<void>("discard");
+        cancel();
+        break;
+      }
+    }
+
+    void endBeforeAnyChunk(ChunkOutcome outcome, const std::string& errorMessage)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver)
+          return;
+        isOver = true;
+      }
+      conclude(outcome, errorMessage, 0.0);
+    }
+
+    // Stop the chunks in flight right away, rather than when their reads or writes complete.
+    void cancelPush()
+    {
+      std::map<std::uint64_t, boost::function<void()>> callsToCancel;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver)
+          return;
+        isOver = true;
+        callsToCancel.swap(callCancelers);
+      }
+
+      for (auto& call : callsToCancel)
+        call.second();
+      conclude(ChunkOutcome::Canceled, std::string(), 0.0);
+    }
+
+    /** Keep a call in flight to cancel it with the operation.
+        @return The identifier to pass to untrackCall() once the call completes,
+                zero if the operation is already over: the call is canceled right away.
+    **/
+    template <typename T>
+    std::uint64_t trackCall(Future<T> futureCall)
+    {
+      boost::function<void()> cancelCall = [futureCall]() mutable { futureCall.cancel(); };
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!isOver)
+        {
+          const std::uint64_t callId = ++lastCallId;
+          callCancelers.emplace(callId, std::move(cancelCall));
+          return callId;
+        }
+      }
+      cancelCall();
+      return 0;
+    }
+
+    void untrackCall(std::uint64_t callId)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      callCancelers.erase(callId);
+    }
+
+    // The operation may have been canceled while the destination was resized.
+    void commitEmptyDestination()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        if (isOver)
+          return;
+        isOver = true;
+      }
+      commitDestination();
+    }
+
+    // A failed commit discards the content by itself.
+    void commitDestination()
+    {
+      auto myself = shared_from_this();
+      destination.async<void>("commit").connect([this, myself](Future<void> futureCommit) {
+        if (futureCommit.hasError())
+          fail(futureCommit.error());
+        else
+          finish();
+      });
+    }
+
+    const WritableFilePtr destination;
+    boost::mutex mutex;
+    FileTransferOptions options;
+    const std::streamsize chunkSize;
+    std::streamoff nextOffset = 0;
+    std::streamsize bytesWritten = 0;
+    unsigned int chunksInFlight = 0;
+    bool isOver = false;
+    std::uint64_t lastCallId = 0;
+    std::map<std::uint64_t, boost::function<void()>> callCancelers;
+  };
+
+  FileCopyToRemote::FileCopyToRemote(FilePtr file, WritableFilePtr destination, FileTransferOptions options)
+    : FileOperation(boost::make_shared<Task>(std::move(file), std::move(destination), std::move(options)))
+  {
+  }
+
+  std::streamsize FileCopyToRemote::sentBytes() const
+  {
+    if (!task())
+      throw std::runtime_error("Tried to access the statistics of an invalid FileOperation");
+
+    Task& copyTask = static_cast<Task&>(*task());
+    boost::mutex::scoped_lock lock(copyTask.mutex);
+    return copyTask.bytesWritten;
+  }
+}
@@ -0,0 +1,396 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include "filedigest.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include <boost/filesystem/fstream.hpp>
+
+#include "filecontent.hpp"
+
+namespace qi
+{
+namespace
+{
+  const std::uint64_t PRIME1 = 11400714785074694791ULL;
+  const std::uint64_t PRIME2 = 14029467366897019727ULL;
+  const std::uint64_t PRIME3 = 1609587929392839161ULL;
+  const std::uint64_t PRIME4 = 9650029242287828579ULL;
+  const std::uint64_t PRIME5 = 2870177450012600261ULL;
+
+  std::uint64_t rotateLeft(std::uint64_t value, int bits)
+  {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  // The hash is defined on little-endian words, whatever the platform.
+  std::uint64_t read64(const unsigned char* data)
+  {
+    std::uint64_t value = 0;
+    for (int idx = 7; idx >= 0; --idx)
+      value = (value << 8) | data[idx];
+    return value;
+  }
+
+  std::uint64_t read32(const unsigned char* data)
+  {
+    std::uint64_t value = 0;
+    for (int idx = 3; idx >= 0; --idx)
+      value = (value << 8) | data[idx];
+    return value;
+  }
+
+  std::uint64_t round(std::uint64_t accumulator, std::uint64_t input)
+  {
+    accumulator += input * PRIME2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * PRIME1;
+  }
+
+  std::uint64_t mergeRound(std::uint64_t hash, std::uint64_t accumulator)
+  {
+    hash ^= round(0, accumulator);
+    return hash * PRIME1 + PRIME4;
+  }
+
+  const std::uint32_t SHA256_ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+  };
+
+  std::uint32_t rotateRight(std::uint32_t value, int bits)
+  {
+    return (value >> bits) | (value << (32 - bits));
+  }
+
+  // SHA-256 is defined on big-endian words, whatever the platform.
+  std::uint32_t readBigEndian32(const unsigned char* data)
+  {
+    return (static_cast<std::uint32_t>(data[0]) << 24) | (static_cast<std::uint32_t>(data[1]) << 16)
+        | (static_cast<std::uint32_t>(data[2]) << 8) | static_cast<std::uint32_t>(data[3]);
+  }
+}
+
+  Xxh64::Xxh64(std::uint64_t seed)
+    : _accumulators{ { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 } }
+    , _seed(seed)
+  {
+  }
+
+  void Xxh64::update(const void* data, std::size_t size)
+  {
+    const unsigned char* input = static_cast<const unsigned char*>(data);
+    _totalSize += size;
+
+    if (_stripeSize > 0)
+    {
+      const std::size_t byteCount = std::min(size, _stripe.size() - _stripeSize);
+      std::memcpy(_stripe.data() + _stripeSize, input, byteCount);
+      _stripeSize += byteCount;
+      input += byteCount;
+      size -= byteCount;
+      if (_stripeSize < _stripe.size())
+        return;
+
+      for (std::size_t lane = 0; lane < 4; ++lane)
+        _accumulators[lane] = round(_accumulators[lane], read64(_stripe.data() + 8 * lane));
+      _stripeSize = 0;
+    }
+
+    for (; size >= _stripe.size(); input += _stripe.size(), size -= _stripe.size())
+    {
+      for (std::size_t lane = 0; lane < 4; ++lane)
+        _accumulators[lane] = round(_accumulators[lane], read64(input + 8 * lane));
+    }
+
+    std::memcpy(_stripe.data(), input, size);
+    _stripeSize = size;
+  }
+
+  std::uint64_t Xxh64::digest() const
+  {
+    std::uint64_t hash = 0;
+    if (_totalSize >= _stripe.size())
+    {
+      hash = rotateLeft(_accumulators[0], 1) + rotateLeft(_accumulators[1], 7)
+          + rotateLeft(_accumulators[2], 12) + rotateLeft(_accumulators[3], 18);
+      for (const auto accumulator : _accumulators)
+        hash = mergeRound(hash, accumulator);
+    }
+    else
+    {
+      hash = _seed + PRIME5;
+    }
+    hash += _totalSize;
+
+    const unsigned char* input = _stripe.data();
+    std::size_t size = _stripeSize;
+    for (; size >= 8; input += 8, size -= 8)
+      hash = rotateLeft(hash ^ round(0, read64(input)), 27) * PRIME1 + PRIME4;
+    if (size >= 4)
+    {
+      hash = rotateLeft(hash ^ (read32(input) * PRIME1), 23) * PRIME2 + PRIME3;
+      input += 4;
+      size -= 4;
+    }
+    for (; size > 0; ++input, --size)
+      hash = rotateLeft(hash ^ (*input * PRIME5), 11) * PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+  Sha256::Sha256()
+    : _state{ { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 } }
+  {
+  }
+
+  void Sha256::update(const void* data, std::size_t size)
+  {
+    const unsigned char* input = static_cast<const unsigned char*>(data);
+    _totalSize += size;
+
+    if (_blockSize > 0)
+    {
+      const std::size_t byteCount = std::min(size, _block.size() - _blockSize);
+      std::memcpy(_block.data() + _blockSize, input, byteCount);
+      _blockSize += byteCount;
+      input += byteCount;
+      size -= byteCount;
+      if (_blockSize < _block.size())
+        return;
+
+      processBlock(_block.data());
+      _blockSize = 0;
+    }
+
+    for (; size >= _block.size(); input += _block.size(), size -= _block.size())
+      processBlock(input);
+
+    std::memcpy(_block.data(), input, size);
+    _blockSize = size;
+  }
+
+  std::string Sha256::hexDigest() const
+  {
+    // The padding is hashed by a copy: more data can still be provided to this hash.
+    Sha256 padded(*this);
+    const std::uint64_t bitCount = _totalSize * 8;
+    static const unsigned char PADDING_START = 0x80;
+    static const unsigned char ZEROS[64] = {};
+    padded.update(&PADDING_START, 1);
+    padded.update(ZEROS, (padded._blockSize <= 56 ? 56 : 120) - padded._blockSize);
+
+    unsigned char length[8];
+    for (int idx = 0; idx < 8; ++idx)
+      length[idx] = static_cast<unsigned char>(bitCount >> (56 - 8 * idx));
+    padded.update(length, sizeof(length));
+
+    char digest[65];
+    for (std::size_t word = 0; word < padded._state.size(); ++word)
+      std::snprintf(digest + 8 * word, 9, "%08x", static_cast<unsigned int>(padded._state[word]));
+    return std::string(digest, 64);
+  }
+
+  void Sha256::processBlock(const unsigned char* block)
+  {
+    std::uint32_t words[64];
+    for (std::size_t idx = 0; idx < 16; ++idx)
+      words[idx] = readBigEndian32(block + 4 * idx);
+    for (std::size_t idx = 16; idx < 64; ++idx)
+    {
+      const std::uint32_t s0 = rotateRight(words[idx - 15], 7) ^ rotateRight(words[idx - 15], 18) ^ (words[idx - 15] >> 3);
+      const std::uint32_t s1 = rotateRight(words[idx - 2], 17) ^ rotateRight(words[idx - 2], 19) ^ (words[idx - 2] >> 10);
+      words[idx] = words[idx - 16] + s0 + words[idx - 7] + s1;
+    }
+
+    std::uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    std::uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+    for (std::size_t idx = 0; idx < 64; ++idx)
+    {
+      const std::uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+      const std::uint32_t choice = (e & f) ^ (~e & g);
+      const std::uint32_t temp1 = h + s1 + choice + SHA256_ROUND_CONSTANTS[idx] + words[idx];
+      const std::uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+      const std::uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+      const std::uint32_t temp2 = s0 + majority;
+      h = g;
+      g = f;
+      f = e;
+      e = d + temp1;
+      d = c;
+      c = b;
+      b = a;
+      a = temp1 + temp2;
+    }
+
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+  }
+
+  std::string formatFileDigest(const Sha256& hash)
+  {
+    return "sha256-" + hash.hexDigest();
+  }
+
+  RollingChecksum::RollingChecksum(const unsigned char* window, std::size_t windowSize)
+    : _windowSize(static_cast<std::uint32_t>(windowSize))
+  {
+    for (std::size_t idx = 0; idx < windowSize; ++idx)
+    {
+      _a += window[idx];
+      _b += static_cast<std::uint32_t>(windowSize - idx) * window[idx];
+    }
+  }
+
+  void RollingChecksum::roll(unsigned char outByte, unsigned char inByte)
+  {
+    _a += static_cast<std::uint32_t>(inByte) - outByte;
+    _b += _a - _windowSize * outByte;
+  }
+
+  std::uint64_t hashBlock(const void* data, std::size_t size)
+  {
+    Xxh64 hash;
+    hash.update(data, size);
+    return hash.digest();
+  }
+
+  std::vector<File::BlockMatch> matchFileBlocks(const FileContent& content, std::streamsize blockSize,
+                                                const std::vector<File::BlockSignature>& signatures)
+  {
+    static const std::streamsize BYTES_PER_READ = 1024 * 1024;
+
+    std::vector<File::BlockMatch> matches;
+    const std::streamsize fileSize = content.size();
+    if (signatures.empty() || fileSize < blockSize)
+      return matches;
+
+    std::unordered_multimap<std::uint32_t, std::uint32_t> blocksByChecksum;
+    blocksByChecksum.reserve(signatures.size());
+    for (std::size_t blockIdx = 0; blockIdx < signatures.size(); ++blockIdx)
+      blocksByChecksum.emplace(signatures[blockIdx].first, static_cast<std::uint32_t>(blockIdx));
+
+    // Bytes of the file from bufferOffset, the current window starts at windowOffset.
+    std::vector<unsigned char> bytes;
+    std::streamoff bufferOffset = 0;
+    std::streamoff windowOffset = 0;
+    const auto windowAt = [&](std::streamoff offset) {
+      return bytes.data() + static_cast<std::size_t>(offset - bufferOffset);
+    };
+    // @return false if the file ends before endOffset.
+    const auto readUpTo = [&](std::streamoff endOffset) {
+      while (bufferOffset + static_cast<std::streamoff>(bytes.size()) < endOffset)
+      {
+        // The bytes before the window are not needed anymore.
+        if (windowOffset - bufferOffset >= BYTES_PER_READ)
+        {
+          bytes.erase(bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(windowOffset - bufferOffset));
+          bufferOffset = windowOffset;
+        }
+
+        const Buffer data = content.read(bufferOffset + static_cast<std::streamoff>(bytes.size()), BYTES_PER_READ);
+        if (data.totalSize() == 0)
+          return false;
+        const unsigned char* begin = static_cast<const unsigned char*>(data.data());
+        bytes.insert(bytes.end(), begin, begin + data.totalSize());
+      }
+      return true;
+    };
+
+    if (!readUpTo(blockSize))
+      return matches;
+    RollingChecksum checksum(windowAt(0), static_cast<std::size_t>(blockSize));
+    while (true)
+    {
+      bool isMatch = false;
+      const auto candidates = blocksByChecksum.equal_range(checksum.value());
+      if (candidates.first != candidates.second)
+      {
+        const std::uint64_t hash = hashBlock(windowAt(windowOffset), static_cast<std::size_t>(blockSize));
+        for (auto candidateIt = candidates.first; candidateIt != candidates.second; ++candidateIt)
+        {
+          if (signatures[candidateIt->second].second == hash)
+          {
+            matches.emplace_back(windowOffset, candidateIt->second);
+            isMatch = true;
+            break;
+          }
+        }
+      }
+
+      if (isMatch)
+      {
+        // Matched blocks do not overlap: the search starts again after the block.
+        if (!readUpTo(windowOffset + 2 * blockSize))
+          break;
+        windowOffset += blockSize;
+        checksum = RollingChecksum(windowAt(windowOffset), static_cast<std::size_t>(blockSize));
+      }
+      else
+      {
+        if (!readUpTo(windowOffset + blockSize + 1))
+          break;
+        checksum.roll(*windowAt(windowOffset), *windowAt(windowOffset + blockSize));
+        ++windowOffset;
+      }
+    }
+    return matches;
+  }
+
+  std::string digestFileContent(const FileContent& content)
+  {
+    static const std::streamsize BYTES_PER_READ = 1024 * 1024;
+
+    Sha256 hash;
+    for (std::streamoff offset = 0; offset < content.size(); offset += BYTES_PER_READ)
+    {
+      const Buffer data = content.read(offset, BYTES_PER_READ);
+      if (data.totalSize() == 0)
+        break;
+      hash.update(data.data(), data.totalSize());
+    }
+    return formatFileDigest(hash);
+  }
+
+namespace detail
+{
+  std::vector<File::BlockSignature> computeBlockSignatures(const Path& localPath, std::streamsize blockSize)
+  {
+    std::vector<File::BlockSignature> signatures;
+    boost::filesystem::ifstream localFile(localPath.bfsPath(), std::ios::in | std::ios::binary);
+    if (!localFile.is_open() || blockSize <= 0)
+      return signatures;
+
+    std::vector<unsigned char> block(static_cast<std::size_t>(blockSize));
+    while (localFile.read(reinterpret_cast<char*>(block.data()), blockSize))
+    {
+      const RollingChecksum checksum(block.data(), block.size());
+      signatures.emplace_back(checksum.value(), hashBlock(block.data(), block.size()));
+    }
+    return signatures;
+  }
+}
+}
@@ -0,0 +1,105 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#pragma once
+#ifndef _QICORE_SRC_FILEDIGEST_HPP_
+#define _QICORE_SRC_FILEDIGEST_HPP_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <qicore/file.hpp>
+
+namespace qi
+{
+  class FileContent;
+
+  /** Incremental XXH64 hash, a fast non-cryptographic hash of 64 bits.
+      The data can be provided in pieces of any size, the result only depends on the concatenated data.
+  **/
+  class Xxh64
+  {
+  public:
+    explicit Xxh64(std::uint64_t seed = 0);
+
+    void update(const void* data, std::size_t size);
+
+    /// @return The hash of the data provided so far.
+    std::uint64_t digest() const;
+
+  private:
+    std::array<std::uint64_t, 4> _accumulators;
+    std::array<unsigned char, 32> _stripe;
+    std::size_t _stripeSize = 0;
+    std::uint64_t _totalSize = 0;
+    const std::uint64_t _seed;
+  };
+
+  /** Incremental SHA-256 hash (FIPS 180-4), a cryptographic hash of 256 bits.
+      The data can be provided in pieces of any size, the result only depends on the concatenated data.
+  **/
+  class Sha256
+  {
+  public:
+    Sha256();
+
+    void update(const void* data, std::size_t size);
+
+    /// @return The hash of the data provided so far, as lowercase hexadecimal digits.
+    std::string hexDigest() const;
+
+  private:
+    void processBlock(const unsigned char* block);
+
+    std::array<std::uint32_t, 8> _state;
+    std::array<unsigned char, 64> _block;
+    std::size_t _blockSize = 0;
+    std::uint64_t _totalSize = 0;
+  };
+
+  /// @return The digest of a content as documented by File::digest(), from the hash of the content.
+  std::string formatFileDigest(const Sha256& hash);
+
+  /** Weak checksum of a window of bytes, which can be moved by one byte in constant time (see rsync).
+      Both halves are sums modulo 2^16: the sum of the bytes and the sum of the bytes weighted by their
+      distance to the end of the window.
+  **/
+  class RollingChecksum
+  {
+  public:
+    /// Start with the checksum of a whole window.
+    RollingChecksum(const unsigned char* window, std::size_t windowSize);
+
+    /// Move the window by one byte: the first byte goes out and a new last byte comes in.
+    void roll(unsigned char outByte, unsigned char inByte);
+
+    std::uint32_t value() const
+    {
+      return (_a & 0xffff) | ((_b & 0xffff) << 16);
+    }
+
+  private:
+    std::uint32_t _a = 0;
+    std::uint32_t _b = 0;
+    std::uint32_t _windowSize;
+  };
+
+  /// @return The XXH64 hash of a block of bytes.
+  std::uint64_t hashBlock(const void* data, std::size_t size);
+
+  /** Find blocks of another version of a file in a file content, as documented by File::matchBlocks().
+      blockSize must be positive.
+  **/
+  std::vector<File::BlockMatch> matchFileBlocks(const FileContent& content, std::streamsize blockSize,
+                                                const std::vector<File::BlockSignature>& signatures);
+
+  /** Hash the whole content of a file.
+      @return The digest as documented by File::digest().
+  **/
+  std::string digestFileContent(const FileContent& content);
+}
+
+#endif
@@ -0,0 +1,319 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include "filehandlepool.hpp"
+
+#include <list>
+#include <map>
+#include <sstream>
+#include <utility>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+#ifndef _WIN32
+# include <cerrno>
+# include <cstring>
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+qiLogCategory("qicore.file.filehandlepool");
+
+namespace qi
+{
+#ifndef _WIN32
+namespace
+{
+  using FileKey = std::pair<dev_t, ino_t>;
+
+  std::runtime_error openError(const Path& localFilePath, const std::string& reason)
+  {
+    std::stringstream message;
+    message << "Failed to open file " << localFilePath.str() << ": " << reason;
+    return std::runtime_error(message.str());
+  }
+
+  // Returns the descriptor, or -1 with errno set.
+  int openDescriptor(const Path& localFilePath, struct stat& fileStatus)
+  {
+    const int fd = ::open(localFilePath.bfsPath().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return -1;
+    if (::fstat(fd, &fileStatus) != 0)
+    {
+      const int error = errno;
+      ::close(fd);
+      errno = error;
+      return -1;
+    }
+    return fd;
+  }
+}
+
+class PooledFileHandle
+{
+public:
+  PooledFileHandle(Path localFilePath, FileKey fileKey, int openedFd)
+    : path(std::move(localFilePath))
+    , key(fileKey)
+    , fd(openedFd)
+  {
+  }
+
+  ~PooledFileHandle();
+
+  const Path path;
+  const FileKey key;
+
+  // Guarded by the mutex of the pool.
+  int fd;
+  unsigned int pinCount = 0;
+  bool isIdle = false;
+  std::list<PooledFileHandle*>::iterator idleIt;
+};
+#endif
+
+namespace
+{
+  /** Shared by all the local files opened in stream mode.
+      Each file opened is identified by its device and inode, the handles are shared by all of its openings
+      and only referenced weakly by the pool. The descriptors not pinned by a read are idle: the least
+      recently used idle descriptors are closed when the budget is exceeded, the pinned ones are never closed.
+      Nor are the descriptors of the files whose path does not lead to them anymore (renamed, removed or replaced):
+      they could not be reopened.
+      Handles must never be released with the mutex locked, their destruction locks it.
+  **/
+  class FileHandlePool
+  {
+  public:
+    // Never destroyed: files may still be opened while the static objects are destroyed.
+    static FileHandlePool& instance()
+    {
+      static FileHandlePool* const pool = new FileHandlePool;
+      return *pool;
+    }
+
+    void setLimits(const FileHandlePoolLimits& newLimits)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _limits = newLimits;
+#ifndef _WIN32
+      closeOverflow();
+#endif
+    }
+
+    FileHandlePoolLimits limits()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _limits;
+    }
+
+    FileHandlePoolCounters counters()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      FileHandlePoolCounters counters = _counters;
+#ifndef _WIN32
+      counters.fileCount = static_cast<unsigned int>(_handles.size());
+#endif
+      return counters;
+    }
+
+#ifndef _WIN32
+    PooledFileHandlePtr open(const Path& localFilePath, std::streamsize& size)
+    {
+      PooledFileHandlePtr handle;
+      // Opening a file already in the pool costs a stat() instead of an open() and a fstat().
+      struct stat fileStatus;
+      if (::stat(localFilePath.bfsPath().c_str(), &fileStatus) == 0)
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        handle = findHandle(FileKey(fileStatus.st_dev, fileStatus.st_ino));
+        if (handle)
+        {
+          ++_counters.sharedOpens;
+          size = static_cast<std::streamsize>(fileStatus.st_size);
+          return handle;
+        }
+      }
+
+      const int fd = openDescriptor(localFilePath, fileStatus);
+      if (fd < 0)
+        throw openError(localFilePath, std::strerror(errno));
+      size = static_cast<std::streamsize>(fileStatus.st_size);
+      const FileKey key(fileStatus.st_dev, fileStatus.st_ino);
+
+      boost::mutex::scoped_lock lock(_mutex);
+      // Opened concurrently by another thread, or replaced since the stat().
+      handle = findHandle(key);
+      if (handle)
+      {
+        ::close(fd);
+        ++_counters.sharedOpens;
+        return handle;
+      }
+
+      handle.reset(new PooledFileHandle(localFilePath, key, fd));
+      _handles[key] = Registration(handle.get(), handle);
+      ++_counters.opens;
+      ++_counters.openDescriptors;
+      makeIdle(*handle);
+      closeOverflow();
+      return handle;
+    }
+
+    void pin(PooledFileHandle& handle)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (handle.fd < 0)
+        reopen(handle);
+      if (handle.isIdle)
+      {
+        _idleHandles.erase(handle.idleIt);
+        handle.isIdle = false;
+      }
+      ++handle.pinCount;
+    }
+
+    void unpin(PooledFileHandle& handle)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (--handle.pinCount == 0)
+      {
+        makeIdle(handle);
+        closeOverflow();
+      }
+    }
+
+    void forget(PooledFileHandle& handle)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (handle.isIdle)
+        _idleHandles.erase(handle.idleIt);
+      if (handle.fd >= 0)
+        closeDescriptor(handle);
+
+      // The file may have been opened again with a new handle since the last reference was released.
+      const auto registrationIt = _handles.find(handle.key);
+      if (registrationIt != _handles.end() && registrationIt->second.first == &handle)
+        _handles.erase(registrationIt);
+    }
+#endif
+
+  private:
+    FileHandlePool() = default;
+
+#ifndef _WIN32
+    using Registration = std::pair<PooledFileHandle*, boost::weak_ptr<PooledFileHandle>>;
+
+    // The following functions must be called with the mutex locked.
+
+    PooledFileHandlePtr findHandle(const FileKey& key)
+    {
+      const auto registrationIt = _handles.find(key);
+      if (registrationIt == _handles.end())
+        return {};
+      return registrationIt->second.second.lock();
+    }
+
+    // Holding the mutex while reopening keeps it simple: it only happens once the budget has been exceeded.
+    void reopen(PooledFileHandle& handle)
+    {
+      struct stat fileStatus;
+      const int fd = openDescriptor(handle.path, fileStatus);
+      if (fd < 0)
+        throw openError(handle.path, std::strerror(errno));
+      if (FileKey(fileStatus.st_dev, fileStatus.st_ino) != handle.key)
+      {
+        ::close(fd);
+        throw openError(handle.path, "the file has been replaced since it was opened");
+      }
+      handle.fd = fd;
+      ++_counters.reopens;
+      ++_counters.openDescriptors;
+    }
+
+    void makeIdle(PooledFileHandle& handle)
+    {
+      handle.idleIt = _idleHandles.insert(_idleHandles.begin(), &handle);
+      handle.isIdle = true;
+    }
+
+    void closeDescriptor(PooledFileHandle& handle)
+    {
+      if (::close(handle.fd) != 0)
+        qiLogVerbose() << "Failed to close " << handle.path.str() << ": " << std::strerror(errno);
+      handle.fd = -1;
+      --_counters.openDescriptors;
+    }
+
+    // Costs a stat() of each idle file considered, least recently used first.
+    void closeOverflow()
+    {
+      auto idleIt = _idleHandles.end();
+      while (_counters.openDescriptors > _limits.maxOpenDescriptors && idleIt != _idleHandles.begin())
+      {
+        PooledFileHandle& handle = **--idleIt;
+        if (!canReopen(handle))
+          continue;
+
+        idleIt = _idleHandles.erase(idleIt);
+        handle.isIdle = false;
+        closeDescriptor(handle);
+        ++_counters.evictions;
+      }
+    }
+
+    static bool canReopen(const PooledFileHandle& handle)
+    {
+      struct stat fileStatus;
+      return ::stat(handle.path.bfsPath().c_str(), &fileStatus) == 0
+          && FileKey(fileStatus.st_dev, fileStatus.st_ino) == handle.key;
+    }
+
+    std::map<FileKey, Registration> _handles;
+    std::list<PooledFileHandle*> _idleHandles; // open and not pinned, most recently used first
+#endif
+
+    boost::mutex _mutex;
+    FileHandlePoolLimits _limits;
+    FileHandlePoolCounters _counters;
+  };
+}
+
+#ifndef _WIN32
+PooledFileHandle::~PooledFileHandle()
+{
+  FileHandlePool::instance().forget(*this);
+}
+
+PooledFileHandlePtr openPooledFile(const Path& localFilePath, std::streamsize& size)
+{
+  return FileHandlePool::instance().open(localFilePath, size);
+}
+
+PinnedDescriptor pinPooledDescriptor(const PooledFileHandlePtr& handle)
+{
+  FileHandlePool::instance().pin(*handle);
+  // The deleter keeps the handle alive until it is unpinned.
+  return PinnedDescriptor(&handle->fd, [handle](const int*) { FileHandlePool::instance().unpin(*handle); });
+}
+#endif
+
+void setFileHandlePoolLimits(const FileHandlePoolLimits& limits)
+{
+  FileHandlePool::instance().setLimits(limits);
+}
+
+FileHandlePoolLimits fileHandlePoolLimits()
+{
+  return FileHandlePool::instance().limits();
+}
+
+FileHandlePoolCounters fileHandlePoolCounters()
+{
+  return FileHandlePool::instance().counters();
+}
+}
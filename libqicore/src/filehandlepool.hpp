@@ -0,0 +1,42 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#pragma once
+#ifndef _QICORE_SRC_FILEHANDLEPOOL_HPP_
+#define _QICORE_SRC_FILEHANDLEPOOL_HPP_
+
+#include <iosfwd>
+#include <boost/shared_ptr.hpp>
+#include <qicore/file.hpp>
+
+namespace qi
+{
+  /** POSIX file descriptor of a local file, kept open as long as a copy of the pointer lives.
+      Descriptors of pooled files must be pinned only for the duration of a read or a copy:
+      the pool can only close the descriptors which are not pinned.
+  **/
+  using PinnedDescriptor = boost::shared_ptr<const int>;
+
+#ifndef _WIN32
+  /// Read handle of a local file, shared by all the openings of the same file (same device and inode).
+  class PooledFileHandle;
+  using PooledFileHandlePtr = boost::shared_ptr<PooledFileHandle>;
+
+  /** Open a local file through the process-wide pool of read handles.
+      Throws a std::runtime_error if the file cannot be opened.
+      @param localFilePath  Path of an existing file.
+      @param size           Set to the count of bytes of the file at the time of the call.
+      @return The handle shared by all the openings of this file.
+  **/
+  PooledFileHandlePtr openPooledFile(const Path& localFilePath, std::streamsize& size);
+
+  /** Get an open descriptor of a pooled file, reopening it if the pool closed it.
+      Throws a std::runtime_error if the file cannot be reopened, or has been replaced since it was opened.
+  **/
+  PinnedDescriptor pinPooledDescriptor(const PooledFileHandlePtr& handle);
+#endif
+}
+
+#endif
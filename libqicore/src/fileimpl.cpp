@@ -5,21 +5,212 @@
 
 #include <qicore/file.hpp>
 
-#include <boost/filesystem/fstream.hpp>
 #include <algorithm>
-#include <vector>
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
 
 #include <qi/anymodule.hpp>
 
+#include "diskreadexecutor.hpp"
+#include "filecompression.hpp"
+#include "filecontent.hpp"
+#include "filedigest.hpp"
+
+qiLogCategory("qicore.file.fileimpl");
+
 // FIXME: Remove once deprecated method are removed
 #include <qi/detail/warn_push_ignore_deprecated.hpp>
 
 namespace qi
 {
+namespace
+{
+  /// Content of a file read through its File interface, by the default implementations of the File members.
+  class FileInterfaceContent : public FileContent
+  {
+  public:
+    explicit FileInterfaceContent(File& file)
+      : _file(file)
+      , _size(file.size())
+    {
+    }
+
+    std::streamsize size() const override
+    {
+      return _size;
+    }
+
+    Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) const override
+    {
+      Buffer output;
+      while (countBytesToRead > 0)
+      {
+        const std::streamsize byteCount = std::min(countBytesToRead, static_cast<std::streamsize>(File::MAX_READ_SIZE));
+        const Buffer data = _file.read(beginOffset, byteCount);
+        if (data.totalSize() == 0)
+          break;
+        output.write(data.data(), data.totalSize());
+        beginOffset += static_cast<std::streamoff>(data.totalSize());
+        countBytesToRead -= static_cast<std::streamsize>(data.totalSize());
+      }
+      return output;
+    }
+
+  private:
+    File& _file;
+    const std::streamsize _size;
+  };
+
+  void requireReadableTotalSize(const std::vector<File::ByteRange>& ranges)
+  {
+    std::streamsize totalBytesToRead = 0;
+    for (const auto& range : ranges)
+      totalBytesToRead += std::max(range.second, std::streamsize(0));
+    if (totalBytesToRead > File::MAX_READ_SIZE)
+      throw std::runtime_error("Tried to read too much data at once.");
+  }
+}
+
+// Default implementations, for the implementations of File predating these members.
+
+Future<Buffer> File::readAsync(std::streamoff beginOffset, std::streamsize countBytesToRead)
+{
+  try
+  {
+    return Future<Buffer>(read(beginOffset, countBytesToRead));
+  }
+  catch (const std::exception& ex)
+  {
+    return makeFutureError<Buffer>(ex.what());
+  }
+}
+
+std::vector<Buffer> File::readMany(const std::vector<ByteRange>& ranges)
+{
+  requireReadableTotalSize(ranges);
+  std::vector<Buffer> output;
+  output.reserve(ranges.size());
+  for (const auto& range : ranges)
+    output.push_back(read(range.first, range.second));
+  return output;
+}
+
+std::pair<bool, Buffer> File::readCompressed(std::streamoff beginOffset, std::streamsize countBytesToRead)
+{
+  return std::make_pair(false, read(beginOffset, countBytesToRead));
+}
+
+std::string File::digest()
+{
+  if (!isOpen())
+    throw std::runtime_error("Trying to manipulate a closed file access.");
+  return digestFileContent(FileInterfaceContent(*this));
+}
+
+std::vector<File::BlockMatch> File::matchBlocks(std::streamsize blockSize,
+                                                const std::vector<BlockSignature>& signatures)
+{
+  if (blockSize <= 0 || blockSize > MAX_READ_SIZE)
+    throw std::runtime_error("Invalid block size to match.");
+  return matchFileBlocks(FileInterfaceContent(*this), blockSize, signatures);
+}
+
+FileStreamPtr File::openStream(std::streamoff, std::streamsize)
+{
+  throw std::runtime_error("This file cannot be streamed.");
+}
+
+class FileStreamImpl : public FileStream
+{
+public:
+  FileStreamImpl(FileContentPtr content, std::streamoff beginOffset, std::streamsize chunkSize)
+    : _content(std::move(content))
+    , _nextOffset(beginOffset)
+    , _chunkSize(chunkSize)
+  {
+  }
+
+  void addCredits(unsigned int credits) override
+  {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (_isStopped)
+        return;
+      _credits += credits;
+      // Only one call pumps the stream, the others just provide it credits.
+      if (_isPumping)
+        return;
+      _isPumping = true;
+    }
+    pump();
+  }
+
+  void stop() override
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _isStopped = true;
+  }
+
+private:
+  // Emit chunks as long as the stream has credits.
+  void pump()
+  {
+    while (true)
+    {
+      std::streamoff chunkOffset = 0;
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        if (_isStopped || _credits == 0)
+        {
+          _isPumping = false;
+          return;
+        }
+        --_credits;
+        chunkOffset = _nextOffset;
+        _nextOffset += _chunkSize;
+      }
+
+      Buffer chunk;
+      try
+      {
+        chunk = _content->read(chunkOffset, _chunkSize);
+      }
+      catch (...)
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        _isStopped = true;
+        _isPumping = false;
+        throw;
+      }
+
+      if (chunk.totalSize() > 0)
+        chunkStreamed(chunkOffset, chunk);
+
+      if (chunkOffset + _chunkSize >= _content->size())
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        _isStopped = true;
+        _isPumping = false;
+        return;
+      }
+    }
+  }
+
+  boost::mutex _mutex;
+  const FileContentPtr _content;
+  std::streamoff _nextOffset;
+  const std::streamsize _chunkSize;
+  unsigned int _credits = 0;
+  bool _isPumping = false;
+  bool _isStopped = false;
+};
+
 class FileImpl : public File
 {
 public:
-  explicit FileImpl(const Path& localFilePath)
+  explicit FileImpl(const Path& localFilePath, FileAccessMode accessMode = FileAccessMode_Stream)
   {
     if (!localFilePath.exists())
     {
@@ -30,75 +221,198 @@ public:
 
     _progressNotifier = createProgressNotifier();
 
-    _fileStream.open(localFilePath, std::ios::in | std::ios::binary);
-    if (_fileStream.is_open())
+    try
     {
-      _fileStream.seekg(0, _fileStream.end);
-      _size = _fileStream.tellg();
-      _fileStream.seekg(0, _fileStream.beg);
-      assert(_fileStream.tellg() == std::streamoff(0));
+      _content = openFileContent(localFilePath, accessMode);
+    }
+    catch (const std::runtime_error& ex)
+    {
+      qiLogWarning() << ex.what();
     }
   }
 
   ~FileImpl() = default;
 
+  // Positional reads do not use the cursor: they can be executed concurrently.
   Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) override
   {
-    if (seek(beginOffset))
-      return read(countBytesToRead);
-    else
-      return {};
+    const FileContentPtr content = requireOpenFile();
+    requireReadableSize(countBytesToRead);
+    return content->read(beginOffset, countBytesToRead);
+  }
+
+  Future<Buffer> readAsync(std::streamoff beginOffset, std::streamsize countBytesToRead) override
+  {
+    FileContentPtr content;
+    try
+    {
+      content = requireOpenFile();
+      requireReadableSize(countBytesToRead);
+    }
+    catch (const std::runtime_error& ex)
+    {
+      return makeFutureError<Buffer>(ex.what());
+    }
+    return scheduleDiskRead<Buffer>(this, [content, beginOffset, countBytesToRead] {
+      return content->read(beginOffset, countBytesToRead);
+    });
   }
 
   Buffer read(std::streamsize countBytesToRead) override
   {
-    requireOpenFile();
-    if (countBytesToRead > MAX_READ_SIZE)
-      throw std::runtime_error("Tried to read too much data at once.");
+    const FileContentPtr content = requireOpenFile();
+    requireReadableSize(countBytesToRead);
 
-    Buffer output;
+    const std::streamoff beginOffset = advanceCursor(*content, countBytesToRead);
+    return content->read(beginOffset, countBytesToRead);
+  }
 
-    assert(_fileStream.is_open());
-    const std::streamoff initialCursorPos = static_cast<std::streamoff>(_fileStream.tellg());
-    const std::streamoff targetEnd = std::min(initialCursorPos + countBytesToRead, static_cast<std::streamoff>(_size));
-    const std::streamsize distanceToTargetEnd = targetEnd - initialCursorPos;
-    const std::streamsize byteCountToRead = std::min(static_cast<std::streamsize>(MAX_READ_SIZE), distanceToTargetEnd);
-    assert(byteCountToRead <= MAX_READ_SIZE);
+  Future<Buffer> readFromCursorAsync(std::streamsize countBytesToRead)
+  {
+    FileContentPtr content;
+    std::streamoff beginOffset = 0;
+    try
+    {
+      content = requireOpenFile();
+      requireReadableSize(countBytesToRead);
+      beginOffset = advanceCursor(*content, countBytesToRead);
+    }
+    catch (const std::runtime_error& ex)
+    {
+      return makeFutureError<Buffer>(ex.what());
+    }
+    return scheduleDiskRead<Buffer>(this, [content, beginOffset, countBytesToRead] {
+      return content->read(beginOffset, countBytesToRead);
+    });
+  }
 
-    _readBuffer.resize(static_cast<size_t>(byteCountToRead), '\0');
-    _fileStream.read(_readBuffer.data(), byteCountToRead);
-    const std::streamsize bytesRead = _fileStream.gcount();
-    assert(bytesRead <= byteCountToRead);
-    output.write(_readBuffer.data(), static_cast<size_t>(bytesRead));
+  std::vector<Buffer> readMany(const std::vector<ByteRange>& ranges) override
+  {
+    const FileContentPtr content = requireOpenFile();
+    requireReadableTotalSize(ranges);
+    return readRanges(*content, ranges);
+  }
 
-    return output;
+  Future<std::vector<Buffer>> readManyAsync(const std::vector<ByteRange>& ranges)
+  {
+    FileContentPtr content;
+    try
+    {
+      content = requireOpenFile();
+      requireReadableTotalSize(ranges);
+    }
+    catch (const std::runtime_error& ex)
+    {
+      return makeFutureError<std::vector<Buffer>>(ex.what());
+    }
+    return scheduleDiskRead<std::vector<Buffer>>(this, [content, ranges] {
+      return readRanges(*content, ranges);
+    });
+  }
+
+  std::pair<bool, Buffer> readCompressed(std::streamoff beginOffset, std::streamsize countBytesToRead) override
+  {
+    const FileContentPtr content = requireOpenFile();
+    requireReadableSize(countBytesToRead);
+    return readCompressedChunk(*content, beginOffset, countBytesToRead);
+  }
+
+  Future<std::pair<bool, Buffer>> readCompressedAsync(std::streamoff beginOffset, std::streamsize countBytesToRead)
+  {
+    FileContentPtr content;
+    try
+    {
+      content = requireOpenFile();
+      requireReadableSize(countBytesToRead);
+    }
+    catch (const std::runtime_error& ex)
+    {
+      return makeFutureError<std::pair<bool, Buffer>>(ex.what());
+    }
+    return scheduleDiskRead<std::pair<bool, Buffer>>(this, [content, beginOffset, countBytesToRead] {
+      return readCompressedChunk(*content, beginOffset, countBytesToRead);
+    });
+  }
+
+  std::vector<BlockMatch> matchBlocks(std::streamsize blockSize, const std::vector<BlockSignature>& signatures) override
+  {
+    const FileContentPtr content = requireOpenFile();
+    requireMatchableBlockSize(blockSize);
+    return matchFileBlocks(*content, blockSize, signatures);
+  }
+
+  Future<std::vector<BlockMatch>> matchBlocksAsync(std::streamsize blockSize,
+                                                   const std::vector<BlockSignature>& signatures)
+  {
+    FileContentPtr content;
+    try
+    {
+      content = requireOpenFile();
+      requireMatchableBlockSize(blockSize);
+    }
+    catch (const std::runtime_error& ex)
+    {
+      return makeFutureError<std::vector<BlockMatch>>(ex.what());
+    }
+    return scheduleDiskRead<std::vector<BlockMatch>>(this, [content, blockSize, signatures] {
+      return matchFileBlocks(*content, blockSize, signatures);
+    });
+  }
+
+  // Each stream is read from the content by its own object, referenced weakly to be stopped by close().
+  FileStreamPtr openStream(std::streamoff beginOffset, std::streamsize chunkSize) override
+  {
+    FileContentPtr content = requireOpenFile();
+    if (chunkSize <= 0 || chunkSize > MAX_READ_SIZE)
+      throw std::runtime_error("Invalid chunk size for a file stream.");
+
+    auto stream = boost::make_shared<FileStreamImpl>(std::move(content), beginOffset, chunkSize);
+    boost::mutex::scoped_lock lock(_streamsMutex);
+    _streams.erase(std::remove_if(_streams.begin(), _streams.end(),
+                                  [](const boost::weak_ptr<FileStreamImpl>& openStream) { return openStream.expired(); }),
+                   _streams.end());
+    _streams.push_back(stream);
+    return stream;
   }
 
   bool seek(std::streamoff offsetFromBegin) override
   {
-    requireOpenFile();
+    const FileContentPtr content = requireOpenFile();
 
-    if (offsetFromBegin >= _size)
+    if (offsetFromBegin >= content->size())
       return false;
 
-    _fileStream.seekg(offsetFromBegin);
+    boost::mutex::scoped_lock lock(_cursorMutex);
+    _cursor = offsetFromBegin;
     return true;
   }
 
   void close() override
   {
-    _fileStream.close();
-    _size = 0;
+    // Reads in progress keep their own reference on the content until they end.
+    boost::atomic_store(&_content, FileContentPtr{});
+
+    std::vector<boost::weak_ptr<FileStreamImpl>> streams;
+    {
+      boost::mutex::scoped_lock lock(_streamsMutex);
+      streams.swap(_streams);
+    }
+    for (const auto& weakStream : streams)
+    {
+      if (auto stream = weakStream.lock())
+        stream->stop();
+    }
   }
 
   std::streamsize size() const override
   {
-    return _size;
+    const FileContentPtr content = boost::atomic_load(&_content);
+    return content ? content->size() : 0;
   }
 
   bool isOpen() const override
   {
-    return _fileStream.is_open();
+    return boost::atomic_load(&_content) ? true : false;
   }
 
   bool isRemote() const override
@@ -111,6 +425,33 @@ public:
     return _progressNotifier;
   }
 
+  std::string digest() override
+  {
+    const FileContentPtr content = requireOpenFile();
+    return _digest->compute(*content);
+  }
+
+  Future<std::string> digestAsync()
+  {
+    FileContentPtr content;
+    try
+    {
+      content = requireOpenFile();
+    }
+    catch (const std::runtime_error& ex)
+    {
+      return makeFutureError<std::string>(ex.what());
+    }
+    const boost::shared_ptr<ContentDigest> digest = _digest;
+    return scheduleDiskRead<std::string>(this, [content, digest] { return digest->compute(*content); });
+  }
+
+  /// @return The content of the file, null if the file is closed.
+  FileContentPtr content() const
+  {
+    return boost::atomic_load(&_content);
+  }
+
   // Deprecated members:
   Buffer _read(std::streamoff beginOffset, std::streamsize countBytesToRead) override
   {
@@ -133,30 +474,168 @@ public:
   }
 
 private:
-  boost::filesystem::ifstream _fileStream;
-  std::vector<char> _readBuffer;
-  std::streamsize _size;
+  boost::mutex _streamsMutex;
+  std::vector<boost::weak_ptr<FileStreamImpl>> _streams;
+
+  FileContentPtr _content;
+  boost::mutex _cursorMutex;
+  std::streamoff _cursor = 0;
   ProgressNotifierPtr _progressNotifier;
 
-  void requireOpenFile()
+  // Computed once: concurrent callers wait for the first computation.
+  // Shared with the reads scheduled on the disk reader threads, which may outlive this object.
+  struct ContentDigest
   {
-    if (!_fileStream.is_open())
+    boost::mutex mutex;
+    std::string value;
+
+    std::string compute(const FileContent& content)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      if (value.empty())
+        value = digestFileContent(content);
+      return value;
+    }
+  };
+  const boost::shared_ptr<ContentDigest> _digest = boost::make_shared<ContentDigest>();
+
+  FileContentPtr requireOpenFile() const
+  {
+    FileContentPtr content = boost::atomic_load(&_content);
+    if (!content)
       throw std::runtime_error("Trying to manipulate a closed file access.");
+    return content;
+  }
+
+  static void requireReadableSize(std::streamsize countBytesToRead)
+  {
+    if (countBytesToRead > MAX_READ_SIZE)
+      throw std::runtime_error("Tried to read too much data at once.");
+  }
+
+  static void requireMatchableBlockSize(std::streamsize blockSize)
+  {
+    requireReadableSize(blockSize);
+    if (blockSize <= 0)
+      throw std::runtime_error("Invalid block size to match.");
+  }
+
+  /// @return The offset of the cursor before it is moved past the bytes to read.
+  std::streamoff advanceCursor(const FileContent& content, std::streamsize countBytesToRead)
+  {
+    boost::mutex::scoped_lock lock(_cursorMutex);
+    const std::streamoff beginOffset = _cursor;
+    _cursor = std::min(_cursor + std::max(countBytesToRead, std::streamsize(0)), content.size());
+    return beginOffset;
+  }
+
+  static std::vector<Buffer> readRanges(const FileContent& content, const std::vector<ByteRange>& ranges)
+  {
+    std::vector<Buffer> output;
+    output.reserve(ranges.size());
+    for (const auto& range : ranges)
+      output.push_back(content.read(range.first, range.second));
+    return output;
+  }
+
+  static std::pair<bool, Buffer> readCompressedChunk(const FileContent& content,
+                                                     std::streamoff beginOffset,
+                                                     std::streamsize countBytesToRead)
+  {
+    const Buffer data = content.read(beginOffset, countBytesToRead);
+    Buffer compressedData = compressFileChunk(data);
+    if (compressedData.totalSize() == 0)
+      return std::make_pair(false, data);
+    return std::make_pair(true, std::move(compressedData));
   }
 };
 
+namespace
+{
+  /** The calls of the messaging layer are served with futures: the local files are read on the disk reader
+      threads, in the queue of the File object, and never block the threads dispatching the calls.
+      The caller of a call is not known, so the File object given to a client stands for the client:
+      the clients opening the file on their own are served in turn, the clients sharing a File object
+      share its turn. The other implementations of File are called in the dispatching thread.
+  **/
+  template <typename T, typename Call>
+  Future<T> callInPlace(Call call)
+  {
+    try
+    {
+      return Future<T>(call());
+    }
+    catch (const std::exception& ex)
+    {
+      return makeFutureError<T>(ex.what());
+    }
+  }
+
+  Future<Buffer> serveRead(File* file, std::streamoff beginOffset, std::streamsize countBytesToRead)
+  {
+    return file->readAsync(beginOffset, countBytesToRead);
+  }
+
+  Future<Buffer> serveReadFromCursor(File* file, std::streamsize countBytesToRead)
+  {
+    if (auto localFile = dynamic_cast<FileImpl*>(file))
+      return localFile->readFromCursorAsync(countBytesToRead);
+    return callInPlace<Buffer>([&] { return file->read(countBytesToRead); });
+  }
+
+  Future<std::vector<Buffer>> serveReadMany(File* file, const std::vector<File::ByteRange>& ranges)
+  {
+    if (auto localFile = dynamic_cast<FileImpl*>(file))
+      return localFile->readManyAsync(ranges);
+    return callInPlace<std::vector<Buffer>>([&] { return file->readMany(ranges); });
+  }
+
+  Future<std::pair<bool, Buffer>> serveReadCompressed(File* file,
+                                                      std::streamoff beginOffset,
+                                                      std::streamsize countBytesToRead)
+  {
+    if (auto localFile = dynamic_cast<FileImpl*>(file))
+      return localFile->readCompressedAsync(beginOffset, countBytesToRead);
+    return callInPlace<std::pair<bool, Buffer>>([&] { return file->readCompressed(beginOffset, countBytesToRead); });
+  }
+
+  Future<std::vector<File::BlockMatch>> serveMatchBlocks(File* file,
+                                                         std::streamsize blockSize,
+                                                         const std::vector<File::BlockSignature>& signatures)
+  {
+    if (auto localFile = dynamic_cast<FileImpl*>(file))
+      return localFile->matchBlocksAsync(blockSize, signatures);
+    return callInPlace<std::vector<File::BlockMatch>>([&] { return file->matchBlocks(blockSize, signatures); });
+  }
+
+  Future<std::string> serveDigest(File* file)
+  {
+    if (auto localFile = dynamic_cast<FileImpl*>(file))
+      return localFile->digestAsync();
+    return callInPlace<std::string>([&] { return file->digest(); });
+  }
+}
+
 void _qiregisterFile()
 {
   ::qi::ObjectTypeBuilder<File> builder;
-
-  QI_OBJECT_BUILDER_ADVERTISE_OVERLOAD(builder, File, read, Buffer,(std::streamoff, std::streamsize));
-  QI_OBJECT_BUILDER_ADVERTISE_OVERLOAD(builder, File, read, Buffer, (std::streamsize));
+  // Reads are positional or protect the cursor: calls can be dispatched concurrently.
+  builder.setThreadingModel(ObjectThreadingModel_MultiThread);
+
+  builder.advertiseMethod("read", &serveRead);
+  builder.advertiseMethod("read", &serveReadFromCursor);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, File, readAsync);
+  builder.advertiseMethod("readMany", &serveReadMany);
+  builder.advertiseMethod("readCompressed", &serveReadCompressed);
+  builder.advertiseMethod("matchBlocks", &serveMatchBlocks);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, File, openStream);
   QI_OBJECT_BUILDER_ADVERTISE(builder, File, seek);
   QI_OBJECT_BUILDER_ADVERTISE(builder, File, close);
   QI_OBJECT_BUILDER_ADVERTISE(builder, File, size);
   QI_OBJECT_BUILDER_ADVERTISE(builder, File, isOpen);
   QI_OBJECT_BUILDER_ADVERTISE(builder, File, isRemote);
   QI_OBJECT_BUILDER_ADVERTISE(builder, File, operationProgress);
+  builder.advertiseMethod("digest", &serveDigest);
 
   // Deprecated members:
   QI_OBJECT_BUILDER_ADVERTISE_OVERLOAD(builder, File, _read, Buffer, (std::streamoff, std::streamsize));
@@ -182,14 +661,63 @@ void _qiregisterFile()
 
 }
 
+void _qiregisterFileStream()
+{
+  ::qi::ObjectTypeBuilder<FileStream> builder;
+  // Credits can be added while the stream is pumped: calls can be dispatched concurrently.
+  builder.setThreadingModel(ObjectThreadingModel_MultiThread);
+
+  QI_OBJECT_BUILDER_ADVERTISE(builder, FileStream, addCredits);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, FileStream, stop);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, FileStream, chunkStreamed);
+
+  builder.registerType();
+
+  {
+    qi::detail::ForceProxyInclusion<FileStream>().dummyCall();
+    qi::registerType(typeid(FileStreamImpl), qi::typeOf<FileStream>());
+    FileStreamImpl* ptr = static_cast<FileStreamImpl*>(reinterpret_cast<void*>(0x10000));
+    FileStream* pptr = ptr;
+    intptr_t offset = reinterpret_cast<intptr_t>(pptr)-reinterpret_cast<intptr_t>(ptr);
+    if (offset)
+    {
+      qiLogError("qitype.register") << "non-zero offset for implementation FileStreamImpl of FileStream,"
+        "call will fail at runtime";
+      throw std::runtime_error("non-zero offset between implementation and interface");
+    }
+  }
+}
+
 FilePtr openLocalFile(const qi::Path& localPath)
 {
   return boost::make_shared<FileImpl>(localPath);
 }
 
+FilePtr openLocalFile(const qi::Path& localPath, FileAccessMode accessMode)
+{
+  return boost::make_shared<FileImpl>(localPath, accessMode);
+}
+
+namespace detail
+{
+  std::unique_ptr<KernelFileCopy> startKernelFileCopy(const FilePtr& sourceFile, const Path& destinationPath)
+  {
+    FileImpl* const localFile = dynamic_cast<FileImpl*>(sourceFile.operator->());
+    if (!localFile)
+      return {};
+
+    FileContentPtr content = localFile->content();
+    if (!content)
+      return {};
+
+    return openKernelFileCopy(std::move(content), destinationPath);
+  }
+}
+
 void registerFileCreation(qi::ModuleBuilder& mb)
 {
-  mb.advertiseMethod("openLocalFile", &openLocalFile);
+  mb.advertiseMethod("openLocalFile", static_cast<FilePtr (*)(const qi::Path&)>(&openLocalFile));
+  mb.advertiseMethod("openLocalFile", static_cast<FilePtr (*)(const qi::Path&, FileAccessMode)>(&openLocalFile));
 }
 }
 
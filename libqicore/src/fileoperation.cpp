@@ -6,8 +6,69 @@
 #include <qicore/file.hpp>
 #include <qi/anymodule.hpp>
 
+#include "fileoperationtask.hpp"
+
 namespace qi
 {
+  FileOperation::~FileOperation()
+  {
+    auto task = std::move(_task);
+    if (task)
+    {
+      task->promise.future().cancel();
+    }
+  }
+
+  qi::Future<void> FileOperation::start()
+  {
+    if (!_task)
+    {
+      throw std::runtime_error{ "Tried to start an invalid FileOperation" };
+    }
+
+    if (_task->isLaunched.swap(true))
+    {
+      throw std::runtime_error{ "Called FileOperation::start() more than once!" };
+    }
+
+    return _task->run();
+  }
+
+  qi::Future<void> FileOperation::detach()
+  {
+    boost::shared_ptr<Task> sharedTask = std::move(_task);
+
+    if (!sharedTask)
+    {
+      throw std::runtime_error("Called FileOperation::detach() but no task is owned!");
+    }
+
+    if (!sharedTask->isLaunched._value)
+    {
+      throw std::runtime_error("Called FileOperation::detach() but task was not started!");
+    }
+
+    auto future = sharedTask->promise.future();
+    future.connect([sharedTask](const Future<void>&){}); // keep the task alive until it ends
+    return future;
+  }
+
+  ProgressNotifierPtr FileOperation::notifier() const
+  {
+    return _task ? _task->localNotifier : ProgressNotifierPtr{};
+  }
+
+  void FileOperation::setProgressNotificationPolicy(const ProgressNotificationPolicy& policy)
+  {
+    if (!_task)
+    {
+      throw std::runtime_error("Tried to set the progress notification policy of an invalid FileOperation");
+    }
+
+    boost::mutex::scoped_lock lock(_task->notificationMutex);
+    _task->progressPolicy = policy;
+  }
+
   template<class FileOpType, class... Args >
   auto launchStandalone(Args&&... args)->decltype(std::declval<FileOpType>().start())
   {
@@ -21,11 +82,46 @@ namespace qi
     return launchStandalone<FileCopyToLocal>(std::move(file), std::move(localPath));
   }
 
+  FutureSync<Buffer> copyToMemory(FilePtr file, std::size_t maxSize)
+  {
+    return launchStandalone<FileCopyToMemory>(std::move(file), maxSize);
+  }
+
+  FutureSync<void> copyToRemote(FilePtr file, WritableFilePtr destination)
+  {
+    return launchStandalone<FileCopyToRemote>(std::move(file), std::move(destination));
+  }
+
   FileOperationPtr prepareCopyToLocal(FilePtr file, Path localPath)
   {
     return boost::make_shared<FileCopyToLocal>(std::move(file), std::move(localPath));
   }
 
+  FileOperationPtr prepareParallelCopyToLocal(FilePtr file, Path localPath, unsigned int rangeCount)
+  {
+    return boost::make_shared<FileParallelCopyToLocal>(std::move(file), std::move(localPath), rangeCount);
+  }
+
+  FileOperationPtr prepareResumableCopyToLocal(FilePtr file, Path localPath)
+  {
+    return boost::make_shared<FileResumableCopyToLocal>(std::move(file), std::move(localPath));
+  }
+
+  FileOperationPtr prepareSyncToLocal(FilePtr file, Path localPath)
+  {
+    return boost::make_shared<FileSyncToLocal>(std::move(file), std::move(localPath));
+  }
+
+  FileOperationPtr prepareBatchCopyToLocal(std::vector<FileBatchCopyToLocal::Item> items)
+  {
+    return boost::make_shared<FileBatchCopyToLocal>(std::move(items));
+  }
+
+  FileOperationPtr prepareCopyToRemote(FilePtr file, WritableFilePtr destination)
+  {
+    return boost::make_shared<FileCopyToRemote>(std::move(file), std::move(destination));
+  }
+
   void _qiregisterFileOperation()
   {
     ::qi::ObjectTypeBuilder<FileOperation> builder;
@@ -41,6 +137,13 @@ namespace qi
   {
     mb.advertiseMethod("copyToLocal", &copyToLocal);
     mb.advertiseMethod("FileCopyToLocal", &prepareCopyToLocal);
+    mb.advertiseMethod("FileParallelCopyToLocal", &prepareParallelCopyToLocal);
+    mb.advertiseMethod("FileResumableCopyToLocal", &prepareResumableCopyToLocal);
+    mb.advertiseMethod("FileBatchCopyToLocal", &prepareBatchCopyToLocal);
+    mb.advertiseMethod("FileSyncToLocal", &prepareSyncToLocal);
+    mb.advertiseMethod("copyToMemory", &copyToMemory);
+    mb.advertiseMethod("copyToRemote", &copyToRemote);
+    mb.advertiseMethod("FileCopyToRemote", &prepareCopyToRemote);
   }
 
 }
@@ -0,0 +1,391 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#pragma once
+#ifndef _QICORE_SRC_FILEOPERATIONTASK_HPP_
+#define _QICORE_SRC_FILEOPERATIONTASK_HPP_
+
+#include <qicore/file.hpp>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <qi/log.hpp>
+#include <qi/detail/warn_push_ignore_deprecated.hpp>
+
+namespace qi
+{
+  namespace detail
+  {
+    /** Accumulates the measures of a transfer, see TransferTelemetry.
+        Recording a measure is a few arithmetic operations under a mutex that is never held
+        while calling other code: read latencies are counted in a histogram with logarithmic buckets
+        instead of being stored.
+    **/
+    class TransferMeter
+    {
+    public:
+      using Clock = std::chrono::steady_clock;
+
+      void start()
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        _startTime = _lastSnapshotTime = Clock::now();
+      }
+
+      void addTransferredBytes(std::streamsize byteCount)
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        _bytesTransferred += byteCount;
+      }
+
+      void addReadLatency(Clock::duration latency)
+      {
+        const double microseconds = std::chrono::duration<double, std::micro>(latency).count();
+        const int bucket = microseconds <= LATENCY_BUCKETS_ORIGIN_US
+            ? 0
+            : static_cast<int>(2.0 * std::log2(microseconds / LATENCY_BUCKETS_ORIGIN_US));
+        boost::mutex::scoped_lock lock(_mutex);
+        ++_latencyBuckets[static_cast<std::size_t>(std::min(bucket, LATENCY_BUCKET_COUNT - 1))];
+        ++_latencyCount;
+      }
+
+      void addLocalWriteTime(Clock::duration writeTime)
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        _localWriteTime += writeTime;
+      }
+
+      /** @param remainingBytes  Count of bytes left to transfer, used to estimate the remaining time.
+          @return The measures since the start, the instantaneous throughput is measured since the previous call.
+      **/
+      TransferTelemetry snapshot(std::streamsize remainingBytes)
+      {
+        static const double THROUGHPUT_SMOOTHING = 0.3;
+        TransferTelemetry telemetry;
+
+        boost::mutex::scoped_lock lock(_mutex);
+        const auto now = Clock::now();
+        const double elapsed = std::chrono::duration<double>(now - _startTime).count();
+        const double sinceLastSnapshot = std::chrono::duration<double>(now - _lastSnapshotTime).count();
+
+        telemetry.bytesTransferred = _bytesTransferred;
+        if (elapsed > 0.0)
+          telemetry.averageThroughput = static_cast<double>(_bytesTransferred) / elapsed;
+        telemetry.throughput = sinceLastSnapshot > 0.0
+            ? static_cast<double>(_bytesTransferred - _lastSnapshotBytes) / sinceLastSnapshot
+            : _lastThroughput;
+        _smoothedThroughput = _smoothedThroughput == 0.0
+            ? telemetry.throughput
+            : (1.0 - THROUGHPUT_SMOOTHING) * _smoothedThroughput + THROUGHPUT_SMOOTHING * telemetry.throughput;
+        if (remainingBytes <= 0)
+          telemetry.estimatedTimeRemaining = 0.0;
+        else if (_smoothedThroughput > 0.0)
+          telemetry.estimatedTimeRemaining = static_cast<double>(remainingBytes) / _smoothedThroughput;
+
+        telemetry.readLatencyMedian = latencyPercentile(0.5);
+        telemetry.readLatency90 = latencyPercentile(0.9);
+        telemetry.readLatency99 = latencyPercentile(0.99);
+        telemetry.localWriteTime = std::chrono::duration<double>(_localWriteTime).count();
+
+        _lastSnapshotTime = now;
+        _lastSnapshotBytes = _bytesTransferred;
+        _lastThroughput = telemetry.throughput;
+        return telemetry;
+      }
+
+    private:
+      // Bucket i counts latencies below ORIGIN * 2^((i + 1) / 2): from 20us to about 2 minutes.
+      static constexpr int LATENCY_BUCKET_COUNT = 48;
+      static constexpr double LATENCY_BUCKETS_ORIGIN_US = 10.0;
+
+      // Must be called with the mutex locked. @return The upper bound of the bucket in seconds.
+      double latencyPercentile(double ratio) const
+      {
+        if (_latencyCount == 0)
+          return 0.0;
+
+        const auto rank = static_cast<std::uint64_t>(std::ceil(ratio * static_cast<double>(_latencyCount)));
+        std::uint64_t count = 0;
+        int bucket = 0;
+        for (; bucket < LATENCY_BUCKET_COUNT - 1; ++bucket)
+        {
+          count += _latencyBuckets[static_cast<std::size_t>(bucket)];
+          if (count >= rank)
+            break;
+        }
+        return LATENCY_BUCKETS_ORIGIN_US * std::exp2((bucket + 1) / 2.0) * 1e-6;
+      }
+
+      boost::mutex _mutex;
+      Clock::time_point _startTime;
+      Clock::time_point _lastSnapshotTime;
+      std::streamsize _bytesTransferred = 0;
+      std::streamsize _lastSnapshotBytes = 0;
+      double _lastThroughput = 0.0;
+      double _smoothedThroughput = 0.0;
+      std::array<std::uint64_t, LATENCY_BUCKET_COUNT> _latencyBuckets{};
+      std::uint64_t _latencyCount = 0;
+      Clock::duration _localWriteTime{ 0 };
+    };
+  }
+
+  /// State of a running file operation, shared with the continuations of the operation.
+  struct FileOperation::Task
+    : public boost::enable_shared_from_this<FileOperation::Task>
+  {
+    Task(FilePtr file)
+      : sourceFile{ std::move(file) }
+      , fileSize{ sourceFile->size() }
+      , promise{ PromiseNoop<void> }
+      , localNotifier{ createProgressNotifier(promise.future()) }
+      , remoteNotifier{ sourceFile->operationProgress() }
+      , isRemoteDeprecated(sourceFile.metaObject().findMethod("read").empty())
+      , hasRemoteTelemetry(!isRemoteDeprecated && !remoteNotifier.metaObject().findMethod("notifyTelemetry").empty())
+      , readFuncName(isRemoteDeprecated ? "_read"
+                     : sourceFile.metaObject().findMethod("readAsync").empty() ? "read" : "readAsync")
+    {
+    }
+
+    /// For operations without a single source file: there is no remote notifier to notify.
+    explicit Task(std::streamsize totalSize)
+      : fileSize{ totalSize }
+      , promise{ PromiseNoop<void> }
+      , localNotifier{ createProgressNotifier(promise.future()) }
+      , isRemoteDeprecated(false)
+      , hasRemoteTelemetry(false)
+      , readFuncName("read")
+    {
+    }
+
+    virtual ~Task() = default;
+
+    qi::Future<void> run()
+    {
+      localNotifier->reset();
+      if (remoteNotifier)
+        isRemoteDeprecated ? remoteNotifier->_reset() : remoteNotifier->reset();
+      localNotifier->notifyRunning();
+      if (remoteNotifier)
+        isRemoteDeprecated ? remoteNotifier->_notifyRunning() : remoteNotifier->notifyRunning();
+      meter.start();
+      start();
+      return promise.future();
+    }
+
+    // The following notifications can be called concurrently from the continuations
+    // of the operation: only the first end of the operation is taken into account and
+    // progress notified after the end or lower than an already notified progress are ignored.
+    // Progress held back by the progress policy is notified before the end of the operation.
+    // What to notify is decided with the notification mutex locked, the notifications are made out of it:
+    // the observers of the notifiers may call back the operation, and the remote notifier is called
+    // without waiting for the source.
+
+    void finish()
+    {
+      {
+        boost::mutex::scoped_lock lock(notificationMutex);
+        if (isTerminated.swap(true))
+          return;
+        publishPendingProgress();
+        Promise<void> operationPromise = promise;
+        pendingNotifications.push_back([operationPromise]() mutable { operationPromise.setValue(0); });
+        queueEndNotification([](const ProgressNotifierPtr& notifier) { notifier->notifyFinished(); },
+                             "notifyFinished");
+      }
+      publishNotifications();
+      sendRemoteTelemetry();
+    }
+
+    void fail(const std::string& errorMessage)
+    {
+      {
+        boost::mutex::scoped_lock lock(notificationMutex);
+        if (isTerminated.swap(true))
+          return;
+        publishPendingProgress();
+        Promise<void> operationPromise = promise;
+        pendingNotifications.push_back([operationPromise, errorMessage]() mutable {
+          operationPromise.setError(errorMessage);
+        });
+        queueEndNotification([](const ProgressNotifierPtr& notifier) { notifier->notifyFailed(); },
+                             "notifyFailed");
+      }
+      publishNotifications();
+      sendRemoteTelemetry();
+    }
+
+    void cancel()
+    {
+      {
+        boost::mutex::scoped_lock lock(notificationMutex);
+        if (isTerminated.swap(true))
+          return;
+        publishPendingProgress();
+        Promise<void> operationPromise = promise;
+        pendingNotifications.push_back([operationPromise]() mutable { operationPromise.setCanceled(); });
+        queueEndNotification([](const ProgressNotifierPtr& notifier) { notifier->notifyCanceled(); },
+                             "notifyCanceled");
+      }
+      publishNotifications();
+      sendRemoteTelemetry();
+    }
+
+    void notifyProgressed(double newProgress)
+    {
+      {
+        boost::mutex::scoped_lock lock(notificationMutex);
+        if (isTerminated._value || newProgress <= pendingProgress)
+          return;
+        pendingProgress = newProgress;
+
+        const auto now = std::chrono::steady_clock::now();
+        const bool isHeldBack = now - lastNotificationTime < progressPolicy.minInterval
+            || newProgress - lastNotifiedProgress < progressPolicy.minProgressDelta;
+        if (isHeldBack && newProgress < 1.0)
+          return;
+
+        lastNotificationTime = now;
+        publishProgress(newProgress);
+      }
+      publishNotifications();
+      sendRemoteTelemetry();
+    }
+
+    // Must be called with the notification mutex locked.
+    void publishPendingProgress()
+    {
+      if (pendingProgress > lastNotifiedProgress)
+        publishProgress(pendingProgress);
+    }
+
+    // Must be called with the notification mutex locked.
+    void publishProgress(double newProgress)
+    {
+      lastNotifiedProgress = newProgress;
+      const auto remainingBytes = static_cast<std::streamsize>((1.0 - newProgress) * static_cast<double>(fileSize));
+      const TransferTelemetry telemetry = meter.snapshot(remainingBytes);
+
+      const ProgressNotifierPtr notifier = localNotifier;
+      pendingNotifications.push_back([notifier, newProgress, telemetry] {
+        notifier->notifyProgressed(newProgress);
+        notifier->notifyTelemetry(telemetry);
+      });
+      if (remoteNotifier)
+      {
+        const ProgressNotifierPtr notifiedRemote = remoteNotifier;
+        const std::string funcName = isRemoteDeprecated ? "_notifyProgressed" : "notifyProgressed";
+        pendingNotifications.push_back([notifiedRemote, funcName, newProgress] {
+          notifiedRemote.async<void>(funcName, newProgress);
+        });
+      }
+
+      if (hasRemoteTelemetry && isRemoteTelemetryEnabled)
+      {
+        remoteTelemetry = telemetry;
+        hasPendingRemoteTelemetry = true;
+      }
+    }
+
+    // Must be called with the notification mutex locked.
+    void queueEndNotification(boost::function<void(const ProgressNotifierPtr&)> notifyLocal,
+                              const std::string& funcName)
+    {
+      const ProgressNotifierPtr notifier = localNotifier;
+      pendingNotifications.push_back([notifier, notifyLocal] { notifyLocal(notifier); });
+      if (remoteNotifier)
+      {
+        const ProgressNotifierPtr notifiedRemote = remoteNotifier;
+        const std::string remoteFuncName = isRemoteDeprecated ? "_" + funcName : funcName;
+        pendingNotifications.push_back([notifiedRemote, remoteFuncName] {
+          notifiedRemote.async<void>(remoteFuncName);
+        });
+      }
+    }
+
+    // Makes the queued notifications in order, unless another thread is already making them.
+    // Must be called without the notification mutex locked.
+    void publishNotifications()
+    {
+      boost::mutex::scoped_lock lock(notificationMutex);
+      if (isPublishingNotifications)
+        return;
+      isPublishingNotifications = true;
+      while (!pendingNotifications.empty())
+      {
+        const boost::function<void()> notification = std::move(pendingNotifications.front());
+        pendingNotifications.pop_front();
+        lock.unlock();
+        try
+        {
+          notification();
+        }
+        catch (const std::exception& ex)
+        {
+          qiLogWarning("qicore.file.fileoperation") << "Failed to notify the progress of a file operation: " << ex.what();
+        }
+        lock.lock();
+      }
+      isPublishingNotifications = false;
+    }
+
+    // Only the latest telemetry is sent, without waiting for the source.
+    // Must be called without the notification mutex locked.
+    void sendRemoteTelemetry()
+    {
+      TransferTelemetry telemetry;
+      {
+        boost::mutex::scoped_lock lock(notificationMutex);
+        if (!hasPendingRemoteTelemetry)
+          return;
+        hasPendingRemoteTelemetry = false;
+        telemetry = remoteTelemetry;
+      }
+      remoteNotifier.async<void>("notifyTelemetry", telemetry);
+    }
+
+    virtual void start() = 0;
+
+    // Call the handler as soon as the future is set, synchronously if it is already set.
+    template <typename T, typename Handler>
+    static void whenReady(Future<T> future, Handler handler)
+    {
+      if (future.isFinished())
+        handler(future);
+      else
+        future.connect(std::move(handler));
+    }
+
+    qi::Atomic<bool> isLaunched{ false };
+    qi::Atomic<bool> isTerminated{ false };
+    boost::mutex notificationMutex;
+    std::deque<boost::function<void()>> pendingNotifications; // made in order by publishNotifications()
+    bool isPublishingNotifications = false;
+    double lastNotifiedProgress = 0.0;
+    double pendingProgress = 0.0;
+    std::chrono::steady_clock::time_point lastNotificationTime;
+    ProgressNotificationPolicy progressPolicy;
+    const FilePtr sourceFile;
+    const std::streamsize fileSize;
+    Promise<void> promise;
+    const ProgressNotifierPtr localNotifier;
+    const ProgressNotifierPtr remoteNotifier;
+    const bool isRemoteDeprecated;
+    const bool hasRemoteTelemetry;
+    bool isRemoteTelemetryEnabled = false; // the remote notifier is only given the telemetry on request
+    TransferTelemetry remoteTelemetry;     // published but not sent to the remote notifier yet
+    bool hasPendingRemoteTelemetry = false;
+    /// Method reading a range of the source file, served without blocking a thread of the source when possible.
+    const char* const readFuncName;
+    detail::TransferMeter meter;
+  };
+}
+
+#include <qi/detail/warn_pop_ignore_deprecated.hpp>
+#endif
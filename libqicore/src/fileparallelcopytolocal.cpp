@@ -0,0 +1,122 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <boost/filesystem/operations.hpp>
+
+#include "filecopytolocal.hpp"
+
+namespace qi
+{
+  class FileParallelCopyToLocal::Task
+    : public FileCopyToLocal::Task
+  {
+  public:
+    Task(FilePtr sourceFile, qi::Path localFilePath, unsigned int rangeCount, FileTransferOptions transferOptions)
+      : FileCopyToLocal::Task(std::move(sourceFile), std::move(localFilePath), std::move(transferOptions))
+    {
+      rangeCount = std::max(rangeCount, 1u);
+      const std::streamsize rangeSize = (fileSize + rangeCount - 1) / rangeCount;
+      for (std::streamoff rangeBegin = 0; rangeBegin < fileSize; rangeBegin += rangeSize)
+        ranges.push_back(Range{ rangeBegin, rangeBegin, std::min(rangeBegin + rangeSize, fileSize), false });
+
+      if (!localPath.isEmpty())
+        options.maxReadsInFlight = static_cast<unsigned int>(ranges.size());
+      options.allowStreaming = false;
+    }
+
+    // Sinks take the data in order: all the ranges but the first one would be held in memory.
+    void addSink(FileSinkPtr) override
+    {
+      throw std::runtime_error("A parallel copy cannot provide the content to sinks.");
+    }
+
+    // Without sinks, the received content is digested once written, by reading the local file again.
+    void startDigestingReceivedContent() override
+    {
+    }
+
+    std::string digestReceivedContent() override
+    {
+      try
+      {
+        return openLocalFile(localPath)->digest();
+      }
+      catch (const std::exception&)
+      {
+        return {};
+      }
+    }
+
+    bool makeLocalFile() override
+    {
+      if (!FileCopyToLocal::Task::makeLocalFile())
+        return false;
+
+      if (localFile.is_open())
+      {
+        boost::system::error_code error;
+        boost::filesystem::resize_file(localPath.bfsPath(), static_cast<boost::uintmax_t>(fileSize), error);
+        if (error)
+        {
+          fail("Failed to preallocate local file copy: " + error.message());
+          clearLocalFile();
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool takeNextRequest(ReadRequest& request) override
+    {
+      if (readsInFlight >= options.maxReadsInFlight)
+        return false;
+
+      for (auto& range : ranges)
+      {
+        if (range.isFetching || range.next >= range.end)
+          continue;
+
+        request.offset = range.next;
+        request.size = std::min(chunkSize, range.end - range.next);
+        range.next += request.size;
+        range.isFetching = true;
+        return true;
+      }
+      return false;
+    }
+
+    void releaseRequest(const ReadRequest& request) override
+    {
+      for (auto& range : ranges)
+      {
+        if (request.offset >= range.begin && request.offset < range.end)
+        {
+          range.isFetching = false;
+          return;
+        }
+      }
+    }
+
+    struct Range
+    {
+      std::streamoff begin;
+      std::streamoff next;    ///< First byte of the range not requested yet.
+      std::streamoff end;
+      bool isFetching;        ///< A read of this range is in flight.
+    };
+
+    std::vector<Range> ranges;
+  };
+
+  FileParallelCopyToLocal::FileParallelCopyToLocal(qi::FilePtr file, qi::Path localPath, unsigned int rangeCount,
+                                                   FileTransferOptions options)
+    : FileCopyToLocal(boost::make_shared<Task>(std::move(file), std::move(localPath), rangeCount, std::move(options)))
+  {
+  }
+}
@@ -0,0 +1,269 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <boost/crc.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include "filecopytolocal.hpp"
+
+namespace qi
+{
+  class FileResumableCopyToLocal::Task
+    : public FileCopyToLocal::Task
+  {
+  public:
+    Task(FilePtr sourceFile, qi::Path localFilePath, FileTransferOptions transferOptions)
+      : FileCopyToLocal::Task(std::move(sourceFile), std::move(localFilePath), std::move(transferOptions))
+      , manifestFilePath(manifestPath(localPath))
+      , chunkCount(static_cast<std::size_t>((fileSize + chunkSize - 1) / chunkSize))
+      , chunkChecksums(chunkCount, 0)
+      , isChunkVerified(chunkCount, false)
+    {
+      // The chunks must match the ones recorded in the manifest.
+      options.minChunkSize = options.maxChunkSize = chunkSize;
+      options.allowStreaming = false;
+      options.allowKernelCopy = false;
+      options.useCopyCache = false;
+    }
+
+    // The chunks already copied are not transferred again.
+    void addSink(FileSinkPtr) override
+    {
+      throw std::runtime_error("A resumable copy cannot provide the content to sinks.");
+    }
+
+    // The digest of the source identifies its content, it costs a round trip and a read of the
+    // whole source file by its owner before the transfer starts.
+    void startTransfer() override
+    {
+      if (isRemoteDeprecated || sourceFile.metaObject().findMethod("digest").empty())
+      {
+        fetchContent();
+        return;
+      }
+
+      auto myself = shared_from_this();
+      sourceFile.async<std::string>("digest").connect([this, myself](Future<std::string> futureDigest) {
+        // Without digest, the copy is made from scratch.
+        if (futureDigest.hasValue())
+          sourceDigest = futureDigest.value();
+
+        if (promise.isCancelRequested())
+          cancel();
+        else
+          fetchContent();
+      });
+    }
+
+    bool makeLocalFile() override
+    {
+      if (localPath.isEmpty())
+      {
+        fail("A resumable copy requires a local file path.");
+        return false;
+      }
+
+      const bool isResuming = loadManifest() && verifyLocalChunks();
+      if (isResuming)
+        localFile.open(localPath.bfsPath(), std::ios::in | std::ios::out | std::ios::binary);
+      else
+        localFile.open(localPath.bfsPath(), std::ios::out | std::ios::binary);
+
+      if (isResuming)
+        manifestFile.open(manifestFilePath.bfsPath(), std::ios::out | std::ios::app);
+      else
+        manifestFile.open(manifestFilePath.bfsPath(), std::ios::out | std::ios::trunc);
+
+      if (!localFile.is_open() || !manifestFile.is_open())
+      {
+        fail("Failed to create local file copy.");
+        return false;
+      }
+
+      if (!isResuming)
+      {
+        std::fill(isChunkVerified.begin(), isChunkVerified.end(), false);
+        manifestFile << manifestHeader() << '\n' << fileSize << ' ' << chunkSize << ' '
+                     << (sourceDigest.empty() ? std::string("unknown") : sourceDigest) << '\n' << std::flush;
+      }
+
+      bytesWritten = 0;
+      for (std::size_t chunkIdx = 0; chunkIdx < chunkCount; ++chunkIdx)
+      {
+        if (isChunkVerified[chunkIdx])
+          bytesWritten += chunkSizeAt(chunkIdx);
+      }
+      return true;
+    }
+
+    bool takeNextRequest(ReadRequest& request) override
+    {
+      if (readsInFlight >= options.maxReadsInFlight)
+        return false;
+
+      while (nextChunkIdx < chunkCount && isChunkVerified[nextChunkIdx])
+        ++nextChunkIdx;
+      if (nextChunkIdx >= chunkCount)
+        return false;
+
+      request.offset = static_cast<std::streamoff>(nextChunkIdx) * chunkSize;
+      request.size = chunkSizeAt(nextChunkIdx);
+      ++nextChunkIdx;
+      return true;
+    }
+
+    void onChunkWritten(std::streamoff offset, const Buffer& chunk) override
+    {
+      const std::size_t chunkIdx = static_cast<std::size_t>(offset / chunkSize);
+      chunkChecksums[chunkIdx] = checksum(chunk.data(), chunk.totalSize());
+      isChunkVerified[chunkIdx] = true;
+
+      // The data must reach the file before the manifest claims it is there.
+      localFile.flush();
+      manifestFile << chunkIdx << ' ' << std::hex << chunkChecksums[chunkIdx] << std::dec << '\n' << std::flush;
+    }
+
+    void stop() override
+    {
+      {
+        boost::mutex::scoped_lock writeLock(writeMutex);
+        closeLocalFile();
+        manifestFile.close();
+      }
+
+      if (!verifyLocalFile() || !verifyLocalDigest())
+      {
+        FileCopyToLocal::Task::clearLocalFile();
+        boost::filesystem::remove(manifestFilePath);
+        fail("The local file copy does not match the received data.");
+        return;
+      }
+
+      boost::filesystem::remove(manifestFilePath);
+      finish();
+    }
+
+    // The partial copy is kept to be resumed.
+    void clearLocalFile() override
+    {
+      boost::mutex::scoped_lock writeLock(writeMutex);
+      closeLocalFile();
+      manifestFile.close();
+    }
+
+    std::streamsize chunkSizeAt(std::size_t chunkIdx) const
+    {
+      return std::min(chunkSize, fileSize - static_cast<std::streamoff>(chunkIdx) * chunkSize);
+    }
+
+    static boost::uint32_t checksum(const void* data, std::size_t size)
+    {
+      boost::crc_32_type crc;
+      crc.process_bytes(data, size);
+      return crc.checksum();
+    }
+
+    /// Read the checksums of the manifest, if it describes a copy of the same file.
+    bool loadManifest()
+    {
+      boost::filesystem::ifstream manifest(manifestFilePath.bfsPath());
+      std::string header;
+      std::streamsize manifestFileSize = 0;
+      std::streamsize manifestChunkSize = 0;
+      std::string manifestSourceDigest;
+      if (sourceDigest.empty() || !std::getline(manifest, header) || header != manifestHeader()
+          || !(manifest >> manifestFileSize >> manifestChunkSize >> manifestSourceDigest)
+          || manifestFileSize != fileSize || manifestChunkSize != chunkSize || manifestSourceDigest != sourceDigest)
+      {
+        return false;
+      }
+
+      std::size_t chunkIdx = 0;
+      boost::uint32_t chunkChecksum = 0;
+      while (manifest >> chunkIdx >> std::hex >> chunkChecksum >> std::dec)
+      {
+        if (chunkIdx >= chunkCount)
+          return false;
+        chunkChecksums[chunkIdx] = chunkChecksum;
+        isChunkVerified[chunkIdx] = true;
+      }
+      return true;
+    }
+
+    /// Keep only the chunks of the partial local copy matching the manifest.
+    bool verifyLocalChunks()
+    {
+      boost::filesystem::ifstream partialFile(localPath.bfsPath(), std::ios::in | std::ios::binary);
+      if (!partialFile.is_open())
+        return false;
+
+      std::vector<char> chunkData;
+      for (std::size_t chunkIdx = 0; chunkIdx < chunkCount; ++chunkIdx)
+      {
+        if (!isChunkVerified[chunkIdx])
+          continue;
+
+        chunkData.resize(static_cast<std::size_t>(chunkSizeAt(chunkIdx)));
+        partialFile.clear();
+        partialFile.seekg(static_cast<std::streamoff>(chunkIdx) * chunkSize);
+        partialFile.read(chunkData.data(), chunkData.size());
+        isChunkVerified[chunkIdx] = partialFile.gcount() == static_cast<std::streamsize>(chunkData.size())
+            && checksum(chunkData.data(), chunkData.size()) == chunkChecksums[chunkIdx];
+      }
+      return true;
+    }
+
+    /// Check the whole local file against the checksums of the received chunks.
+    bool verifyLocalFile()
+    {
+      boost::system::error_code error;
+      const auto localFileSize = boost::filesystem::file_size(localPath.bfsPath(), error);
+      if (error || static_cast<std::streamsize>(localFileSize) != fileSize)
+        return false;
+
+      verifyLocalChunks();
+      return std::find(isChunkVerified.begin(), isChunkVerified.end(), false) == isChunkVerified.end();
+    }
+
+    /// Check the whole local file against the digest of the source, when it is known.
+    bool verifyLocalDigest()
+    {
+      if (sourceDigest.empty())
+        return true;
+
+      try
+      {
+        return openLocalFile(localPath)->digest() == sourceDigest;
+      }
+      catch (const std::exception&)
+      {
+        return false;
+      }
+    }
+
+    static const char* manifestHeader()
+    {
+      return "qicore-copy-manifest 2";
+    }
+
+    const qi::Path manifestFilePath;
+    boost::filesystem::ofstream manifestFile;
+    std::string sourceDigest; // empty when the source cannot provide it
+    const std::size_t chunkCount;
+    std::vector<boost::uint32_t> chunkChecksums;
+    std::vector<bool> isChunkVerified;
+    std::size_t nextChunkIdx = 0;
+  };
+
+  FileResumableCopyToLocal::FileResumableCopyToLocal(qi::FilePtr file, qi::Path localPath, FileTransferOptions options)
+    : FileCopyToLocal(boost::make_shared<Task>(std::move(file), std::move(localPath), std::move(options)))
+  {
+  }
+}
@@ -0,0 +1,214 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <zlib.h>
+
+#include "filedigest.hpp"
+
+namespace qi
+{
+  /////////////////////////////////////////////////////////////////////////////
+  // DigestFileSink
+
+  class DigestFileSink::Impl
+  {
+  public:
+    Sha256 hash;
+  };
+
+  DigestFileSink::DigestFileSink()
+    : _impl(new Impl)
+  {
+  }
+
+  DigestFileSink::~DigestFileSink() = default;
+
+  void DigestFileSink::write(const Buffer& data)
+  {
+    _impl->hash.update(data.data(), data.totalSize());
+  }
+
+  std::string DigestFileSink::digest() const
+  {
+    return formatFileDigest(_impl->hash);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  // MemoryFileSink
+
+  MemoryFileSink::MemoryFileSink(std::size_t maxSize)
+    : _maxSize(maxSize)
+  {
+  }
+
+  void MemoryFileSink::write(const Buffer& data)
+  {
+    if (data.totalSize() > _maxSize - _content.totalSize())
+    {
+      std::stringstream message;
+      message << "The content exceeds the maximum size of " << _maxSize << " bytes kept in memory.";
+      throw std::runtime_error(message.str());
+    }
+    _content.write(data.data(), data.totalSize());
+  }
+
+  void MemoryFileSink::abort()
+  {
+    _content.clear();
+  }
+
+  const Buffer& MemoryFileSink::content() const
+  {
+    return _content;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  // TeeFileSink
+
+  class TeeFileSink::Impl
+  {
+  public:
+    explicit Impl(const Path& localPath)
+      : file(createLocalFile(localPath))
+    {
+    }
+
+    WritableFilePtr file;
+    std::streamoff offset = 0;
+  };
+
+  TeeFileSink::TeeFileSink(const Path& localPath)
+    : _impl(new Impl(localPath))
+  {
+  }
+
+  TeeFileSink::~TeeFileSink() = default;
+
+  void TeeFileSink::write(const Buffer& data)
+  {
+    const char* const bytes = static_cast<const char*>(data.data());
+    const std::size_t size = data.totalSize();
+    for (std::size_t position = 0; position < size;)
+    {
+      const std::size_t pieceSize =
+          std::min(size - position, static_cast<std::size_t>(WritableFile::MAX_WRITE_SIZE));
+      Buffer piece;
+      piece.write(bytes + position, pieceSize);
+      _impl->file->write(_impl->offset, std::move(piece));
+      _impl->offset += static_cast<std::streamoff>(pieceSize);
+      position += pieceSize;
+    }
+  }
+
+  void TeeFileSink::finish()
+  {
+    _impl->file->commit();
+  }
+
+  void TeeFileSink::abort()
+  {
+    _impl->file->discard();
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  // UncompressingFileSink
+
+  class UncompressingFileSink::Impl
+  {
+  public:
+    explicit Impl(std::vector<FileSinkPtr> downstreamSinks)
+      : sinks(std::move(downstreamSinks))
+    {
+      stream.zalloc = Z_NULL;
+      stream.zfree = Z_NULL;
+      stream.opaque = Z_NULL;
+      stream.next_in = Z_NULL;
+      stream.avail_in = 0;
+      // Window of 32KiB, with the format detected from the header: zlib or gzip.
+      if (inflateInit2(&stream, 15 + 32) != Z_OK)
+        throw std::runtime_error("Failed to initialize the uncompression of the content.");
+    }
+
+    ~Impl()
+    {
+      inflateEnd(&stream);
+    }
+
+    void uncompress(const Buffer& data)
+    {
+      static const std::size_t OUTPUT_SIZE = 64 * 1024;
+
+      if (data.totalSize() == 0)
+        return;
+      if (isEnded)
+        throw std::runtime_error("Failed to uncompress the content: data follows the end of the compressed stream.");
+
+      stream.next_in = const_cast<Bytef*>(static_cast<const Bytef*>(data.data()));
+      stream.avail_in = static_cast<uInt>(data.totalSize());
+      while (stream.avail_in > 0 && !isEnded)
+      {
+        output.resize(OUTPUT_SIZE);
+        stream.next_out = output.data();
+        stream.avail_out = static_cast<uInt>(OUTPUT_SIZE);
+
+        const int result = inflate(&stream, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END)
+        {
+          std::stringstream message;
+          message << "Failed to uncompress the content (zlib error " << result << ").";
+          throw std::runtime_error(message.str());
+        }
+        isEnded = result == Z_STREAM_END;
+
+        const std::size_t outputSize = OUTPUT_SIZE - stream.avail_out;
+        if (outputSize > 0)
+        {
+          Buffer produced;
+          produced.write(output.data(), outputSize);
+          for (const auto& sink : sinks)
+            sink->write(produced);
+        }
+      }
+
+      if (stream.avail_in > 0)
+        throw std::runtime_error("Failed to uncompress the content: data follows the end of the compressed stream.");
+    }
+
+    const std::vector<FileSinkPtr> sinks;
+    z_stream stream;
+    std::vector<Bytef> output;
+    bool isEnded = false;
+  };
+
+  UncompressingFileSink::UncompressingFileSink(std::vector<FileSinkPtr> sinks)
+    : _impl(new Impl(std::move(sinks)))
+  {
+  }
+
+  UncompressingFileSink::~UncompressingFileSink() = default;
+
+  void UncompressingFileSink::write(const Buffer& data)
+  {
+    _impl->uncompress(data);
+  }
+
+  void UncompressingFileSink::finish()
+  {
+    if (!_impl->isEnded)
+      throw std::runtime_error("Failed to uncompress the content: the compressed stream is truncated.");
+    for (const auto& sink : _impl->sinks)
+      sink->finish();
+  }
+
+  void UncompressingFileSink::abort()
+  {
+    for (const auto& sink : _impl->sinks)
+      sink->abort();
+  }
+}
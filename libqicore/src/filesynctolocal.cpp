@@ -0,0 +1,215 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include "filecopytolocal.hpp"
+
+namespace qi
+{
+  class FileSyncToLocal::Task
+    : public FileCopyToLocal::Task
+  {
+  public:
+    Task(FilePtr sourceFile, qi::Path localFilePath, std::streamsize requestedBlockSize,
+         FileTransferOptions transferOptions)
+      : FileCopyToLocal::Task(std::move(sourceFile), temporaryPath(localFilePath), std::move(transferOptions))
+      , targetPath(std::move(localFilePath))
+      , blockSize(requestedBlockSize > 0
+                      ? std::min(requestedBlockSize, static_cast<std::streamsize>(File::MAX_READ_SIZE))
+                      : defaultBlockSize(targetPath))
+    {
+      // The new version is written in its own file, the local copy is only read.
+      options.allowStreaming = false;
+      options.allowKernelCopy = false;
+      options.useCopyCache = false;
+      if (fileSize > 0)
+        missingRanges.emplace_back(0, fileSize);
+    }
+
+    // The blocks matching the local copy are not transferred.
+    void addSink(FileSinkPtr) override
+    {
+      throw std::runtime_error("A synchronization cannot provide the content to sinks.");
+    }
+
+    void start() override
+    {
+      if (targetPath.isEmpty())
+      {
+        fail("A synchronization requires a local file path.");
+        return;
+      }
+
+      if (isRemoteDeprecated || sourceFile.metaObject().findMethod("matchBlocks").empty())
+      {
+        FileCopyToLocal::Task::start();
+        return;
+      }
+
+      // Reading the whole local copy takes a while: not in the caller.
+      auto myself = shared_from_this();
+      qi::async<void>([this, myself] {
+        const auto signatures = detail::computeBlockSignatures(targetPath, blockSize);
+        if (signatures.empty())
+        {
+          FileCopyToLocal::Task::start();
+          return;
+        }
+
+        sourceFile.async<std::vector<File::BlockMatch>>("matchBlocks", blockSize, signatures)
+          .connect([this, myself, signatures](Future<std::vector<File::BlockMatch>> futureMatches)
+        {
+          // Without matches, everything is transferred.
+          if (futureMatches.hasValue())
+            planTransfer(futureMatches.value(), signatures.size());
+
+          if (promise.isCancelRequested())
+            cancel();
+          else
+            FileCopyToLocal::Task::start();
+        });
+      });
+    }
+
+    // Keep the blocks found where they fit in the file, the rest is fetched. Called before the transfer starts.
+    void planTransfer(const std::vector<File::BlockMatch>& matches, std::size_t signatureCount)
+    {
+      missingRanges.clear();
+      std::streamoff missingBegin = 0;
+      std::streamsize reusedByteCount = 0;
+      for (const auto& match : matches)
+      {
+        if (match.first < missingBegin || match.first + blockSize > fileSize || match.second >= signatureCount)
+          continue;
+
+        if (match.first > missingBegin)
+          missingRanges.emplace_back(missingBegin, match.first - missingBegin);
+        reusedBlocks.push_back(match);
+        reusedByteCount += blockSize;
+        missingBegin = match.first + blockSize;
+      }
+      if (missingBegin < fileSize)
+        missingRanges.emplace_back(missingBegin, fileSize - missingBegin);
+      reusedBytes = reusedByteCount;
+    }
+
+    bool makeLocalFile() override
+    {
+      if (!FileCopyToLocal::Task::makeLocalFile())
+        return false;
+
+      if (!copyReusedBlocks())
+      {
+        fail("Failed to reuse the blocks of the local copy.");
+        clearLocalFile();
+        return false;
+      }
+      bytesWritten = reusedBytes.load();
+      return true;
+    }
+
+    bool takeNextRequest(ReadRequest& request) override
+    {
+      if (readsInFlight >= options.maxReadsInFlight || nextRangeIdx >= missingRanges.size())
+        return false;
+
+      File::ByteRange& range = missingRanges[nextRangeIdx];
+      request.offset = range.first;
+      request.size = std::min(chunkSize, range.second);
+      range.first += request.size;
+      range.second -= request.size;
+      if (range.second == 0)
+        ++nextRangeIdx;
+      return true;
+    }
+
+    // The new version replaces the local copy once complete.
+    void stop() override
+    {
+      {
+        boost::mutex::scoped_lock writeLock(writeMutex);
+        closeLocalFile();
+      }
+
+      if (options.syncPolicy != FileSyncPolicy_None && !detail::syncLocalFile(localPath))
+      {
+        fail("Failed to write the local file copy to the storage device.");
+        clearLocalFile();
+        return;
+      }
+
+      boost::system::error_code error;
+      boost::filesystem::rename(localPath.bfsPath(), targetPath.bfsPath(), error);
+      if (error)
+      {
+        fail("Failed to replace the local file copy: " + error.message());
+        clearLocalFile();
+        return;
+      }
+      finish();
+    }
+
+    bool copyReusedBlocks()
+    {
+      if (reusedBlocks.empty())
+        return true;
+
+      boost::filesystem::ifstream previousFile(targetPath.bfsPath(), std::ios::in | std::ios::binary);
+      std::vector<char> block(static_cast<std::size_t>(blockSize));
+      for (const auto& reusedBlock : reusedBlocks)
+      {
+        previousFile.seekg(static_cast<std::streamoff>(reusedBlock.second) * blockSize);
+        if (!previousFile.read(block.data(), blockSize))
+          return false;
+        localFile.seekp(reusedBlock.first);
+        localFile.write(block.data(), blockSize);
+      }
+      return !localFile.fail();
+    }
+
+    // About the square root of the size of the local copy, like rsync.
+    static std::streamsize defaultBlockSize(const qi::Path& localPath)
+    {
+      static const std::streamsize MIN_BLOCK_SIZE = 2 * 1024;
+      static const std::streamsize MAX_BLOCK_SIZE = 128 * 1024;
+      boost::system::error_code error;
+      const auto localFileSize = boost::filesystem::file_size(localPath.bfsPath(), error);
+      if (error)
+        return MIN_BLOCK_SIZE;
+
+      const auto squareRoot = static_cast<std::streamsize>(std::sqrt(static_cast<double>(localFileSize)));
+      const std::streamsize roundedSize = (squareRoot + 1023) / 1024 * 1024;
+      return std::max(MIN_BLOCK_SIZE, std::min(roundedSize, MAX_BLOCK_SIZE));
+    }
+
+    const qi::Path targetPath;
+    const std::streamsize blockSize;
+    std::vector<File::BlockMatch> reusedBlocks;
+    std::vector<File::ByteRange> missingRanges;
+    std::size_t nextRangeIdx = 0;
+    std::atomic<std::streamsize> reusedBytes{ 0 };
+  };
+
+  FileSyncToLocal::FileSyncToLocal(qi::FilePtr file, qi::Path localPath, std::streamsize blockSize,
+                                   FileTransferOptions options)
+    : FileCopyToLocal(boost::make_shared<Task>(std::move(file), std::move(localPath), blockSize, std::move(options)))
+  {
+  }
+
+  std::streamsize FileSyncToLocal::reusedBytes() const
+  {
+    if (!task())
+      throw std::runtime_error("Tried to access the statistics of an invalid FileOperation");
+    return static_cast<Task&>(*task()).reusedBytes.load();
+  }
+}
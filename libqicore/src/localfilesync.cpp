@@ -0,0 +1,138 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <cerrno>
+# include <cstring>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+qiLogCategory("qicore.file.localfilesync");
+
+namespace qi
+{
+namespace detail
+{
+  // The data of a file is flushed whatever the descriptor used to write it.
+  bool syncLocalFile(const Path& localPath)
+  {
+#ifdef _WIN32
+    const HANDLE file = ::CreateFileW(localPath.bfsPath().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                      nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      qiLogWarning() << "Cannot open " << localPath.str() << " to synchronize it: error " << ::GetLastError();
+      return false;
+    }
+    const bool isSynced = ::FlushFileBuffers(file) != 0;
+    if (!isSynced)
+      qiLogWarning() << "Failed to synchronize " << localPath.str() << ": error " << ::GetLastError();
+    ::CloseHandle(file);
+    return isSynced;
+#else
+    const int fd = ::open(localPath.bfsPath().c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      qiLogWarning() << "Cannot open " << localPath.str() << " to synchronize it: " << std::strerror(errno);
+      return false;
+    }
+
+    int result = 0;
+    do
+    {
+      result = ::fsync(fd);
+    } while (result != 0 && errno == EINTR);
+    if (result != 0)
+      qiLogWarning() << "Failed to synchronize " << localPath.str() << ": " << std::strerror(errno);
+    ::close(fd);
+    return result == 0;
+#endif
+  }
+
+  class LocalFileSync::Impl
+  {
+  public:
+    explicit Impl(Path path)
+      : localPath(std::move(path))
+    {
+    }
+
+    ~Impl()
+    {
+#ifdef _WIN32
+      if (file != INVALID_HANDLE_VALUE)
+        ::CloseHandle(file);
+#else
+      if (fd >= 0)
+        ::close(fd);
+#endif
+    }
+
+    bool sync()
+    {
+#ifdef _WIN32
+      if (file == INVALID_HANDLE_VALUE)
+      {
+        file = ::CreateFileW(localPath.bfsPath().c_str(), GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+          qiLogWarning() << "Cannot open " << localPath.str() << " to synchronize it: error " << ::GetLastError();
+          return false;
+        }
+      }
+      const bool isSynced = ::FlushFileBuffers(file) != 0;
+      if (!isSynced)
+        qiLogWarning() << "Failed to synchronize " << localPath.str() << ": error " << ::GetLastError();
+      return isSynced;
+#else
+      if (fd < 0)
+      {
+        fd = ::open(localPath.bfsPath().c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+          qiLogWarning() << "Cannot open " << localPath.str() << " to synchronize it: " << std::strerror(errno);
+          return false;
+        }
+      }
+
+      int result = 0;
+      do
+      {
+        result = ::fsync(fd);
+      } while (result != 0 && errno == EINTR);
+      if (result != 0)
+        qiLogWarning() << "Failed to synchronize " << localPath.str() << ": " << std::strerror(errno);
+      return result == 0;
+#endif
+    }
+
+    const Path localPath;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+  };
+
+  LocalFileSync::LocalFileSync(Path localPath)
+    : _impl(new Impl(std::move(localPath)))
+  {
+  }
+
+  LocalFileSync::~LocalFileSync() = default;
+
+  bool LocalFileSync::sync()
+  {
+    return _impl->sync();
+  }
+}
+}
@@ -0,0 +1,282 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+qiLogCategory("qicore.file.progressaggregator");
+
+namespace qi
+{
+/** The state of the children is updated by their signals, which only keep a weak reference on the aggregate.
+    The notifications of the combined notifier are queued with the mutex locked, and made in order by one thread
+    at a time with the mutex unlocked: the observers of the combined notifier may attach other operations.
+**/
+class ProgressAggregator::Impl
+  : public boost::enable_shared_from_this<ProgressAggregator::Impl>
+{
+public:
+  explicit Impl(ProgressNotificationPolicy notificationPolicy)
+    : policy(std::move(notificationPolicy))
+    , notifier(createProgressNotifier())
+  {
+  }
+
+  void attach(ProgressNotifierPtr childNotifier, std::uint64_t weight)
+  {
+    std::size_t childIndex = 0;
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      if (isEnded)
+        throw std::runtime_error("Tried to attach an operation to a job which has already ended.");
+      childIndex = children.size();
+      children.push_back(Child{ childNotifier, std::max<std::uint64_t>(weight, 1u), 0.0, ProgressNotifier::Status_Idle,
+                                false, false, SignalBase::invalidSignalLink, SignalBase::invalidSignalLink });
+      totalWeight += children.back().weight;
+    }
+
+    boost::weak_ptr<Impl> weakSelf = shared_from_this();
+    const SignalLink progressLink = childNotifier->progress.connect([weakSelf, childIndex](double progress) {
+      if (auto self = weakSelf.lock())
+        self->onChildProgressed(childIndex, progress);
+    });
+    const SignalLink statusLink = childNotifier->status.connect([weakSelf, childIndex](ProgressNotifier::Status status) {
+      if (auto self = weakSelf.lock())
+        self->onChildStatusChanged(childIndex, status);
+    });
+
+    // Read once connected, so that no change is missed: the child may have started before being attached.
+    // A value signaled meanwhile is more recent than the one read.
+    const ProgressNotifier::Status childStatus = childNotifier->status.get();
+    const double childProgress = childNotifier->progress.get();
+
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      Child& child = children[childIndex];
+      child.progressLink = progressLink;
+      child.statusLink = statusLink;
+      if (!child.isStatusSignaled)
+        child.status = childStatus;
+      if (!child.isProgressSignaled)
+        child.progress = childProgress;
+      updateStatus();
+      updateProgress();
+    }
+    publishNotifications();
+  }
+
+  void detachAll()
+  {
+    std::vector<Child> detachedChildren;
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      detachedChildren = children;
+    }
+
+    for (const auto& child : detachedChildren)
+    {
+      try
+      {
+        child.notifier->progress.disconnect(child.progressLink);
+        child.notifier->status.disconnect(child.statusLink);
+      }
+      catch (const std::exception& ex)
+      {
+        qiLogVerbose() << "Failed to stop following the progress of an operation: " << ex.what();
+      }
+    }
+  }
+
+  const ProgressNotificationPolicy policy;
+  const ProgressNotifierPtr notifier;
+
+private:
+  struct Child
+  {
+    ProgressNotifierPtr notifier;
+    std::uint64_t weight;
+    double progress;
+    ProgressNotifier::Status status;
+    bool isProgressSignaled;
+    bool isStatusSignaled;
+    SignalLink progressLink;
+    SignalLink statusLink;
+  };
+
+  static bool isEndedStatus(ProgressNotifier::Status status)
+  {
+    return status == ProgressNotifier::Status_Finished || status == ProgressNotifier::Status_Failed
+        || status == ProgressNotifier::Status_Canceled;
+  }
+
+  void onChildProgressed(std::size_t childIndex, double progress)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      children[childIndex].progress = progress;
+      children[childIndex].isProgressSignaled = true;
+      updateProgress();
+    }
+    publishNotifications();
+  }
+
+  void onChildStatusChanged(std::size_t childIndex, ProgressNotifier::Status status)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      children[childIndex].status = status;
+      children[childIndex].isStatusSignaled = true;
+      updateStatus();
+      // An ended child counts as complete.
+      updateProgress();
+    }
+    publishNotifications();
+  }
+
+  // Makes the queued notifications, unless another thread is already making them.
+  void publishNotifications()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    if (isPublishing)
+      return;
+    isPublishing = true;
+    while (!pendingNotifications.empty())
+    {
+      const boost::function<void()> notification = std::move(pendingNotifications.front());
+      pendingNotifications.pop_front();
+      lock.unlock();
+      try
+      {
+        notification();
+      }
+      catch (const std::exception& ex)
+      {
+        qiLogWarning() << "Failed to notify the progress of a job: " << ex.what();
+      }
+      lock.lock();
+    }
+    isPublishing = false;
+  }
+
+  // The following functions must be called with the mutex locked.
+
+  void updateProgress()
+  {
+    if (isEnded)
+      return;
+
+    const double newProgress = combinedProgress();
+    const auto now = std::chrono::steady_clock::now();
+    const bool isHeldBack = now - lastNotificationTime < policy.minInterval
+        || std::abs(newProgress - lastNotifiedProgress) < policy.minProgressDelta;
+    if (isHeldBack && newProgress < 1.0)
+      return;
+
+    lastNotificationTime = now;
+    publishProgress(newProgress);
+  }
+
+  void queueNotification(boost::function<void(const ProgressNotifierPtr&)> notify)
+  {
+    pendingNotifications.push_back(boost::bind(std::move(notify), notifier));
+  }
+
+  double combinedProgress() const
+  {
+    double weightedProgress = 0.0;
+    for (const auto& child : children)
+    {
+      const double childProgress = isEndedStatus(child.status) ? 1.0 : std::min(std::max(child.progress, 0.0), 1.0);
+      weightedProgress += childProgress * static_cast<double>(child.weight);
+    }
+    return totalWeight > 0 ? weightedProgress / static_cast<double>(totalWeight) : 0.0;
+  }
+
+  void publishProgress(double newProgress)
+  {
+    if (newProgress == lastNotifiedProgress)
+      return;
+    lastNotifiedProgress = newProgress;
+    queueNotification([newProgress](const ProgressNotifierPtr& combinedNotifier) {
+      combinedNotifier->notifyProgressed(newProgress);
+    });
+  }
+
+  void updateStatus()
+  {
+    if (isEnded || children.empty())
+      return;
+
+    bool isAnyRunning = false;
+    bool isAnyFailed = false;
+    bool isAnyCanceled = false;
+    bool isAllEnded = true;
+    for (const auto& child : children)
+    {
+      isAnyRunning = isAnyRunning || child.status == ProgressNotifier::Status_Running;
+      isAnyFailed = isAnyFailed || child.status == ProgressNotifier::Status_Failed;
+      isAnyCanceled = isAnyCanceled || child.status == ProgressNotifier::Status_Canceled;
+      isAllEnded = isAllEnded && isEndedStatus(child.status);
+    }
+
+    if (!isRunning && (isAnyRunning || isAllEnded))
+    {
+      isRunning = true;
+      queueNotification([](const ProgressNotifierPtr& combinedNotifier) { combinedNotifier->notifyRunning(); });
+    }
+    if (!isAllEnded)
+      return;
+
+    // The final state is always notified.
+    isEnded = true;
+    publishProgress(combinedProgress());
+    if (isAnyFailed)
+      queueNotification([](const ProgressNotifierPtr& combinedNotifier) { combinedNotifier->notifyFailed(); });
+    else if (isAnyCanceled)
+      queueNotification([](const ProgressNotifierPtr& combinedNotifier) { combinedNotifier->notifyCanceled(); });
+    else
+      queueNotification([](const ProgressNotifierPtr& combinedNotifier) { combinedNotifier->notifyFinished(); });
+  }
+
+  boost::mutex mutex;
+  std::vector<Child> children;
+  std::uint64_t totalWeight = 0;
+  std::chrono::steady_clock::time_point lastNotificationTime;
+  double lastNotifiedProgress = 0.0;
+  bool isRunning = false;
+  bool isEnded = false;
+  std::deque<boost::function<void()>> pendingNotifications;
+  bool isPublishing = false;
+};
+
+ProgressAggregator::ProgressAggregator(ProgressNotificationPolicy policy)
+  : _impl(boost::make_shared<Impl>(std::move(policy)))
+{
+}
+
+ProgressAggregator::~ProgressAggregator()
+{
+  _impl->detachAll();
+}
+
+ProgressNotifierPtr ProgressAggregator::notifier() const
+{
+  return _impl->notifier;
+}
+
+void ProgressAggregator::attach(ProgressNotifierPtr child, std::uint64_t weight)
+{
+  _impl->attach(std::move(child), weight);
+}
+}
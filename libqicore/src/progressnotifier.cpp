@@ -6,6 +6,9 @@
 #include <qicore/file.hpp>
 #include <qi/anymodule.hpp>
 
+#include <atomic>
+#include <cstdint>
+
 qiLogCategory("qicore.file.progressnotifierimpl");
 
 // FIXME: Remove once deprecated method are removed
@@ -13,6 +16,68 @@ qiLogCategory("qicore.file.progressnotifierimpl");
 
 namespace qi
 {
+  namespace
+  {
+    /** Publishes the latest value of an atomic to a property, without lock. One publisher at a time sets the
+        property, only to a value it does not hold yet, and always to the latest value: the property changes in order
+        and ends on the latest value. The other publishers leave their change to the current one.
+        The observers of the property may change the value, their changes are published once they return.
+    **/
+    template <typename T>
+    class LatestValuePublisher
+    {
+    public:
+      explicit LatestValuePublisher(T initialValue)
+        : _publishedValue(std::move(initialValue))
+      {
+      }
+
+      /// Must be called after each change of the value.
+      void publish(const std::atomic<T>& value, Property<T>& property)
+      {
+        ++_changeCount;
+        std::uint64_t publishedChange = 0;
+        while (true)
+        {
+          bool isPublishing = false;
+          if (!_isPublishing.compare_exchange_strong(isPublishing, true))
+            return;
+
+          do
+          {
+            publishedChange = _changeCount.load();
+            const T latestValue = value.load();
+            if (latestValue != _publishedValue)
+            {
+              _publishedValue = latestValue;
+              property.set(latestValue);
+            }
+          } while (_changeCount.load() != publishedChange);
+
+          _isPublishing.store(false);
+          // A change made while releasing the publication is not left behind.
+          if (_changeCount.load() == publishedChange)
+            return;
+        }
+      }
+
+    private:
+      std::atomic<std::uint64_t> _changeCount{ 0 };
+      std::atomic<bool> _isPublishing{ false };
+      T _publishedValue; // only used by the current publisher
+    };
+  }
+
+  void ProgressNotifier::notifyTelemetry(const TransferTelemetry& newTelemetry)
+  {
+    this->telemetry.set(newTelemetry);
+  }
+
+  /** The status and progress are held by atomics, the properties only publish their changes:
+      the transitions are compare-and-swap operations, and the property signals are not triggered
+      by notifications that do not change anything.
+      @remark The properties must not be set directly, they would not reflect the state anymore.
+  **/
   class ProgressNotifierImpl
     : public ProgressNotifier
   {
@@ -25,42 +90,36 @@ namespace qi
 
     void reset() override
     {
-      this->status.set(ProgressNotifier::Status_Idle);
-      this->progress.set(0.0);
+      changeStatus(ProgressNotifier::Status_Idle);
+      changeProgress(0.0);
     }
 
     void notifyRunning() override
     {
-      if (this->status.get() != ProgressNotifier::Status_Idle)
+      if (!switchStatus(ProgressNotifier::Status_Idle, ProgressNotifier::Status_Running))
         qiLogError()
         << "ProgressNotifier must be Idle to be allowed to switch to Running status.";
-
-      this->status.set(ProgressNotifier::Status_Running);
     }
 
     void notifyFinished() override
     {
-      if (!isRunning())
+      if (!switchStatus(ProgressNotifier::Status_Running, ProgressNotifier::Status_Finished))
         qiLogError()
         << "ProgressNotifier must be Running to be allowed to switch to Finished status.";
-
-      this->status.set(ProgressNotifier::Status_Finished);
     }
 
     void notifyCanceled() override
     {
-      if (!isRunning())
+      if (!switchStatus(ProgressNotifier::Status_Running, ProgressNotifier::Status_Canceled))
         qiLogError()
         << "ProgressNotifier must be Running to be allowed to switch to Canceled status.";
-      this->status.set(ProgressNotifier::Status_Canceled);
     }
 
     void notifyFailed() override
     {
-      if (!isRunning())
+      if (!switchStatus(ProgressNotifier::Status_Running, ProgressNotifier::Status_Failed))
         qiLogError()
         << "ProgressNotifier must be Running to be allowed to switch to Failed status.";
-      this->status.set(ProgressNotifier::Status_Failed);
     }
 
     void notifyProgressed(double newProgress) override
@@ -68,12 +127,12 @@ namespace qi
       if (!isRunning())
         qiLogError()
         << "ProgressNotifier must be Running to be allowed to notify any progress.";
-      this->progress.set(newProgress);
+      changeProgress(newProgress);
     }
 
     bool isRunning() const override
     {
-      return this->status.get() == ProgressNotifier::Status_Running;
+      return _status.load() == ProgressNotifier::Status_Running;
     }
 
     Future<void> waitForFinished() override
@@ -83,6 +142,37 @@ namespace qi
 
     Future<void> _opFuture;
 
+  private:
+    std::atomic<Status> _status{ ProgressNotifier::Status_Idle };
+    std::atomic<double> _progress{ 0.0 };
+    LatestValuePublisher<Status> _statusPublisher{ ProgressNotifier::Status_Idle };
+    LatestValuePublisher<double> _progressPublisher{ 0.0 };
+
+    /** Switch from the expected status to the new one.
+        @return false if the status was not the expected one: the status is left unchanged.
+    **/
+    bool switchStatus(Status expectedStatus, Status newStatus)
+    {
+      Status previousStatus = expectedStatus;
+      if (!_status.compare_exchange_strong(previousStatus, newStatus))
+        return false;
+      _statusPublisher.publish(_status, this->status);
+      return true;
+    }
+
+    void changeStatus(Status newStatus)
+    {
+      if (_status.exchange(newStatus) != newStatus)
+        _statusPublisher.publish(_status, this->status);
+    }
+
+    void changeProgress(double newProgress)
+    {
+      if (_progress.exchange(newProgress) != newProgress)
+        _progressPublisher.publish(_progress, this->progress);
+    }
+
+  public:
     // Deprecated members:
     void _reset() override
     {
@@ -124,11 +214,13 @@ void _qiregisterProgressNotifier()
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, notifyCanceled);
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, notifyFailed);
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, notifyProgressed);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, notifyTelemetry);
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, waitForFinished);
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, isRunning);
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, reset);
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, progress);
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, status);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, telemetry);
 
   // Deprecated members:
   QI_OBJECT_BUILDER_ADVERTISE(builder, ProgressNotifier, _reset);
@@ -42,6 +42,14 @@ public:
     _obj.call<void>("notifyProgressed", newProgress);
   }
 
+  void notifyTelemetry(const TransferTelemetry& newTelemetry) override
+  {
+    // Notifiers served by an older version do not record telemetry.
+    if (_obj.metaObject().findMethod("notifyTelemetry").empty())
+      return;
+    _obj.call<void>("notifyTelemetry", newTelemetry);
+  }
+
   bool isRunning() const override
   {
     return _obj.call<bool>("isRunning");
@@ -13,10 +13,15 @@ namespace qi
   void _qiregisterProgressNotifierProxy();
   void _qiregisterFile();
   void _qiregisterFileProxy();
+  void _qiregisterFileStream();
+  void _qiregisterFileStreamProxy();
+  void _qiregisterWritableFile();
+  void _qiregisterWritableFileProxy();
   void _qiregisterFileOperation();
 
   void registerProgressNotifierCreation(qi::ModuleBuilder& mb);
   void registerFileCreation(qi::ModuleBuilder& mb);
+  void registerWritableFileCreation(qi::ModuleBuilder& mb);
   void registerFileOperations(qi::ModuleBuilder& mb);
 }
 
@@ -26,6 +31,10 @@ static bool _qiregisterFileTypes()
   qi::_qiregisterProgressNotifierProxy();
   qi::_qiregisterFile();
   qi::_qiregisterFileProxy();
+  qi::_qiregisterFileStream();
+  qi::_qiregisterFileStreamProxy();
+  qi::_qiregisterWritableFile();
+  qi::_qiregisterWritableFileProxy();
   qi::_qiregisterFileOperation();
   return true;
 }
@@ -36,6 +45,7 @@ void registerLibQiCore(qi::ModuleBuilder* mb)
 {
   qi::registerProgressNotifierCreation(*mb);
   qi::registerFileCreation(*mb);
+  qi::registerWritableFileCreation(*mb);
   qi::registerFileOperations(*mb);
   qi::registerLogProvider(mb);
 }
@@ -0,0 +1,354 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <qi/eventloop.hpp>
+
+namespace qi
+{
+namespace
+{
+  /** Shared by all the file operations of the process.
+      Transfers are admitted up to the maximum count of concurrent transfers, and reads consume
+      tokens of a bucket refilled at the maximum bandwidth. Waiting requests are served by priority
+      class, then in arrival order, and leave their queue when their future is canceled.
+      Promises are always set out of the mutex.
+      The scheduler is never destroyed: the refills scheduled on the event loop may run after
+      the static objects are destroyed.
+  **/
+  class TransferScheduler
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static TransferScheduler& instance()
+    {
+      static TransferScheduler* const scheduler = new TransferScheduler;
+      return *scheduler;
+    }
+
+    void setLimits(const TransferSchedulerLimits& newLimits)
+    {
+      std::vector<Promise<void>> ready;
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        refillTokens(Clock::now());
+        const bool wasLimited = _limits.maxBytesPerSecond > 0.0;
+        _limits = newLimits;
+        _limits.burstBytes = std::max<std::streamsize>(_limits.burstBytes, 1);
+        // A newly limited bandwidth starts with a full bucket.
+        _tokens = wasLimited ? std::min(_tokens, static_cast<double>(_limits.burstBytes))
+                             : static_cast<double>(_limits.burstBytes);
+        collectReadyTransfers(ready);
+        collectReadyReads(ready);
+        scheduleRefill();
+      }
+      setValues(ready);
+    }
+
+    TransferSchedulerLimits limits()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      return _limits;
+    }
+
+    TransferSchedulerCounters counters()
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      TransferSchedulerCounters counters = _counters;
+      counters.transfersWaiting = 0;
+      counters.readsWaiting = 0;
+      for (const auto& queue : _waitingTransfers)
+        counters.transfersWaiting += static_cast<unsigned int>(queue.size());
+      for (const auto& queue : _waitingReads)
+        counters.readsWaiting += static_cast<unsigned int>(queue.size());
+      return counters;
+    }
+
+    Future<void> acquireTransferSlot(TransferPriority priority)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (canStartTransfer() && !hasWaitingTransfer())
+      {
+        startTransfer();
+        return Future<void>(0);
+      }
+
+      ++_counters.transfersQueued;
+      const std::uint64_t waiterId = ++_lastWaiterId;
+      Promise<void> slot([this, waiterId](Promise<void>&) { cancelWaiter(waiterId); });
+      _waitingTransfers[priorityIndex(priority)].push_back(WaitingTransfer{ waiterId, slot });
+      return slot.future();
+    }
+
+    void releaseTransferSlot()
+    {
+      std::vector<Promise<void>> ready;
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        --_counters.transfersRunning;
+        collectReadyTransfers(ready);
+      }
+      setValues(ready);
+    }
+
+    Future<void> acquireReadBandwidth(TransferPriority priority, std::streamsize byteCount)
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (_limits.maxBytesPerSecond <= 0.0)
+      {
+        grantRead(byteCount);
+        return Future<void>(0);
+      }
+
+      refillTokens(Clock::now());
+      if (!hasWaitingRead() && hasTokensFor(byteCount))
+      {
+        _tokens -= static_cast<double>(byteCount);
+        grantRead(byteCount);
+        return Future<void>(0);
+      }
+
+      ++_counters.readsThrottled;
+      const std::uint64_t waiterId = ++_lastWaiterId;
+      Promise<void> bandwidth([this, waiterId](Promise<void>&) { cancelWaiter(waiterId); });
+      _waitingReads[priorityIndex(priority)].push_back(WaitingRead{ waiterId, byteCount, bandwidth });
+      scheduleRefill();
+      return bandwidth.future();
+    }
+
+  private:
+    static const std::size_t PRIORITY_COUNT = 3;
+
+    struct WaitingTransfer
+    {
+      std::uint64_t id;
+      Promise<void> promise;
+    };
+
+    struct WaitingRead
+    {
+      std::uint64_t id;
+      std::streamsize byteCount;
+      Promise<void> promise;
+    };
+
+    TransferScheduler() = default;
+
+    static std::size_t priorityIndex(TransferPriority priority)
+    {
+      return std::min(static_cast<std::size_t>(priority), PRIORITY_COUNT - 1);
+    }
+
+    static void setValues(std::vector<Promise<void>>& promises)
+    {
+      for (auto& promise : promises)
+        promise.setValue(0);
+    }
+
+    // Nothing to do if the waiter has already been served.
+    void cancelWaiter(std::uint64_t waiterId)
+    {
+      std::vector<Promise<void>> canceled;
+      std::vector<Promise<void>> ready;
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        const auto hasWaiterId = [waiterId](const WaitingTransfer& waiter) { return waiter.id == waiterId; };
+        for (auto& queue : _waitingTransfers)
+        {
+          const auto waiterIt = std::find_if(queue.begin(), queue.end(), hasWaiterId);
+          if (waiterIt != queue.end())
+          {
+            canceled.push_back(waiterIt->promise);
+            queue.erase(waiterIt);
+          }
+        }
+
+        const auto hasReadId = [waiterId](const WaitingRead& waiter) { return waiter.id == waiterId; };
+        for (auto& queue : _waitingReads)
+        {
+          const auto waiterIt = std::find_if(queue.begin(), queue.end(), hasReadId);
+          if (waiterIt != queue.end())
+          {
+            canceled.push_back(waiterIt->promise);
+            queue.erase(waiterIt);
+          }
+        }
+
+        // The reads queued behind the canceled one may be served now.
+        refillTokens(Clock::now());
+        collectReadyReads(ready);
+      }
+
+      for (auto& promise : canceled)
+        promise.setCanceled();
+      setValues(ready);
+    }
+
+    // The following functions must be called with the mutex locked.
+
+    bool canStartTransfer() const
+    {
+      return _limits.maxConcurrentTransfers == 0 || _counters.transfersRunning < _limits.maxConcurrentTransfers;
+    }
+
+    bool hasWaitingTransfer() const
+    {
+      return std::any_of(_waitingTransfers.begin(), _waitingTransfers.end(),
+                         [](const std::deque<WaitingTransfer>& queue) { return !queue.empty(); });
+    }
+
+    bool hasWaitingRead() const
+    {
+      return std::any_of(_waitingReads.begin(), _waitingReads.end(),
+                         [](const std::deque<WaitingRead>& queue) { return !queue.empty(); });
+    }
+
+    void startTransfer()
+    {
+      ++_counters.transfersRunning;
+      ++_counters.transfersStarted;
+    }
+
+    void grantRead(std::streamsize byteCount)
+    {
+      ++_counters.readsGranted;
+      _counters.bytesGranted += static_cast<std::uint64_t>(byteCount);
+    }
+
+    // Reads bigger than the burst are allowed once the bucket is full, leaving it in debt.
+    bool hasTokensFor(std::streamsize byteCount) const
+    {
+      return _tokens >= static_cast<double>(std::min(byteCount, _limits.burstBytes));
+    }
+
+    void refillTokens(Clock::time_point now)
+    {
+      const double elapsed = std::chrono::duration<double>(now - _lastRefillTime).count();
+      _lastRefillTime = now;
+      if (_limits.maxBytesPerSecond > 0.0)
+        _tokens = std::min(_tokens + elapsed * _limits.maxBytesPerSecond, static_cast<double>(_limits.burstBytes));
+    }
+
+    void collectReadyTransfers(std::vector<Promise<void>>& ready)
+    {
+      for (auto& queue : _waitingTransfers)
+      {
+        while (!queue.empty() && canStartTransfer())
+        {
+          startTransfer();
+          ready.push_back(queue.front().promise);
+          queue.pop_front();
+        }
+      }
+    }
+
+    void collectReadyReads(std::vector<Promise<void>>& ready)
+    {
+      const bool isLimited = _limits.maxBytesPerSecond > 0.0;
+      for (auto& queue : _waitingReads)
+      {
+        while (!queue.empty())
+        {
+          const WaitingRead& read = queue.front();
+          if (isLimited && !hasTokensFor(read.byteCount))
+            return; // lower priorities keep waiting too
+          if (isLimited)
+            _tokens -= static_cast<double>(read.byteCount);
+          grantRead(read.byteCount);
+          ready.push_back(read.promise);
+          queue.pop_front();
+        }
+      }
+    }
+
+    // Wake up when the first waiting read can be served.
+    void scheduleRefill()
+    {
+      if (_isRefillScheduled || !hasWaitingRead() || _limits.maxBytesPerSecond <= 0.0)
+        return;
+
+      std::streamsize byteCount = 0;
+      for (const auto& queue : _waitingReads)
+      {
+        if (!queue.empty())
+        {
+          byteCount = std::min(queue.front().byteCount, _limits.burstBytes);
+          break;
+        }
+      }
+
+      static const double MIN_DELAY_US = 1000.0;
+      const double missingTokens = std::max(0.0, static_cast<double>(byteCount) - _tokens);
+      const double delayUs = std::max(MIN_DELAY_US, missingTokens / _limits.maxBytesPerSecond * 1e6);
+      _isRefillScheduled = true;
+      qi::asyncDelay([this] { onRefill(); }, qi::MicroSeconds(static_cast<std::int64_t>(delayUs)));
+    }
+
+    void onRefill()
+    {
+      std::vector<Promise<void>> ready;
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        _isRefillScheduled = false;
+        refillTokens(Clock::now());
+        collectReadyReads(ready);
+        scheduleRefill();
+      }
+      setValues(ready);
+    }
+
+    boost::mutex _mutex;
+    TransferSchedulerLimits _limits;
+    TransferSchedulerCounters _counters;
+    double _tokens = 0.0;
+    Clock::time_point _lastRefillTime = Clock::now();
+    bool _isRefillScheduled = false;
+    std::uint64_t _lastWaiterId = 0;
+    std::array<std::deque<WaitingTransfer>, PRIORITY_COUNT> _waitingTransfers;
+    std::array<std::deque<WaitingRead>, PRIORITY_COUNT> _waitingReads;
+  };
+}
+
+void setTransferSchedulerLimits(const TransferSchedulerLimits& limits)
+{
+  TransferScheduler::instance().setLimits(limits);
+}
+
+TransferSchedulerLimits transferSchedulerLimits()
+{
+  return TransferScheduler::instance().limits();
+}
+
+TransferSchedulerCounters transferSchedulerCounters()
+{
+  return TransferScheduler::instance().counters();
+}
+
+namespace detail
+{
+  Future<void> acquireTransferSlot(TransferPriority priority)
+  {
+    return TransferScheduler::instance().acquireTransferSlot(priority);
+  }
+
+  void releaseTransferSlot()
+  {
+    TransferScheduler::instance().releaseTransferSlot();
+  }
+
+  Future<void> acquireReadBandwidth(TransferPriority priority, std::streamsize byteCount)
+  {
+    return TransferScheduler::instance().acquireReadBandwidth(priority, byteCount);
+  }
+}
+}
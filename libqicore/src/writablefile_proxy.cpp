@@ -0,0 +1,51 @@
+#include <qicore/file.hpp>
+#include <qi/anymodule.hpp>
+
+namespace qi
+{
+class WritableFileProxy : public WritableFile, public qi::Proxy
+{
+public:
+  explicit WritableFileProxy(qi::AnyObject obj)
+    : qi::Proxy(std::move(obj))
+  {
+  }
+
+  ~WritableFileProxy() = default;
+
+  void write(std::streamoff beginOffset, Buffer data) override
+  {
+    return _obj.call<void>("write", beginOffset, data);
+  }
+
+  void truncate(std::streamsize newSize) override
+  {
+    return _obj.call<void>("truncate", newSize);
+  }
+
+  void commit() override
+  {
+    return _obj.call<void>("commit");
+  }
+
+  void discard() override
+  {
+    return _obj.call<void>("discard");
+  }
+
+  std::streamsize size() const override
+  {
+    return _obj.call<std::streamsize>("size");
+  }
+
+  bool isOpen() const override
+  {
+    return _obj.call<bool>("isOpen");
+  }
+};
+
+void _qiregisterWritableFileProxy()
+{
+  ::qi::registerProxyInterface<WritableFileProxy, WritableFile>();
+}
+}
@@ -0,0 +1,201 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qicore/file.hpp>
+
+#include <algorithm>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <qi/anymodule.hpp>
+
+qiLogCategory("qicore.file.writablefileimpl");
+
+namespace qi
+{
+class WritableFileImpl : public WritableFile
+{
+public:
+  explicit WritableFileImpl(const Path& localFilePath)
+    : _destinationPath(localFilePath.bfsPath())
+    , _temporaryPath(makeTemporaryPath(_destinationPath))
+  {
+    _file.open(_temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!_file.is_open())
+    {
+      std::stringstream message;
+      message << "Failed to create the local file: " << localFilePath.str();
+      throw std::runtime_error(message.str());
+    }
+  }
+
+  ~WritableFileImpl()
+  {
+    discard();
+  }
+
+  // Writes are serialized by the mutex, they can be dispatched concurrently.
+  void write(std::streamoff beginOffset, Buffer data) override
+  {
+    const std::streamsize byteCount = static_cast<std::streamsize>(data.totalSize());
+    if (byteCount > MAX_WRITE_SIZE)
+      throw std::runtime_error("Tried to write too much data at once.");
+    if (beginOffset < 0)
+      throw std::runtime_error("Tried to write at a negative position.");
+
+    boost::mutex::scoped_lock lock(_mutex);
+    requireOpenFile();
+    _file.seekp(beginOffset);
+    _file.write(static_cast<const char*>(data.data()), byteCount);
+    if (_file.fail())
+    {
+      _file.clear();
+      throw std::runtime_error("Failed to write the local file.");
+    }
+    _size = std::max(_size, beginOffset + byteCount);
+  }
+
+  void truncate(std::streamsize newSize) override
+  {
+    if (newSize < 0)
+      throw std::runtime_error("Tried to truncate a file to a negative size.");
+
+    boost::mutex::scoped_lock lock(_mutex);
+    requireOpenFile();
+    _file.flush();
+
+    boost::system::error_code error;
+    boost::filesystem::resize_file(_temporaryPath, static_cast<boost::uintmax_t>(newSize), error);
+    if (error)
+      throw std::runtime_error("Failed to resize the local file: " + error.message());
+    _size = newSize;
+  }
+
+  void commit() override
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    requireOpenFile();
+    _file.close();
+    _size = 0;
+
+    if (_file.fail())
+    {
+      dropTemporaryFile();
+      throw std::runtime_error("Failed to write the local file.");
+    }
+
+    if (!detail::syncLocalFile(Path(_temporaryPath)))
+    {
+      dropTemporaryFile();
+      throw std::runtime_error("Failed to write the local file to the storage device.");
+    }
+
+    // Renaming in the same directory replaces the destination atomically.
+    boost::system::error_code error;
+    boost::filesystem::rename(_temporaryPath, _destinationPath, error);
+    if (error)
+    {
+      dropTemporaryFile();
+      throw std::runtime_error("Failed to replace the local file: " + error.message());
+    }
+  }
+
+  void discard() override
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    if (!_file.is_open())
+      return;
+
+    _file.close();
+    _size = 0;
+    dropTemporaryFile();
+  }
+
+  std::streamsize size() const override
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    return _size;
+  }
+
+  bool isOpen() const override
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    return _file.is_open();
+  }
+
+private:
+  const boost::filesystem::path _destinationPath;
+  const boost::filesystem::path _temporaryPath;
+  mutable boost::mutex _mutex;
+  boost::filesystem::ofstream _file;
+  std::streamsize _size = 0;
+
+  // In the directory of the destination, so that the rename does not cross file systems.
+  static boost::filesystem::path makeTemporaryPath(const boost::filesystem::path& destinationPath)
+  {
+    boost::filesystem::path pattern = destinationPath;
+    pattern += ".%%%%-%%%%-%%%%.part";
+    return boost::filesystem::unique_path(pattern);
+  }
+
+  // Must be called with the mutex locked.
+  void requireOpenFile() const
+  {
+    if (!_file.is_open())
+      throw std::runtime_error("Trying to write a committed or discarded file.");
+  }
+
+  // Must be called with the mutex locked, once the file is closed.
+  void dropTemporaryFile()
+  {
+    boost::system::error_code error;
+    boost::filesystem::remove(_temporaryPath, error);
+    if (error)
+      qiLogWarning() << "Failed to remove " << _temporaryPath.string() << ": " << error.message();
+  }
+};
+
+void _qiregisterWritableFile()
+{
+  ::qi::ObjectTypeBuilder<WritableFile> builder;
+  // Writes are serialized by the implementation: calls can be dispatched concurrently.
+  builder.setThreadingModel(ObjectThreadingModel_MultiThread);
+
+  QI_OBJECT_BUILDER_ADVERTISE(builder, WritableFile, write);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, WritableFile, truncate);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, WritableFile, commit);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, WritableFile, discard);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, WritableFile, size);
+  QI_OBJECT_BUILDER_ADVERTISE(builder, WritableFile, isOpen);
+
+  builder.registerType();
+
+  {
+    qi::detail::ForceProxyInclusion<WritableFile>().dummyCall();
+    qi::registerType(typeid(WritableFileImpl), qi::typeOf<WritableFile>());
+    WritableFileImpl* ptr = static_cast<WritableFileImpl*>(reinterpret_cast<void*>(0x10000));
+    WritableFile* pptr = ptr;
+    intptr_t offset = reinterpret_cast<intptr_t>(pptr)-reinterpret_cast<intptr_t>(ptr);
+    if (offset)
+    {
+      qiLogError("qitype.register") << "non-zero offset for implementation WritableFileImpl of WritableFile,"
+        "call will fail at runtime";
+      throw std::runtime_error("non-zero offset between implementation and interface");
+    }
+  }
+}
+
+WritableFilePtr createLocalFile(const qi::Path& localPath)
+{
+  return boost::make_shared<WritableFileImpl>(localPath);
+}
+
+void registerWritableFileCreation(qi::ModuleBuilder& mb)
+{
+  mb.advertiseMethod("createLocalFile", &createLocalFile);
+}
+}
@@ -0,0 +1,116 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <qi/application.hpp>
+#include <qicore/file.hpp>
+
+qiLogCategory("test.qi.benchProgressNotifier");
+
+namespace
+{
+  /// The notifications as they were made before the state moved to atomics: every call goes through the properties.
+  struct PropertyNotifications
+  {
+    explicit PropertyNotifications(qi::ProgressNotifier& notifier)
+      : _notifier(notifier)
+    {
+    }
+
+    bool isRunning() const
+    {
+      return _notifier.status.get() == qi::ProgressNotifier::Status_Running;
+    }
+
+    void notifyProgressed(double newProgress)
+    {
+      if (!isRunning())
+        qiLogError() << "ProgressNotifier must be Running to be allowed to notify any progress.";
+      _notifier.progress.set(newProgress);
+    }
+
+    qi::ProgressNotifier& _notifier;
+  };
+
+  /// The notifications made through the notifier.
+  struct NotifierNotifications
+  {
+    explicit NotifierNotifications(qi::ProgressNotifier& notifier)
+      : _notifier(notifier)
+    {
+    }
+
+    bool isRunning() const
+    {
+      return _notifier.isRunning();
+    }
+
+    void notifyProgressed(double newProgress)
+    {
+      _notifier.notifyProgressed(newProgress);
+    }
+
+    qi::ProgressNotifier& _notifier;
+  };
+
+  /** Each thread notifies the progress of its share of a transfer of many small chunks,
+      the progress being rounded like a percentage: most notifications do not change it.
+  **/
+  template <class Notifications>
+  void runBenchmark(const std::string& name, int threadCount, int notificationsPerThread)
+  {
+    qi::ProgressNotifierPtr notifier = qi::createProgressNotifier();
+    notifier->notifyRunning();
+    std::atomic<long> signalCount{ 0 };
+    notifier->progress.connect([&](double) { ++signalCount; });
+
+    Notifications notifications(*notifier);
+    std::atomic<long> runningCount{ 0 };
+    const auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+    {
+      threads.emplace_back([&] {
+        long localRunningCount = 0;
+        for (int notificationIdx = 0; notificationIdx < notificationsPerThread; ++notificationIdx)
+        {
+          if (notifications.isRunning())
+            ++localRunningCount;
+          notifications.notifyProgressed(static_cast<double>(notificationIdx * 100 / notificationsPerThread) / 100.0);
+        }
+        runningCount += localRunningCount;
+      });
+    }
+    for (auto& thread : threads)
+      thread.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+    const double notificationCount = static_cast<double>(threadCount) * notificationsPerThread;
+    std::cout << name << ": " << threadCount << " threads, "
+              << (elapsed.count() * 1e9 / notificationCount) << " ns per notification, "
+              << signalCount.load() << " progress signals for " << static_cast<long>(notificationCount)
+              << " notifications, " << runningCount.load() << " seen running" << std::endl;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  qi::Application app(argc, argv);
+  const int notificationsPerThread = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+  for (const int threadCount : { 1, 4, 16 })
+  {
+    runBenchmark<PropertyNotifications>("properties", threadCount, notificationsPerThread);
+    runBenchmark<NotifierNotifications>("atomics   ", threadCount, notificationsPerThread);
+  }
+  return EXIT_SUCCESS;
+}
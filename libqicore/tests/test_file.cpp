@@ -9,6 +9,12 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem.hpp>
 #include <atomic>
+#include <chrono>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
 
 #include <qicore/file.hpp>
 #include <qi/path.hpp>
@@ -162,6 +168,360 @@ TEST(TestFile, readLocalFile)
   checkIsTestFileContent(buffer);
 }
 
+TEST(TestFile, readMappedLocalFile)
+{
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH, qi::FileAccessMode_Mapped);
+  EXPECT_TRUE(testFile->isOpen());
+  EXPECT_EQ(std::streamsize(TESTFILE_CONTENT.size()), testFile->size());
+
+  checkIsTestFileContent(*testFile);
+
+  qi::Buffer bufferPartial = testFile->read(TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE);
+  checkIsTestFilePartialContent(bufferPartial);
+  EXPECT_EQ(0u, testFile->read(1).totalSize());
+
+  testFile->close();
+  EXPECT_FALSE(testFile->isOpen());
+  EXPECT_THROW(
+      {
+        testFile->read(42);
+      },
+      std::runtime_error);
+}
+
+TEST(TestFile, mappedModeFallsBackOnEmptyFile)
+{
+  const qi::Path emptyFilePath{ TEMPORARY_DIR.PATH / "empty.data" };
+  boost::filesystem::ofstream{ emptyFilePath, std::ios::out | std::ios::binary };
+
+  qi::FilePtr testFile = qi::openLocalFile(emptyFilePath, qi::FileAccessMode_Mapped);
+  EXPECT_TRUE(testFile->isOpen());
+  EXPECT_EQ(0, testFile->size());
+  EXPECT_EQ(0u, testFile->read(42).totalSize());
+}
+
+TEST(TestFile, positionalReadDoesNotMoveCursor)
+{
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+
+  qi::Buffer bufferPartial = testFile->read(TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE);
+  checkIsTestFilePartialContent(bufferPartial);
+
+  qi::Buffer bufferBegin = testFile->read(TESTFILE_MIDDLE_SIZE);
+  checkIsTestFileContent(bufferBegin, 0, TESTFILE_MIDDLE_SIZE);
+}
+
+TEST(TestFile, concurrentPositionalReads)
+{
+  static const int READER_COUNT = 16;
+  static const int READS_PER_READER = 1000;
+
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+  const std::streamsize fileSize = testFile->size();
+
+  std::vector<std::thread> readers;
+  for (int readerIdx = 0; readerIdx < READER_COUNT; ++readerIdx)
+  {
+    readers.emplace_back([&, readerIdx]{
+      for (int readIdx = 0; readIdx < READS_PER_READER; ++readIdx)
+      {
+        const std::streamoff offset = (readerIdx + readIdx) % fileSize;
+        const std::streamsize count = 1 + readIdx % 5;
+        const qi::Buffer buffer = testFile->read(offset, count);
+        checkIsTestFileContent(buffer, offset, std::min(count, fileSize - offset));
+      }
+    });
+  }
+  for (auto& reader : readers)
+    reader.join();
+}
+
+TEST(TestFile, asyncReadsOfSeveralFiles)
+{
+  static const int READS_PER_FILE = 200;
+
+  qi::FilePtr smallFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+  qi::FilePtr bigFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  const std::streamsize fileSize = smallFile->size();
+
+  std::vector<qi::Future<qi::Buffer>> bigReads;
+  std::vector<qi::Future<qi::Buffer>> smallReads;
+  for (int readIdx = 0; readIdx < READS_PER_FILE; ++readIdx)
+  {
+    bigReads.push_back(bigFile->readAsync(readIdx * 1024, qi::File::MAX_READ_SIZE));
+    smallReads.push_back(smallFile->readAsync(readIdx % fileSize, 1 + readIdx % 5));
+  }
+
+  for (int readIdx = 0; readIdx < READS_PER_FILE; ++readIdx)
+  {
+    const std::streamoff offset = readIdx % fileSize;
+    const std::streamsize count = 1 + readIdx % 5;
+    ASSERT_TRUE(smallReads[readIdx].hasValue());
+    checkIsTestFileContent(smallReads[readIdx].value(), offset, std::min(count, fileSize - offset));
+  }
+  const qi::Buffer lastBigRead = bigReads.back().value();
+  const qi::Buffer expectedBigRead = bigFile->read((READS_PER_FILE - 1) * 1024, qi::File::MAX_READ_SIZE);
+  ASSERT_EQ(expectedBigRead.totalSize(), lastBigRead.totalSize());
+  EXPECT_TRUE(std::equal(static_cast<const char*>(expectedBigRead.data()),
+                         static_cast<const char*>(expectedBigRead.data()) + expectedBigRead.totalSize(),
+                         static_cast<const char*>(lastBigRead.data())));
+
+  // Errors are reported through the future.
+  EXPECT_TRUE(smallFile->readAsync(0, qi::File::MAX_READ_SIZE + 1).hasError());
+  smallFile->close();
+  EXPECT_TRUE(smallFile->readAsync(0, 4).hasError());
+}
+
+TEST(TestFile, asyncReadsAreFairAcrossClients)
+{
+  static const int BULK_READ_COUNT = 2000;
+
+  // Each client reads through its own File object, as returned by its own openLocalFile call.
+  qi::FilePtr bulkClientFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  qi::FilePtr otherClientFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+
+  std::vector<qi::Future<qi::Buffer>> bulkReads;
+  for (int readIdx = 0; readIdx < BULK_READ_COUNT; ++readIdx)
+    bulkReads.push_back(bulkClientFile->readAsync(0, qi::File::MAX_READ_SIZE));
+  qi::Future<qi::Buffer> otherRead = otherClientFile->readAsync(0, 4);
+
+  // The other client takes its turn right after the bulk reads in progress, not after all of them.
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, otherRead.wait(5000));
+  const auto finishedBulkReadCount =
+      std::count_if(bulkReads.begin(), bulkReads.end(),
+                    [](qi::Future<qi::Buffer>& bulkRead) { return bulkRead.isFinished(); });
+  EXPECT_LT(finishedBulkReadCount, BULK_READ_COUNT / 2);
+
+  for (auto& bulkRead : bulkReads)
+    bulkRead.cancel();
+}
+
+TEST(TestFile, readManyRanges)
+{
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+
+  const std::vector<qi::File::ByteRange> ranges{
+    { TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE },
+    { TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE },
+    { 0, 4 },
+    { testFile->size(), 4 },
+  };
+  const std::vector<qi::Buffer> buffers = testFile->readMany(ranges);
+  ASSERT_EQ(ranges.size(), buffers.size());
+  checkIsTestFilePartialContent(buffers[0]);
+  checkIsTestFileMiddleContent(buffers[1]);
+  checkIsTestFileContent(buffers[2], 0, 4);
+  EXPECT_EQ(0u, buffers[3].totalSize());
+}
+
+namespace
+{
+// Implements only the members which were required before readMany, readAsync, digest and matchBlocks.
+class MinimalFile : public qi::File
+{
+public:
+  explicit MinimalFile(std::string content)
+    : _content(std::move(content))
+  {
+  }
+
+  std::streamsize size() const override { return static_cast<std::streamsize>(_content.size()); }
+  bool isOpen() const override { return true; }
+  bool isRemote() const override { return false; }
+  qi::ProgressNotifierPtr operationProgress() const override { return {}; }
+
+  qi::Buffer read(std::streamsize) override { throw std::runtime_error("not implemented"); }
+  qi::Buffer read(std::streamoff beginOffset, std::streamsize countBytesToRead) override
+  {
+    ++readCount;
+    qi::Buffer output;
+    if (beginOffset < size())
+      output.write(_content.data() + beginOffset,
+                   static_cast<size_t>(std::min(countBytesToRead, size() - beginOffset)));
+    return output;
+  }
+
+  bool seek(std::streamoff) override { return false; }
+  void close() override {}
+
+  qi::Buffer _read(std::streamsize) override { throw std::runtime_error("not implemented"); }
+  qi::Buffer _read(std::streamoff, std::streamsize) override { throw std::runtime_error("not implemented"); }
+  bool _seek(std::streamoff) override { return false; }
+  void _close() override {}
+
+  int readCount = 0;
+
+private:
+  const std::string _content;
+};
+
+TEST(TestFile, defaultImplementationsUseRead)
+{
+  MinimalFile minimalFile(TESTFILE_CONTENT);
+
+  const std::vector<qi::Buffer> buffers = minimalFile.readMany({
+    { TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE },
+    { TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE },
+  });
+  ASSERT_EQ(2u, buffers.size());
+  checkIsTestFilePartialContent(buffers[0]);
+  checkIsTestFileMiddleContent(buffers[1]);
+  EXPECT_EQ(2, minimalFile.readCount);
+
+  qi::Future<qi::Buffer> futureMiddle = minimalFile.readAsync(TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE);
+  ASSERT_TRUE(futureMiddle.hasValue());
+  checkIsTestFileMiddleContent(futureMiddle.value());
+
+  const std::pair<bool, qi::Buffer> uncompressed = minimalFile.readCompressed(0, TESTFILE_CONTENT.size());
+  EXPECT_FALSE(uncompressed.first);
+  checkIsTestFileContent(uncompressed.second);
+
+  EXPECT_EQ(qi::openLocalFile(SMALL_TEST_FILE_PATH)->digest(), minimalFile.digest());
+  const std::vector<qi::File::BlockSignature> signatures = qi::detail::computeBlockSignatures(SMALL_TEST_FILE_PATH, 4);
+  const std::vector<qi::File::BlockMatch> matches = minimalFile.matchBlocks(4, signatures);
+  EXPECT_EQ(qi::openLocalFile(SMALL_TEST_FILE_PATH)->matchBlocks(4, signatures), matches);
+  EXPECT_EQ(TESTFILE_CONTENT.size() / 4, matches.size());
+  EXPECT_THROW(minimalFile.matchBlocks(0, signatures), std::runtime_error);
+}
+
+// A stream which never pushes the chunks it is granted credits for.
+class StalledStream : public qi::FileStream
+{
+public:
+  void addCredits(unsigned int) override {}
+  void stop() override { isStopped = true; }
+
+  std::atomic<bool> isStopped{ false };
+};
+
+class StalledStreamFile : public MinimalFile
+{
+public:
+  using MinimalFile::MinimalFile;
+
+  qi::FileStreamPtr openStream(std::streamoff, std::streamsize) override
+  {
+    return stream;
+  }
+
+  const boost::shared_ptr<StalledStream> stream = boost::make_shared<StalledStream>();
+};
+}
+
+TEST(TestFile, copyFailsWhenTheStreamStalls)
+{
+  static const qi::Path LOCAL_COPY_PATH(TEMPORARY_DIR.PATH / "stalledcopy.data");
+  auto stalledFile = boost::make_shared<StalledStreamFile>(TESTFILE_CONTENT);
+  qi::FilePtr testFile = boost::shared_ptr<qi::File>(stalledFile);
+
+  qi::FileTransferOptions options;
+  options.allowKernelCopy = false;
+  options.streamStallTimeout = std::chrono::milliseconds(200);
+  qi::FileCopyToLocal fileCopy{ testFile, LOCAL_COPY_PATH, options };
+  qi::Future<void> futureCopy = fileCopy.start();
+  ASSERT_EQ(qi::FutureState_FinishedWithError, futureCopy.wait(5000));
+  EXPECT_TRUE(stalledFile->stream->isStopped);
+  EXPECT_FALSE(boost::filesystem::exists(LOCAL_COPY_PATH));
+}
+
+TEST(TestFile, copyReadsFilesWhichCannotBeStreamed)
+{
+  static const qi::Path LOCAL_COPY_PATH(TEMPORARY_DIR.PATH / "unstreamedcopy.data");
+  auto minimalFile = boost::make_shared<MinimalFile>(TESTFILE_CONTENT);
+  qi::FilePtr testFile = boost::shared_ptr<qi::File>(minimalFile);
+
+  qi::FileTransferOptions options;
+  options.allowKernelCopy = false;
+  options.allowStreaming = true;
+  qi::FileCopyToLocal fileCopy{ testFile, LOCAL_COPY_PATH, options };
+  qi::Future<void> futureCopy = fileCopy.start();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, futureCopy.wait(5000));
+  EXPECT_LT(0, minimalFile->readCount);
+  checkSameFilesContent(*qi::openLocalFile(SMALL_TEST_FILE_PATH), *qi::openLocalFile(LOCAL_COPY_PATH));
+  boost::filesystem::remove(LOCAL_COPY_PATH);
+}
+
+TEST(TestFile, cannotReadManyTooMuchData)
+{
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+
+  const std::vector<qi::File::ByteRange> ranges{
+    { 0, qi::File::MAX_READ_SIZE / 2 },
+    { 0, qi::File::MAX_READ_SIZE / 2 + 1 },
+  };
+  EXPECT_THROW(
+      {
+        testFile->readMany(ranges);
+      },
+      std::runtime_error);
+}
+
+TEST(TestFile, streamIsLimitedByCredits)
+{
+  static const std::streamsize CHUNK_SIZE = 5;
+
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+  qi::FileStreamPtr stream = testFile->openStream(0, CHUNK_SIZE);
+
+  std::vector<std::pair<std::streamoff, qi::Buffer>> chunks;
+  stream->chunkStreamed.connect([&](std::streamoff offset, qi::Buffer chunk){
+    chunks.emplace_back(offset, chunk);
+  });
+
+  stream->addCredits(2);
+  ASSERT_EQ(2u, chunks.size());
+
+  stream->addCredits(100);
+  const std::size_t expectedChunkCount = (TESTFILE_CONTENT.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  ASSERT_EQ(expectedChunkCount, chunks.size());
+  for (std::size_t chunkIdx = 0; chunkIdx < chunks.size(); ++chunkIdx)
+  {
+    const std::streamoff offset = chunkIdx * CHUNK_SIZE;
+    EXPECT_EQ(offset, chunks[chunkIdx].first);
+    checkIsTestFileContent(chunks[chunkIdx].second, offset,
+                           std::min(CHUNK_SIZE, static_cast<std::streamsize>(TESTFILE_CONTENT.size()) - offset));
+  }
+
+  // The stream ended by itself.
+  stream->addCredits(1);
+  EXPECT_EQ(expectedChunkCount, chunks.size());
+}
+
+TEST(TestFile, streamsAreIndependent)
+{
+  static const std::streamsize CHUNK_SIZE = 5;
+
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+  qi::FileStreamPtr firstStream = testFile->openStream(0, CHUNK_SIZE);
+  qi::FileStreamPtr secondStream = testFile->openStream(TESTFILE_MIDDLE_BEGIN_POSITION, CHUNK_SIZE);
+
+  std::vector<std::streamoff> firstOffsets;
+  std::vector<std::streamoff> secondOffsets;
+  firstStream->chunkStreamed.connect([&](std::streamoff offset, qi::Buffer){ firstOffsets.push_back(offset); });
+  secondStream->chunkStreamed.connect([&](std::streamoff offset, qi::Buffer){ secondOffsets.push_back(offset); });
+
+  firstStream->addCredits(1);
+  secondStream->addCredits(2);
+  EXPECT_EQ(std::vector<std::streamoff>({ 0 }), firstOffsets);
+  EXPECT_EQ(std::vector<std::streamoff>({ TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_BEGIN_POSITION + CHUNK_SIZE }),
+            secondOffsets);
+
+  // Closing the file ends its streams.
+  testFile->close();
+  firstStream->addCredits(1);
+  EXPECT_EQ(1u, firstOffsets.size());
+}
+
+TEST(TestFile, readCompressed)
+{
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+
+  // Too small to be compressed.
+  const std::pair<bool, qi::Buffer> chunk = testFile->readCompressed(TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE);
+  EXPECT_FALSE(chunk.first);
+  checkIsTestFileMiddleContent(chunk.second);
+}
+
 TEST(TestFile, cannotReadPastEnd)
 {
   qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
@@ -173,172 +533,1501 @@ TEST(TestFile, cannotReadPastEnd)
   EXPECT_EQ(0u, buffer.totalSize());
 }
 
-TEST(TestFile, localCopy)
+TEST(TestFile, localCopy)
+{
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+  EXPECT_TRUE(testFile->isOpen());
+  EXPECT_EQ(std::streamsize(TESTFILE_CONTENT.size()), testFile->size());
+
+  static const qi::Path LOCAL_COPY_PATH("if_this_is_not_removed_test_file_failed.txt");
+  boost::filesystem::remove(LOCAL_COPY_PATH);
+  {
+    copyToLocal(testFile, LOCAL_COPY_PATH);
+
+    qi::FilePtr copiedFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+    EXPECT_TRUE(copiedFile->isOpen());
+    checkSameFilesContent(*testFile, *copiedFile);
+  }
+  boost::filesystem::remove(LOCAL_COPY_PATH);
+}
+
+TEST(TestFile, localCopyWithOrWithoutKernel)
+{
+  static const qi::Path LOCAL_COPY_PATH(TEMPORARY_DIR.PATH / "kernelcopy.data");
+  for (const bool allowKernelCopy : { true, false })
+  {
+    for (const auto accessMode : { qi::FileAccessMode_Stream, qi::FileAccessMode_Mapped })
+    {
+      qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH, accessMode);
+      qi::FileTransferOptions options;
+      options.allowKernelCopy = allowKernelCopy;
+
+      qi::FileCopyToLocal fileOperation{ testFile, LOCAL_COPY_PATH, options };
+      qi::Future<void> copyOpFt = fileOperation.start();
+      copyOpFt.wait();
+      ASSERT_TRUE(copyOpFt.hasValue());
+      EXPECT_EQ(1.0, fileOperation.notifier()->progress.get());
+      EXPECT_EQ(std::streamsize(TESTFILE_CONTENT.size()), fileOperation.receivedBytes());
+
+      qi::FilePtr copiedFile = qi::openLocalFile(LOCAL_COPY_PATH);
+      checkSameFilesContent(*testFile, *copiedFile);
+    }
+  }
+  boost::filesystem::remove(LOCAL_COPY_PATH);
+}
+
+// On file systems sharing blocks between files (btrfs, XFS), the destination is a clone of the source
+// and the first copy reports the whole file; elsewhere the data is copied by pieces.
+TEST(TestFile, kernelCopyReportsAllTheCopiedBytes)
+{
+  static const qi::Path LOCAL_COPY_PATH(TEMPORARY_DIR.PATH / "clonedcopy.data");
+  qi::FilePtr testFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  std::unique_ptr<qi::detail::KernelFileCopy> kernelCopy = qi::detail::startKernelFileCopy(testFile, LOCAL_COPY_PATH);
+  if (!kernelCopy)
+    return; // the system cannot copy files here
+
+  std::streamsize copiedBytes = 0;
+  while (const std::streamsize bytes = kernelCopy->copy(1024 * 1024))
+    copiedBytes += bytes;
+  kernelCopy.reset();
+
+  EXPECT_EQ(testFile->size(), copiedBytes);
+  checkSameFilesContent(*testFile, *qi::openLocalFile(LOCAL_COPY_PATH));
+
+  // The copy operation relies on the reported bytes to detect the end of the file.
+  qi::FileTransferOptions options;
+  options.allowKernelCopy = true;
+  qi::FileCopyToLocal fileCopy{ testFile, LOCAL_COPY_PATH, options };
+  qi::Future<void> futureCopy = fileCopy.start();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, futureCopy.wait(10000));
+  EXPECT_EQ(testFile->size(), fileCopy.receivedBytes());
+  checkSameFilesContent(*testFile, *qi::openLocalFile(LOCAL_COPY_PATH));
+  boost::filesystem::remove(LOCAL_COPY_PATH);
+}
+
+TEST(TestFile, transferSchedulerLimits)
+{
+  static const qi::Path LOCAL_COPY_PATH(TEMPORARY_DIR.PATH / "scheduledcopy.data");
+  qi::FilePtr testFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  const std::streamsize fileSize = testFile->size();
+
+  qi::FileTransferOptions options;
+  options.allowKernelCopy = false;
+  options.minChunkSize = options.maxChunkSize = options.initialChunkSize = 64 * 1024;
+
+  // The whole file cannot be read in less than about half a second.
+  qi::TransferSchedulerLimits limits;
+  limits.maxBytesPerSecond = 2.0 * fileSize;
+  limits.burstBytes = 64 * 1024;
+  limits.maxConcurrentTransfers = 1;
+  qi::setTransferSchedulerLimits(limits);
+  const qi::TransferSchedulerCounters countersBefore = qi::transferSchedulerCounters();
+
+  const auto startTime = std::chrono::steady_clock::now();
+  {
+    qi::FileCopyToLocal firstCopy{ testFile, LOCAL_COPY_PATH, options };
+    qi::FileCopyToLocal secondCopy{ qi::openLocalFile(SMALL_TEST_FILE_PATH), LOCAL_COPY_PATH.str() + ".small", options };
+    qi::Future<void> firstCopyFt = firstCopy.start();
+    qi::Future<void> secondCopyFt = secondCopy.start();
+    EXPECT_EQ(1u, qi::transferSchedulerCounters().transfersRunning);
+    firstCopyFt.wait();
+    secondCopyFt.wait();
+    EXPECT_TRUE(firstCopyFt.hasValue());
+    EXPECT_TRUE(secondCopyFt.hasValue());
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+  qi::setTransferSchedulerLimits({});
+
+  const qi::TransferSchedulerCounters countersAfter = qi::transferSchedulerCounters();
+  EXPECT_LE(0.4, elapsed.count());
+  EXPECT_LT(countersBefore.readsThrottled, countersAfter.readsThrottled);
+  EXPECT_LT(countersBefore.transfersQueued, countersAfter.transfersQueued);
+  EXPECT_EQ(countersBefore.bytesGranted + fileSize + TESTFILE_CONTENT.size(), countersAfter.bytesGranted);
+
+  qi::FilePtr copiedFile = qi::openLocalFile(LOCAL_COPY_PATH);
+  checkSameFilesContent(*testFile, *copiedFile);
+  boost::filesystem::remove(LOCAL_COPY_PATH);
+  boost::filesystem::remove(LOCAL_COPY_PATH.str() + ".small");
+}
+
+TEST(TestFile, canceledTransfersLeaveTheSchedulerQueue)
+{
+  static const qi::Path LOCAL_COPY_PATH(TEMPORARY_DIR.PATH / "queuedcopy.data");
+  qi::TransferSchedulerLimits limits;
+  limits.maxConcurrentTransfers = 1;
+  qi::setTransferSchedulerLimits(limits);
+
+  qi::Future<void> runningSlot = qi::detail::acquireTransferSlot(qi::TransferPriority_Normal);
+  ASSERT_TRUE(runningSlot.hasValue());
+  {
+    qi::Future<void> waitingSlot = qi::detail::acquireTransferSlot(qi::TransferPriority_Normal);
+    EXPECT_FALSE(waitingSlot.isFinished());
+    EXPECT_EQ(1u, qi::transferSchedulerCounters().transfersWaiting);
+    waitingSlot.cancel();
+    EXPECT_TRUE(waitingSlot.isCanceled());
+    EXPECT_EQ(0u, qi::transferSchedulerCounters().transfersWaiting);
+  }
+  {
+    qi::FileCopyToLocal fileCopy{ qi::openLocalFile(SMALL_TEST_FILE_PATH), LOCAL_COPY_PATH };
+    qi::Future<void> copyOpFt = fileCopy.start();
+    EXPECT_EQ(1u, qi::transferSchedulerCounters().transfersWaiting);
+    copyOpFt.cancel();
+    ASSERT_EQ(qi::FutureState_Canceled, copyOpFt.wait(5000));
+    EXPECT_EQ(0u, qi::transferSchedulerCounters().transfersWaiting);
+  }
+  qi::detail::releaseTransferSlot();
+  EXPECT_EQ(0u, qi::transferSchedulerCounters().transfersRunning);
+  qi::setTransferSchedulerLimits({});
+  boost::filesystem::remove(LOCAL_COPY_PATH);
+}
+
+TEST(TestFile, fileHandlePoolSharesAndReopensDescriptors)
+{
+  static const qi::Path POOLED_FILES_DIR(TEMPORARY_DIR.PATH / "pooled");
+  static const int FILE_COUNT = 8;
+  boost::filesystem::create_directories(POOLED_FILES_DIR);
+  const auto pooledFilePath = [](int index) { return POOLED_FILES_DIR / (std::to_string(index) + ".data"); };
+  const auto pooledFileContent = [](int index) { return std::to_string(index) + TESTFILE_CONTENT; };
+  for (int index = 0; index < FILE_COUNT; ++index)
+  {
+    boost::filesystem::ofstream fileOutput(pooledFilePath(index), std::ios::out | std::ios::binary);
+    fileOutput << pooledFileContent(index);
+  }
+
+  const qi::FileHandlePoolLimits previousLimits = qi::fileHandlePoolLimits();
+  qi::FileHandlePoolLimits limits;
+  limits.maxOpenDescriptors = 2;
+  qi::setFileHandlePoolLimits(limits);
+  const qi::FileHandlePoolCounters countersBefore = qi::fileHandlePoolCounters();
+
+  std::vector<qi::FilePtr> files;
+  for (int index = 0; index < FILE_COUNT; ++index)
+    files.push_back(qi::openLocalFile(pooledFilePath(index)));
+  qi::FilePtr sameFile = qi::openLocalFile(pooledFilePath(0));
+  EXPECT_EQ(countersBefore.opens + FILE_COUNT, qi::fileHandlePoolCounters().opens);
+  EXPECT_EQ(countersBefore.sharedOpens + 1, qi::fileHandlePoolCounters().sharedOpens);
+  EXPECT_GE(2u, qi::fileHandlePoolCounters().openDescriptors);
+
+  // The descriptors closed by the pool are reopened transparently.
+  for (int index = 0; index < FILE_COUNT; ++index)
+  {
+    const std::string expectedContent = pooledFileContent(index);
+    const qi::Buffer content = files[index]->read(0, files[index]->size());
+    ASSERT_EQ(expectedContent.size(), content.totalSize());
+    EXPECT_TRUE(std::equal(expectedContent.begin(), expectedContent.end(), static_cast<const char*>(content.data())));
+  }
+  checkSameFilesContent(*files[0], *sameFile);
+  const qi::FileHandlePoolCounters countersAfter = qi::fileHandlePoolCounters();
+  EXPECT_LE(countersBefore.reopens + FILE_COUNT - 2, countersAfter.reopens);
+  EXPECT_LT(countersBefore.evictions, countersAfter.evictions);
+  EXPECT_GE(2u, countersAfter.openDescriptors);
+
+  const qi::Path replacementPath(POOLED_FILES_DIR / "replacement.data");
+  const auto replaceFile = [&](int index) {
+    {
+      boost::filesystem::ofstream fileOutput(replacementPath, std::ios::out | std::ios::binary);
+      fileOutput << TESTFILE_CONTENT;
+    }
+    boost::filesystem::rename(replacementPath, pooledFilePath(index));
+  };
+
+  // A file replaced while its descriptor is open keeps it, as it could not be reopened.
+  ASSERT_EQ(1u, files[0]->read(0, 1).totalSize());
+  replaceFile(0);
+  for (int index = 1; index < FILE_COUNT; ++index)
+    files[index]->read(0, 1);
+  {
+    const std::string expectedContent = pooledFileContent(0);
+    const qi::Buffer content = files[0]->read(0, files[0]->size());
+    ASSERT_EQ(expectedContent.size(), content.totalSize());
+    EXPECT_TRUE(std::equal(expectedContent.begin(), expectedContent.end(), static_cast<const char*>(content.data())));
+  }
+
+  // A file replaced once its descriptor has been closed cannot be read anymore.
+  replaceFile(1);
+  EXPECT_THROW(files[1]->read(0, 1), std::runtime_error);
+
+  files.clear();
+  sameFile.reset();
+  EXPECT_EQ(countersBefore.fileCount, qi::fileHandlePoolCounters().fileCount);
+  qi::setFileHandlePoolLimits(previousLimits);
+  boost::filesystem::remove_all(POOLED_FILES_DIR);
+}
+
+TEST(TestProgressNotifier, signalsOnlyChanges)
+{
+  qi::ProgressNotifierPtr notifier = qi::createProgressNotifier();
+  std::atomic<int> statusSignalCount{ 0 };
+  std::atomic<int> progressSignalCount{ 0 };
+  notifier->status.connect([&](qi::ProgressNotifier::Status) { ++statusSignalCount; });
+  notifier->progress.connect([&](double) { ++progressSignalCount; });
+
+  notifier->notifyRunning();
+  notifier->notifyProgressed(0.5);
+  notifier->notifyProgressed(0.5);
+  notifier->notifyProgressed(1.0);
+  notifier->notifyFinished();
+  notifier->notifyFinished();
+  EXPECT_EQ(2, statusSignalCount.load());
+  EXPECT_EQ(2, progressSignalCount.load());
+  EXPECT_EQ(qi::ProgressNotifier::Status_Finished, notifier->status.get());
+  EXPECT_EQ(1.0, notifier->progress.get());
+
+  notifier->reset();
+  notifier->reset();
+  EXPECT_EQ(3, statusSignalCount.load());
+  EXPECT_EQ(3, progressSignalCount.load());
+  EXPECT_FALSE(notifier->isRunning());
+}
+
+TEST(TestProgressNotifier, rejectsIllegalTransitions)
+{
+  qi::ProgressNotifierPtr notifier = qi::createProgressNotifier();
+  notifier->notifyFinished();
+  EXPECT_EQ(qi::ProgressNotifier::Status_Idle, notifier->status.get());
+
+  notifier->notifyRunning();
+  notifier->notifyFinished();
+  notifier->notifyRunning();
+  notifier->notifyCanceled();
+  EXPECT_EQ(qi::ProgressNotifier::Status_Finished, notifier->status.get());
+  EXPECT_FALSE(notifier->isRunning());
+}
+
+TEST(TestProgressNotifier, concurrentNotificationsKeepPropertiesConsistent)
+{
+  static const int NOTIFIER_COUNT = 8;
+  static const int PROGRESS_STEPS = 1000;
+
+  qi::ProgressNotifierPtr notifier = qi::createProgressNotifier();
+  notifier->notifyRunning();
+  std::vector<std::thread> notifiers;
+  for (int notifierIdx = 0; notifierIdx < NOTIFIER_COUNT; ++notifierIdx)
+  {
+    notifiers.emplace_back([&] {
+      for (int step = 0; step <= PROGRESS_STEPS; ++step)
+        notifier->notifyProgressed(static_cast<double>(step) / PROGRESS_STEPS);
+    });
+  }
+  for (auto& thread : notifiers)
+    thread.join();
+  EXPECT_EQ(1.0, notifier->progress.get());
+
+  // Only one of the concurrent transitions is expected.
+  std::atomic<int> finishedCount{ 0 };
+  notifier->status.connect([&](qi::ProgressNotifier::Status status) {
+    if (status == qi::ProgressNotifier::Status_Finished)
+      ++finishedCount;
+  });
+  notifiers.clear();
+  for (int notifierIdx = 0; notifierIdx < NOTIFIER_COUNT; ++notifierIdx)
+    notifiers.emplace_back([&] { notifier->notifyFinished(); });
+  for (auto& thread : notifiers)
+    thread.join();
+  EXPECT_EQ(1, finishedCount.load());
+  EXPECT_EQ(qi::ProgressNotifier::Status_Finished, notifier->status.get());
+}
+
+TEST(TestProgressNotifier, aggregatorCombinesWeightedChildren)
+{
+  qi::ProgressNotificationPolicy policy;
+  policy.minProgressDelta = 0.1;
+  qi::ProgressAggregator aggregator{ policy };
+  qi::ProgressNotifierPtr combined = aggregator.notifier();
+  std::atomic<int> progressSignalCount{ 0 };
+  combined->progress.connect([&](double) { ++progressSignalCount; });
+
+  qi::ProgressNotifierPtr bigChild = qi::createProgressNotifier();
+  qi::ProgressNotifierPtr smallChild = qi::createProgressNotifier();
+  aggregator.attach(bigChild, 3000);
+  aggregator.attach(smallChild, 1000);
+  EXPECT_FALSE(combined->isRunning());
+
+  bigChild->notifyRunning();
+  EXPECT_TRUE(combined->isRunning());
+  bigChild->notifyProgressed(0.5);
+  EXPECT_DOUBLE_EQ(0.375, combined->progress.get());
+
+  // Below the minimum delta: held back.
+  bigChild->notifyProgressed(0.51);
+  EXPECT_DOUBLE_EQ(0.375, combined->progress.get());
+  EXPECT_EQ(1, progressSignalCount.load());
+
+  smallChild->notifyRunning();
+  bigChild->notifyFinished();
+  EXPECT_DOUBLE_EQ(0.75, combined->progress.get());
+  EXPECT_TRUE(combined->isRunning());
+
+  // The final state is always notified.
+  smallChild->notifyProgressed(0.95);
+  smallChild->notifyCanceled();
+  EXPECT_DOUBLE_EQ(1.0, combined->progress.get());
+  EXPECT_EQ(qi::ProgressNotifier::Status_Canceled, combined->status.get());
+  EXPECT_THROW(aggregator.attach(qi::createProgressNotifier(), 1), std::runtime_error);
+}
+
+TEST(TestProgressNotifier, aggregatorObserversCanAttachOperations)
+{
+  qi::ProgressAggregator aggregator;
+  qi::ProgressNotifierPtr combined = aggregator.notifier();
+  qi::ProgressNotifierPtr firstChild = qi::createProgressNotifier();
+  qi::ProgressNotifierPtr secondChild = qi::createProgressNotifier();
+  aggregator.attach(firstChild, 1);
+
+  // The combined notifier is notified out of the lock of the aggregator.
+  qi::Promise<void> secondChildAttached;
+  combined->status.connect([&](qi::ProgressNotifier::Status status) {
+    if (status != qi::ProgressNotifier::Status_Running)
+      return;
+    aggregator.attach(secondChild, 1);
+    secondChildAttached.setValue(0);
+  });
+  firstChild->notifyRunning();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, secondChildAttached.future().wait(5000));
+
+  firstChild->notifyFinished();
+  EXPECT_TRUE(combined->isRunning());
+  secondChild->notifyRunning();
+  secondChild->notifyFinished();
+  EXPECT_EQ(qi::ProgressNotifier::Status_Finished, combined->status.get());
+}
+
+TEST(TestFile, digest)
+{
+  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
+  EXPECT_EQ("sha256-71c480df93d6ae2f1efad1447c66c9525e316218cf51fc8d9ed832f2daf18b73", testFile->digest());
+  EXPECT_EQ(testFile->digest(), qi::openLocalFile(SMALL_TEST_FILE_PATH, qi::FileAccessMode_Mapped)->digest());
+  EXPECT_NE(testFile->digest(), qi::openLocalFile(BIG_TEST_FILE_PATH)->digest());
+
+  testFile->close();
+  EXPECT_THROW(testFile->digest(), std::runtime_error);
+}
+
+TEST(TestFile, writableFileCommitOrDiscard)
+{
+  static const qi::Path LOCAL_PATH(TEMPORARY_DIR.PATH / "written.data");
+  static const std::string PREVIOUS_CONTENT = "previous";
+  {
+    boost::filesystem::ofstream previousFile(LOCAL_PATH, std::ios::out | std::ios::binary | std::ios::trunc);
+    previousFile << PREVIOUS_CONTENT;
+  }
+
+  const std::string firstPart = TESTFILE_CONTENT.substr(0, TESTFILE_MIDDLE_BEGIN_POSITION);
+  const std::string lastPart = TESTFILE_CONTENT.substr(TESTFILE_MIDDLE_BEGIN_POSITION);
+  {
+    qi::WritableFilePtr writableFile = qi::createLocalFile(LOCAL_PATH);
+    qi::Buffer lastData;
+    lastData.write(lastPart.data(), lastPart.size());
+    writableFile->write(TESTFILE_MIDDLE_BEGIN_POSITION, lastData);
+    writableFile->discard();
+    EXPECT_FALSE(writableFile->isOpen());
+    EXPECT_THROW(writableFile->write(0, lastData), std::runtime_error);
+  }
+  EXPECT_EQ(static_cast<boost::uintmax_t>(PREVIOUS_CONTENT.size()), boost::filesystem::file_size(LOCAL_PATH));
+  {
+    // The destination is untouched until the content is committed.
+    qi::WritableFilePtr writableFile = qi::createLocalFile(LOCAL_PATH);
+    writableFile->truncate(1);
+    qi::Buffer lastData;
+    lastData.write(lastPart.data(), lastPart.size());
+    writableFile->write(TESTFILE_MIDDLE_BEGIN_POSITION, lastData);
+    qi::Buffer firstData;
+    firstData.write(firstPart.data(), firstPart.size());
+    writableFile->write(0, firstData);
+    EXPECT_EQ(static_cast<std::streamsize>(TESTFILE_CONTENT.size()), writableFile->size());
+    EXPECT_EQ(static_cast<boost::uintmax_t>(PREVIOUS_CONTENT.size()), boost::filesystem::file_size(LOCAL_PATH));
+
+    writableFile->commit();
+    EXPECT_FALSE(writableFile->isOpen());
+  }
+
+  qi::FilePtr writtenFile = qi::openLocalFile(LOCAL_PATH);
+  checkIsTestFileContent(*writtenFile);
+  writtenFile->close();
+
+  std::size_t fileCount = 0;
+  for (boost::filesystem::directory_iterator it(TEMPORARY_DIR.PATH), end; it != end; ++it)
+    fileCount += it->path().filename().string().find("written.data") != std::string::npos ? 1 : 0;
+  EXPECT_EQ(1u, fileCount); // no temporary file left
+  boost::filesystem::remove(LOCAL_PATH);
+}
+
+TEST(TestFile, localCopyToWritableFile)
+{
+  static const qi::Path LOCAL_PATH(TEMPORARY_DIR.PATH / "pushed.data");
+  boost::filesystem::remove(LOCAL_PATH);
+
+  qi::FilePtr testFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  qi::FileTransferOptions options;
+  options.initialChunkSize = 100 * 1000;
+  qi::FileCopyToRemote fileCopy{ testFile, qi::createLocalFile(LOCAL_PATH), options };
+  qi::Future<void> copyOpFt = fileCopy.start();
+  copyOpFt.wait();
+  EXPECT_TRUE(copyOpFt.hasValue());
+  EXPECT_EQ(testFile->size(), fileCopy.sentBytes());
+
+  qi::FilePtr copiedFile = qi::openLocalFile(LOCAL_PATH);
+  checkSameFilesContent(*testFile, *copiedFile);
+  copiedFile->close();
+  boost::filesystem::remove(LOCAL_PATH);
+}
+
+namespace
+{
+qi::FilePtr getTestFile(const qi::Path& filePath)
+{
+  qi::FilePtr testFile = qi::openLocalFile(filePath);
+  EXPECT_TRUE(testFile->isOpen());
+  return testFile;
+}
+
+qi::WritableFilePtr getDestinationFile(const qi::Path& filePath)
+{
+  return qi::createLocalFile(filePath);
+}
+
+std::atomic<bool> printProgressHaveBeenCalled(false);
+void printTranferProgress(double progress)
+{
+  printProgressHaveBeenCalled = true;
+  qiLogInfo() << "#### File Transfer Progress = " << (progress * 100.0) << "%";
+}
+
+class Test_ReadRemoteFile : public ::testing::Test
+{
+public:
+  void SetUp()
+  {
+    qi::DynamicObjectBuilder objectBuilder;
+    objectBuilder.advertiseMethod("getTestFile", &getTestFile);
+    objectBuilder.advertiseMethod("getDestinationFile", &getDestinationFile);
+    service = objectBuilder.object();
+
+    qi::SessionPtr serverSession = sessionPair.server();
+    serverSession->registerService("service", service);
+  }
+
+  qi::FilePtr clientAcquireTestFile(const qi::Path& path)
+  {
+    qi::AnyObject service = sessionPair.client()->service("service");
+    qi::FilePtr testFile = service.call<qi::FilePtr>("getTestFile", path);
+    EXPECT_TRUE(testFile->isRemote());
+    return testFile;
+  }
+
+  qi::WritableFilePtr clientAcquireDestinationFile(const qi::Path& path)
+  {
+    qi::AnyObject service = sessionPair.client()->service("service");
+    return service.call<qi::WritableFilePtr>("getDestinationFile", path);
+  }
+
+private:
+  TestSessionPair sessionPair;
+  qi::AnyObject service;
+};
+}
+
+TEST_F(Test_ReadRemoteFile, isLocalOrRemote)
+{
+  {
+    qi::FilePtr testFile = openLocalFile(SMALL_TEST_FILE_PATH);
+    EXPECT_FALSE(testFile->isRemote());
+  }
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+    EXPECT_TRUE(testFile->isRemote());
+  }
+}
+
+TEST_F(Test_ReadRemoteFile, someReading)
+{
+  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+
+  static const size_t COUNT_BYTES_TO_READ = 20;
+
+  qi::Buffer buffer = testFile->read(COUNT_BYTES_TO_READ);
+  ASSERT_EQ(COUNT_BYTES_TO_READ, buffer.totalSize());
+  checkIsTestFileContent(buffer);
+}
+
+TEST_F(Test_ReadRemoteFile, asyncReading)
+{
+  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+
+  qi::Future<qi::Buffer> futurePartial = testFile->readAsync(TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE);
+  qi::Future<qi::Buffer> futureMiddle = testFile->readAsync(TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE);
+  checkIsTestFilePartialContent(futurePartial.value());
+  checkIsTestFileMiddleContent(futureMiddle.value());
+  EXPECT_TRUE(testFile->readAsync(0, qi::File::MAX_READ_SIZE + 1).hasError());
+}
+
+TEST_F(Test_ReadRemoteFile, readAll)
+{
+  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+
+  static const size_t COUNT_BYTES_TO_READ_PER_CYCLE = 10;
+
+  qi::Buffer buffer;
+  qi::Buffer cycleBuffer;
+  while (true)
+  {
+    cycleBuffer = testFile->read(COUNT_BYTES_TO_READ_PER_CYCLE);
+    buffer.write(cycleBuffer.data(), cycleBuffer.totalSize());
+    if (cycleBuffer.totalSize() < COUNT_BYTES_TO_READ_PER_CYCLE)
+      break;
+  }
+
+  EXPECT_EQ(TESTFILE_CONTENT.size(), buffer.totalSize());
+  checkIsTestFileContent(buffer);
+}
+
+TEST_F(Test_ReadRemoteFile, readAheadSequentialReads)
+{
+  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+  EXPECT_FALSE(qi::enableReadAhead(qi::openLocalFile(SMALL_TEST_FILE_PATH)));
+  ASSERT_TRUE(qi::enableReadAhead(testFile, 8, 2));
+
+  static const size_t COUNT_BYTES_TO_READ_PER_CYCLE = 3;
+
+  qi::Buffer buffer;
+  qi::Buffer cycleBuffer;
+  do
+  {
+    cycleBuffer = testFile->read(COUNT_BYTES_TO_READ_PER_CYCLE);
+    buffer.write(cycleBuffer.data(), cycleBuffer.totalSize());
+  } while (cycleBuffer.totalSize() == COUNT_BYTES_TO_READ_PER_CYCLE);
+
+  EXPECT_EQ(TESTFILE_CONTENT.size(), buffer.totalSize());
+  checkIsTestFileContent(buffer);
+
+  const qi::FileReadAheadStatistics statistics = qi::readAheadStatistics(testFile);
+  EXPECT_GT(statistics.cacheHits, statistics.cacheMisses);
+
+  // The cursor is still honored after a seek, and given back to the remote file.
+  ASSERT_TRUE(testFile->seek(TESTFILE_MIDDLE_BEGIN_POSITION));
+  checkIsTestFileContent(testFile->read(3), TESTFILE_MIDDLE_BEGIN_POSITION, 3);
+  qi::disableReadAhead(testFile);
+  checkIsTestFileContent(testFile->read(3), TESTFILE_MIDDLE_BEGIN_POSITION + 3, 3);
+}
+
+TEST_F(Test_ReadRemoteFile, readAllOnce)
+{
+  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+
+  const std::streamsize fileSize = testFile->size();
+  EXPECT_EQ(std::streamsize(TESTFILE_CONTENT.size()), fileSize);
+
+  qi::Buffer buffer = testFile->read(fileSize);
+  EXPECT_EQ(TESTFILE_CONTENT.size(), buffer.totalSize());
+  checkIsTestFileContent(buffer);
+}
+
+TEST_F(Test_ReadRemoteFile, readManyRanges)
+{
+  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+
+  const std::vector<qi::File::ByteRange> ranges{
+    { TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE },
+    { TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE },
+  };
+  const std::vector<qi::Buffer> buffers = testFile->readMany(ranges);
+  ASSERT_EQ(ranges.size(), buffers.size());
+  checkIsTestFileMiddleContent(buffers[0]);
+  checkIsTestFilePartialContent(buffers[1]);
+}
+
+TEST_F(Test_ReadRemoteFile, concurrentReadersOfOneFile)
+{
+  static const std::streamsize BYTES_PER_READ = 64 * 1024;
+
+  qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+  const std::streamsize fileSize = testFile->size();
+
+  for (int readerCount = 1; readerCount <= 32; readerCount *= 2)
+  {
+    std::atomic<std::streamsize> totalBytesRead{0};
+    const auto beginTime = std::chrono::steady_clock::now();
+
+    // Each reader reads the whole file, starting at a different position.
+    std::vector<std::thread> readers;
+    for (int readerIdx = 0; readerIdx < readerCount; ++readerIdx)
+    {
+      readers.emplace_back([&, readerIdx]{
+        const std::streamsize chunkCount = (fileSize + BYTES_PER_READ - 1) / BYTES_PER_READ;
+        for (std::streamsize chunkIdx = 0; chunkIdx < chunkCount; ++chunkIdx)
+        {
+          const std::streamoff offset = ((chunkIdx + readerIdx) % chunkCount) * BYTES_PER_READ;
+          const qi::Buffer remoteBytes = testFile->read(offset, BYTES_PER_READ);
+          const qi::Buffer localBytes = originalFile->read(offset, BYTES_PER_READ);
+          ASSERT_EQ(localBytes.totalSize(), remoteBytes.totalSize());
+          ASSERT_TRUE(std::equal(static_cast<const char*>(localBytes.data()),
+                                 static_cast<const char*>(localBytes.data()) + localBytes.totalSize(),
+                                 static_cast<const char*>(remoteBytes.data())));
+          totalBytesRead += remoteBytes.totalSize();
+        }
+      });
+    }
+    for (auto& reader : readers)
+      reader.join();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - beginTime;
+    EXPECT_EQ(fileSize * readerCount, totalBytesRead.load());
+    qiLogInfo() << "#### " << readerCount << " concurrent readers: "
+                << (totalBytesRead.load() / elapsed.count() / (1024 * 1024)) << " MiB/s";
+  }
+}
+
+TEST_F(Test_ReadRemoteFile, filetransfert)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "file.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+
+    copyToLocal(testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  }
+  {
+    qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    EXPECT_TRUE(localFileCopy->isOpen());
+    checkIsTestFileContent(*localFileCopy);
+  }
+
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+}
+
+TEST_F(Test_ReadRemoteFile, readInTheMiddle)
+{
+  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+
+  qi::Buffer bufferPartial = testFile->read(TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE);
+  checkIsTestFilePartialContent(bufferPartial);
+
+  qi::Buffer bufferMiddle = testFile->read(TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE);
+  checkIsTestFileMiddleContent(bufferMiddle);
+}
+
+TEST_F(Test_ReadRemoteFile, bigFiletransfert)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+
+    qi::FileCopyToLocal fileCopy{testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN};
+    fileCopy.notifier()->progress.connect(&printTranferProgress);
+    fileCopy.start().wait();
+
+    EXPECT_TRUE(printProgressHaveBeenCalled.load());
+  }
+  {
+    qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+    qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    checkSameFilesContent(*originalFile, *localFileCopy);
+  }
+
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+}
+
+TEST_F(Test_ReadRemoteFile, pipelinedFiletransfert)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  for (unsigned int readsInFlight : { 1u, 3u, 16u })
+  {
+    {
+      qi::FileTransferOptions options;
+      options.allowStreaming = false;
+      options.maxReadsInFlight = readsInFlight;
+      options.initialChunkSize = 10000; // not a divider of the file size
+      options.minChunkSize = 1000;
+      options.maxChunkSize = 200000;
+
+      qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+      qi::FileCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+      double lastProgress = 0.0;
+      fileCopy.notifier()->progress.connect([&](double progress){
+        EXPECT_LE(lastProgress, progress);
+        lastProgress = progress;
+      });
+      qi::Future<void> copyOpFt = fileCopy.start();
+      copyOpFt.wait();
+      EXPECT_TRUE(copyOpFt.hasValue());
+      EXPECT_EQ(1.0, lastProgress);
+    }
+    {
+      qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+      qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+      checkSameFilesContent(*originalFile, *localFileCopy);
+    }
+    boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  }
+}
+
+TEST_F(Test_ReadRemoteFile, writerStageFiletransfert)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+
+  for (const auto syncPolicy : { qi::FileSyncPolicy_None, qi::FileSyncPolicy_AtEnd, qi::FileSyncPolicy_EveryChunk })
+  {
+    for (bool allowStreaming : { true, false })
+    {
+      boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+      {
+        qi::FileTransferOptions options;
+        options.allowStreaming = allowStreaming;
+        options.maxReadsInFlight = 8;
+        options.maxQueuedWrites = 1; // the writes are always late
+        options.syncPolicy = syncPolicy;
+
+        qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+        qi::FileCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+        qi::Future<void> copyOpFt = fileCopy.start();
+        copyOpFt.wait();
+        EXPECT_TRUE(copyOpFt.hasValue());
+        EXPECT_EQ(testFile->size(), fileCopy.receivedBytes());
+      }
+      {
+        qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+        qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+        checkSameFilesContent(*originalFile, *localFileCopy);
+      }
+    }
+  }
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+}
+
+TEST_F(Test_ReadRemoteFile, streamedOrRequestedFiletransfert)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  for (bool allowStreaming : { true, false })
+  {
+    {
+      qi::FileTransferOptions options;
+      options.allowStreaming = allowStreaming;
+
+      qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+      qi::FileCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+      qi::Future<void> copyOpFt = fileCopy.start();
+      copyOpFt.wait();
+      EXPECT_TRUE(copyOpFt.hasValue());
+    }
+    {
+      qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+      qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+      checkSameFilesContent(*originalFile, *localFileCopy);
+    }
+    boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  }
+}
+
+TEST_F(Test_ReadRemoteFile, compressedFiletransfert)
+{
+  static const qi::Path COMPRESSIBLE_FILE_PATH = TEMPORARY_DIR.PATH / "compressible.data";
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "compressible_copy.data";
+  {
+    boost::filesystem::ofstream fileOutput(COMPRESSIBLE_FILE_PATH, std::ios::out | std::ios::binary);
+    for (int idx = 0; idx < 100000; ++idx)
+      fileOutput << TESTFILE_CONTENT << idx;
+  }
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  {
+    qi::FileTransferOptions options;
+    options.allowCompression = true;
+
+    qi::FilePtr testFile = clientAcquireTestFile(COMPRESSIBLE_FILE_PATH);
+    qi::FileCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+    qi::Future<void> copyOpFt = fileCopy.start();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.hasValue());
+    EXPECT_EQ(testFile->size(), fileCopy.receivedBytes());
+    EXPECT_LT(fileCopy.receivedWireBytes(), fileCopy.receivedBytes() / 2);
+  }
+  {
+    qi::FilePtr originalFile = qi::openLocalFile(COMPRESSIBLE_FILE_PATH);
+    qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    checkSameFilesContent(*originalFile, *localFileCopy);
+  }
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  boost::filesystem::remove(COMPRESSIBLE_FILE_PATH);
+}
+
+TEST_F(Test_ReadRemoteFile, parallelFiletransfert)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+    qi::FileParallelCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, 7 };
+    // The ranges are received out of order, they would be held in memory to be provided in order.
+    EXPECT_THROW(fileCopy.addSink(boost::make_shared<qi::DigestFileSink>()), std::runtime_error);
+    qi::Future<void> copyOpFt = fileCopy.start();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.hasValue());
+  }
+  {
+    qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+    qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    checkSameFilesContent(*originalFile, *localFileCopy);
+  }
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+}
+
+TEST_F(Test_ReadRemoteFile, cancelParallelFileTransfer)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+    qi::FileParallelCopyToLocal fileOp{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN };
+    auto fileOpNotifier = fileOp.notifier();
+    fileOpNotifier->status.connect([&](qi::ProgressNotifier::Status status){
+      if (status == qi::ProgressNotifier::Status_Running)
+      {
+        fileOpNotifier->waitForFinished().cancel();
+      }
+    });
+    qi::Future<void> copyOpFt = fileOp.start();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.isCanceled());
+  }
+
+  EXPECT_FALSE(boost::filesystem::exists(LOCAL_PATH_TO_RECEIVE_FILE_IN));
+}
+
+TEST_F(Test_ReadRemoteFile, resumeFileTransfer)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+  const qi::Path manifestPath = qi::FileResumableCopyToLocal::manifestPath(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  boost::filesystem::remove(manifestPath);
+
+  qi::FileTransferOptions options;
+  options.maxReadsInFlight = 2;
+  options.initialChunkSize = 64 * 1024;
+
+  // Interrupt a first copy after some progress.
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+    qi::FileResumableCopyToLocal fileOp{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+    auto fileOpNotifier = fileOp.notifier();
+    fileOpNotifier->progress.connect([=](double progress){
+      if (progress > 0.3)
+        fileOpNotifier->waitForFinished().cancel();
+    });
+    qi::Future<void> copyOpFt = fileOp.start();
+    copyOpFt.wait();
+    ASSERT_TRUE(copyOpFt.isCanceled());
+  }
+  EXPECT_TRUE(boost::filesystem::exists(LOCAL_PATH_TO_RECEIVE_FILE_IN));
+  EXPECT_TRUE(boost::filesystem::exists(manifestPath));
+
+  // Corrupt a chunk already received, it must be fetched again.
+  {
+    boost::filesystem::fstream partialFile(LOCAL_PATH_TO_RECEIVE_FILE_IN, std::ios::in | std::ios::out | std::ios::binary);
+    partialFile.seekp(10);
+    partialFile.put('\x42');
+  }
+
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+    qi::FileResumableCopyToLocal fileOp{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+    std::atomic<bool> isFirstProgress{ true };
+    fileOp.notifier()->progress.connect([&](double progress){
+      if (isFirstProgress.exchange(false))
+      {
+        EXPECT_LT(0.3, progress);
+      }
+    });
+    qi::Future<void> copyOpFt = fileOp.start();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.hasValue());
+    EXPECT_LT(fileOp.receivedWireBytes(), testFile->size());
+  }
+  EXPECT_FALSE(boost::filesystem::exists(manifestPath));
+  {
+    qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+    qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    checkSameFilesContent(*originalFile, *localFileCopy);
+  }
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+}
+
+TEST(TestFile, resumedCopyDiscardsAnotherSource)
 {
-  qi::FilePtr testFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
-  EXPECT_TRUE(testFile->isOpen());
-  EXPECT_EQ(std::streamsize(TESTFILE_CONTENT.size()), testFile->size());
-
-  static const qi::Path LOCAL_COPY_PATH("if_this_is_not_removed_test_file_failed.txt");
+  static const qi::Path FIRST_SOURCE_PATH = TEMPORARY_DIR.PATH / "firstsource.data";
+  static const qi::Path SECOND_SOURCE_PATH = TEMPORARY_DIR.PATH / "secondsource.data";
+  static const qi::Path LOCAL_COPY_PATH = TEMPORARY_DIR.PATH / "resumedcopy.data";
+  const qi::Path manifestPath = qi::FileResumableCopyToLocal::manifestPath(LOCAL_COPY_PATH);
   boost::filesystem::remove(LOCAL_COPY_PATH);
+  boost::filesystem::remove(manifestPath);
+
+  // Two sources of the same size, the partial copy of the first one does not fit the second one.
   {
-    copyToLocal(testFile, LOCAL_COPY_PATH);
+    boost::filesystem::ofstream firstSource(FIRST_SOURCE_PATH, std::ios::out | std::ios::binary);
+    boost::filesystem::ofstream secondSource(SECOND_SOURCE_PATH, std::ios::out | std::ios::binary);
+    firstSource << std::string(1024 * 1024, 'a');
+    secondSource << std::string(1024 * 1024, 'b');
+  }
 
-    qi::FilePtr copiedFile = qi::openLocalFile(SMALL_TEST_FILE_PATH);
-    EXPECT_TRUE(copiedFile->isOpen());
-    checkSameFilesContent(*testFile, *copiedFile);
+  qi::FileTransferOptions options;
+  options.maxReadsInFlight = 1;
+  options.initialChunkSize = 64 * 1024;
+
+  {
+    qi::FileResumableCopyToLocal fileOp{ qi::openLocalFile(FIRST_SOURCE_PATH), LOCAL_COPY_PATH, options };
+    auto fileOpNotifier = fileOp.notifier();
+    fileOpNotifier->progress.connect([=](double progress){
+      if (progress > 0.3)
+        fileOpNotifier->waitForFinished().cancel();
+    });
+    qi::Future<void> copyOpFt = fileOp.start();
+    copyOpFt.wait();
+    ASSERT_TRUE(copyOpFt.isCanceled());
+  }
+  ASSERT_TRUE(boost::filesystem::exists(manifestPath));
+
+  {
+    qi::FileResumableCopyToLocal fileOp{ qi::openLocalFile(SECOND_SOURCE_PATH), LOCAL_COPY_PATH, options };
+    qi::Future<void> copyOpFt = fileOp.start();
+    copyOpFt.wait();
+    ASSERT_TRUE(copyOpFt.hasValue());
+    EXPECT_EQ(std::streamsize(1024 * 1024), fileOp.receivedWireBytes());
   }
+  EXPECT_FALSE(boost::filesystem::exists(manifestPath));
+  checkSameFilesContent(*qi::openLocalFile(SECOND_SOURCE_PATH), *qi::openLocalFile(LOCAL_COPY_PATH));
+
+  boost::filesystem::remove(FIRST_SOURCE_PATH);
+  boost::filesystem::remove(SECOND_SOURCE_PATH);
   boost::filesystem::remove(LOCAL_COPY_PATH);
 }
 
-namespace
-{
-qi::FilePtr getTestFile(const qi::Path& filePath)
+TEST_F(Test_ReadRemoteFile, transferTelemetry)
 {
-  qi::FilePtr testFile = qi::openLocalFile(filePath);
-  EXPECT_TRUE(testFile->isOpen());
-  return testFile;
-}
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
 
-std::atomic<bool> printProgressHaveBeenCalled(false);
-void printTranferProgress(double progress)
-{
-  printProgressHaveBeenCalled = true;
-  qiLogInfo() << "#### File Transfer Progress = " << (progress * 100.0) << "%";
+  qi::FileTransferOptions options;
+  options.allowStreaming = false;
+  options.minChunkSize = options.maxChunkSize = options.initialChunkSize = 64 * 1024;
+
+  qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+  qi::FileCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+  std::atomic<unsigned int> telemetryCount{ 0 };
+  fileCopy.notifier()->telemetry.connect([&](const qi::TransferTelemetry&) { ++telemetryCount; });
+  qi::Future<void> copyOpFt = fileCopy.start();
+  copyOpFt.wait();
+  ASSERT_TRUE(copyOpFt.hasValue());
+
+  const qi::TransferTelemetry telemetry = fileCopy.notifier()->telemetry.get();
+  EXPECT_LT(0u, telemetryCount.load());
+  EXPECT_EQ(testFile->size(), telemetry.bytesTransferred);
+  EXPECT_LT(0.0, telemetry.averageThroughput);
+  EXPECT_LT(0.0, telemetry.readLatencyMedian);
+  EXPECT_LE(telemetry.readLatencyMedian, telemetry.readLatency90);
+  EXPECT_LE(telemetry.readLatency90, telemetry.readLatency99);
+  EXPECT_LE(0.0, telemetry.localWriteTime);
+  EXPECT_EQ(0.0, telemetry.estimatedTimeRemaining);
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
 }
 
-class Test_ReadRemoteFile : public ::testing::Test
+TEST_F(Test_ReadRemoteFile, remoteTelemetryIsOptIn)
 {
-public:
-  void SetUp()
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+
+  for (const bool publishRemoteTelemetry : { false, true })
   {
-    qi::DynamicObjectBuilder objectBuilder;
-    objectBuilder.advertiseMethod("getTestFile", &getTestFile);
-    service = objectBuilder.object();
+    boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    qi::FileTransferOptions options;
+    options.publishRemoteTelemetry = publishRemoteTelemetry;
 
-    qi::SessionPtr serverSession = sessionPair.server();
-    serverSession->registerService("service", service);
+    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+    qi::ProgressNotifierPtr remoteNotifier = testFile->operationProgress();
+    qi::Promise<void> remoteTelemetryComplete;
+    std::atomic<bool> isRemoteTelemetryComplete{ false };
+    std::atomic<unsigned int> remoteTelemetryCount{ 0 };
+    const std::streamsize fileSize = testFile->size();
+    remoteNotifier->telemetry.connect([&, fileSize](const qi::TransferTelemetry& telemetry) {
+      ++remoteTelemetryCount;
+      if (telemetry.bytesTransferred == fileSize && !isRemoteTelemetryComplete.exchange(true))
+        remoteTelemetryComplete.setValue(0);
+    });
+
+    qi::FileCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+    qi::Future<void> copyOpFt = fileCopy.start();
+    copyOpFt.wait();
+    ASSERT_TRUE(copyOpFt.hasValue());
+
+    if (publishRemoteTelemetry)
+      EXPECT_EQ(qi::FutureState_FinishedWithValue, remoteTelemetryComplete.future().wait(5000));
+    else
+      EXPECT_EQ(0u, remoteTelemetryCount.load());
   }
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+}
+
+TEST_F(Test_ReadRemoteFile, progressNotificationPolicyReducesRemoteCalls)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
+
+  // Count the progress notifications received by the notifier of the remote file.
+  const auto countRemoteNotifications = [&](const qi::ProgressNotificationPolicy& policy) {
+    boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    qi::FileTransferOptions options;
+    options.allowStreaming = false;
+    options.minChunkSize = options.maxChunkSize = options.initialChunkSize = 16 * 1024;
+
+    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+    qi::ProgressNotifierPtr remoteNotifier = testFile->operationProgress();
+    std::atomic<unsigned int> notificationCount{ 0 };
+    std::atomic<double> lastProgress{ 0.0 };
+    qi::Promise<void> remoteFinished;
+    remoteNotifier->progress.connect([&](double progress) {
+      ++notificationCount;
+      lastProgress = progress;
+    });
+    remoteNotifier->status.connect([&](qi::ProgressNotifier::Status status) {
+      if (status == qi::ProgressNotifier::Status_Finished)
+        remoteFinished.setValue(0);
+    });
+
+    qi::FileCopyToLocal fileCopy{ testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+    fileCopy.setProgressNotificationPolicy(policy);
+    qi::Future<void> copyOpFt = fileCopy.start();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.hasValue());
+    EXPECT_EQ(qi::FutureState_FinishedWithValue, remoteFinished.future().wait(5000));
+    EXPECT_EQ(1.0, lastProgress.load());
+    return notificationCount.load();
+  };
+
+  const unsigned int unlimitedCount = countRemoteNotifications({});
+  qi::ProgressNotificationPolicy policy;
+  policy.minProgressDelta = 0.25;
+  const unsigned int limitedCount = countRemoteNotifications(policy);
+  qiLogInfo() << "Remote progress notifications: " << unlimitedCount << " without limit, "
+              << limitedCount << " with a minimum delta of " << policy.minProgressDelta;
+
+  EXPECT_LE(limitedCount, 5u);
+  EXPECT_LT(limitedCount, unlimitedCount);
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+}
+
+TEST_F(Test_ReadRemoteFile, progressObserversCanCallTheOperation)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "observedbigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
 
-  qi::FilePtr clientAcquireTestFile(const qi::Path& path)
   {
-    qi::AnyObject service = sessionPair.client()->service("service");
-    qi::FilePtr testFile = service.call<qi::FilePtr>("getTestFile", path);
-    EXPECT_TRUE(testFile->isRemote());
-    return testFile;
+    qi::FileCopyToLocal fileCopy{ clientAcquireTestFile(BIG_TEST_FILE_PATH), LOCAL_PATH_TO_RECEIVE_FILE_IN };
+    // The notifications are made out of the lock of the operation.
+    fileCopy.notifier()->progress.connect([&](double) {
+      fileCopy.setProgressNotificationPolicy(qi::ProgressNotificationPolicy{});
+    });
+    fileCopy.notifier()->status.connect([&](qi::ProgressNotifier::Status) {
+      fileCopy.setProgressNotificationPolicy(qi::ProgressNotificationPolicy{});
+    });
+    qi::Future<void> copyOpFt = fileCopy.start();
+    ASSERT_EQ(qi::FutureState_FinishedWithValue, copyOpFt.wait(10000));
   }
-
-private:
-  TestSessionPair sessionPair;
-  qi::AnyObject service;
-};
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
 }
 
-TEST_F(Test_ReadRemoteFile, isLocalOrRemote)
+TEST_F(Test_ReadRemoteFile, batchFileTransfer)
 {
+  const qi::Path batchDir{ TEMPORARY_DIR.PATH / "batch" };
+  boost::filesystem::create_directories(batchDir);
+
+  std::vector<qi::FileBatchCopyToLocal::Item> items;
+  for (int idx = 0; idx < 6; ++idx)
   {
-    qi::FilePtr testFile = openLocalFile(SMALL_TEST_FILE_PATH);
-    EXPECT_FALSE(testFile->isRemote());
+    const qi::Path& sourcePath = idx % 3 == 0 ? BIG_TEST_FILE_PATH : SMALL_TEST_FILE_PATH;
+    items.emplace_back(clientAcquireTestFile(sourcePath), batchDir / ("copy" + std::to_string(idx)));
   }
+  // The destination directory does not exist: only this copy must fail.
+  items.emplace_back(clientAcquireTestFile(SMALL_TEST_FILE_PATH), batchDir / "missing" / "copy");
+
+  qi::FileTransferOptions options;
+  options.maxReadsInFlight = 3;
+  options.initialChunkSize = 64 * 1024;
+  qi::FileBatchCopyToLocal fileOp{ items, options };
+  qi::Future<void> copyOpFt = fileOp.start();
+  copyOpFt.wait();
+  EXPECT_TRUE(copyOpFt.hasError());
+
+  const std::vector<qi::Future<void>> results = fileOp.itemResults();
+  ASSERT_EQ(items.size(), results.size());
+  for (std::size_t idx = 0; idx + 1 < items.size(); ++idx)
   {
-    qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
-    EXPECT_TRUE(testFile->isRemote());
+    ASSERT_TRUE(results[idx].hasValue());
+    qi::FilePtr localFileCopy = qi::openLocalFile(items[idx].second);
+    checkSameFilesContent(*items[idx].first, *localFileCopy);
   }
+  EXPECT_TRUE(results.back().hasError());
+  boost::filesystem::remove_all(batchDir);
 }
 
-TEST_F(Test_ReadRemoteFile, someReading)
+TEST_F(Test_ReadRemoteFile, aggregatorFollowsCopies)
 {
-  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+  qi::ProgressAggregator aggregator;
+  std::vector<qi::FileCopyToLocal> copies;
+  const qi::Path localDir(TEMPORARY_DIR.PATH / "aggregatedcopies");
+  boost::filesystem::create_directories(localDir);
+  for (int copyIdx = 0; copyIdx < 4; ++copyIdx)
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(copyIdx % 2 ? SMALL_TEST_FILE_PATH : BIG_TEST_FILE_PATH);
+    const std::streamsize fileSize = testFile->size();
+    copies.emplace_back(testFile, localDir / (std::to_string(copyIdx) + ".data"));
+    aggregator.attach(copies.back().notifier(), static_cast<std::uint64_t>(fileSize));
+  }
 
-  static const size_t COUNT_BYTES_TO_READ = 20;
+  std::vector<qi::Future<void>> futures;
+  for (auto& copy : copies)
+    futures.push_back(copy.start());
+  for (auto& future : futures)
+    ASSERT_TRUE(future.hasValue());
 
-  qi::Buffer buffer = testFile->read(COUNT_BYTES_TO_READ);
-  ASSERT_EQ(COUNT_BYTES_TO_READ, buffer.totalSize());
-  checkIsTestFileContent(buffer);
+  // The last notifications of the copies may still be on their way.
+  for (int attempt = 0; attempt < 100 && aggregator.notifier()->status.get() != qi::ProgressNotifier::Status_Finished; ++attempt)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(qi::ProgressNotifier::Status_Finished, aggregator.notifier()->status.get());
+  EXPECT_EQ(1.0, aggregator.notifier()->progress.get());
+  boost::filesystem::remove_all(localDir);
 }
 
-TEST_F(Test_ReadRemoteFile, readAll)
+TEST_F(Test_ReadRemoteFile, sinksConsumeContentInOnePass)
 {
-  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+  const qi::Path localPath = TEMPORARY_DIR.PATH / "sinkcopy.data";
+  const qi::Path teePath = TEMPORARY_DIR.PATH / "sinktee.data";
+  boost::filesystem::remove(localPath);
+  boost::filesystem::remove(teePath);
 
-  static const size_t COUNT_BYTES_TO_READ_PER_CYCLE = 10;
+  qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+  const std::streamsize fileSize = testFile->size();
+  qi::FileTransferOptions options;
+  options.maxReadsInFlight = 8; // the chunks are received out of order
+  qi::FileCopyToLocal fileCopy{ testFile, localPath, options };
+  auto digestSink = boost::make_shared<qi::DigestFileSink>();
+  auto memorySink = boost::make_shared<qi::MemoryFileSink>(static_cast<std::size_t>(fileSize));
+  fileCopy.addSink(digestSink);
+  fileCopy.addSink(memorySink);
+  fileCopy.addSink(boost::make_shared<qi::TeeFileSink>(teePath));
+  ASSERT_TRUE(fileCopy.start().hasValue());
 
-  qi::Buffer buffer;
-  qi::Buffer cycleBuffer;
-  while (true)
+  EXPECT_EQ(testFile->digest(), digestSink->digest());
+  qi::FilePtr localFile = qi::openLocalFile(localPath);
+  const qi::Buffer localContent = localFile->read(0, fileSize);
+  ASSERT_EQ(localContent.totalSize(), memorySink->content().totalSize());
+  EXPECT_TRUE(std::equal(static_cast<const char*>(localContent.data()),
+                         static_cast<const char*>(localContent.data()) + localContent.totalSize(),
+                         static_cast<const char*>(memorySink->content().data())));
+  qi::FilePtr teeFile = qi::openLocalFile(teePath);
+  checkSameFilesContent(*localFile, *teeFile);
+  localFile->close();
+  teeFile->close();
+  boost::filesystem::remove(localPath);
+  boost::filesystem::remove(teePath);
+
+  // A sink failing makes the copy fail, the other sinks leave nothing behind.
+  qi::FileCopyToLocal failingCopy{ testFile, localPath };
+  failingCopy.addSink(boost::make_shared<qi::MemoryFileSink>(static_cast<std::size_t>(fileSize / 2)));
+  failingCopy.addSink(boost::make_shared<qi::TeeFileSink>(teePath));
+  EXPECT_TRUE(failingCopy.start().hasError());
+  EXPECT_FALSE(boost::filesystem::exists(localPath));
+  EXPECT_FALSE(boost::filesystem::exists(teePath));
+}
+
+TEST_F(Test_ReadRemoteFile, uncompressingSinkProvidesOriginalContent)
+{
+  const qi::Path compressedPath = TEMPORARY_DIR.PATH / "compressed.data.z";
+  const qi::Path localPath = TEMPORARY_DIR.PATH / "compressedcopy.data.z";
+  boost::filesystem::remove(localPath);
+
+  std::string content;
+  for (int repetition = 0; repetition < 10000; ++repetition)
+    content += TESTFILE_CONTENT;
+  std::vector<Bytef> compressedContent(compressBound(static_cast<uLong>(content.size())));
+  uLongf compressedSize = static_cast<uLongf>(compressedContent.size());
+  ASSERT_EQ(Z_OK, compress(compressedContent.data(), &compressedSize,
+                           reinterpret_cast<const Bytef*>(content.data()), static_cast<uLong>(content.size())));
   {
-    cycleBuffer = testFile->read(COUNT_BYTES_TO_READ_PER_CYCLE);
-    buffer.write(cycleBuffer.data(), cycleBuffer.totalSize());
-    if (cycleBuffer.totalSize() < COUNT_BYTES_TO_READ_PER_CYCLE)
-      break;
+    boost::filesystem::ofstream compressedFile(compressedPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    compressedFile.write(reinterpret_cast<const char*>(compressedContent.data()), compressedSize);
   }
 
-  EXPECT_EQ(TESTFILE_CONTENT.size(), buffer.totalSize());
-  checkIsTestFileContent(buffer);
+  qi::FileTransferOptions options;
+  options.minChunkSize = options.initialChunkSize = 64; // many small chunks to uncompress
+  qi::FileCopyToLocal fileCopy{ clientAcquireTestFile(compressedPath), localPath, options };
+  auto memorySink = boost::make_shared<qi::MemoryFileSink>(content.size());
+  auto digestSink = boost::make_shared<qi::DigestFileSink>();
+  fileCopy.addSink(boost::make_shared<qi::UncompressingFileSink>(std::vector<qi::FileSinkPtr>{ memorySink, digestSink }));
+  ASSERT_TRUE(fileCopy.start().hasValue());
+
+  ASSERT_EQ(content.size(), memorySink->content().totalSize());
+  EXPECT_EQ(content, std::string(static_cast<const char*>(memorySink->content().data()), content.size()));
+  EXPECT_EQ(static_cast<std::streamsize>(compressedSize), qi::openLocalFile(localPath)->size());
+  boost::filesystem::remove(localPath);
+  boost::filesystem::remove(compressedPath);
 }
 
-TEST_F(Test_ReadRemoteFile, readAllOnce)
+TEST_F(Test_ReadRemoteFile, copyToMemory)
 {
-  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+  qi::FilePtr localFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  const std::streamsize fileSize = localFile->size();
+  const qi::Buffer expectedContent = localFile->read(0, fileSize);
 
-  const std::streamsize fileSize = testFile->size();
-  EXPECT_EQ(std::streamsize(TESTFILE_CONTENT.size()), fileSize);
+  qi::FileTransferOptions options;
+  options.maxReadsInFlight = 8;
+  qi::FileCopyToMemory fileCopy{ clientAcquireTestFile(BIG_TEST_FILE_PATH), static_cast<std::size_t>(fileSize), options };
+  qi::Future<qi::Buffer> futureContent = fileCopy.start();
+  ASSERT_TRUE(futureContent.hasValue());
+  const qi::Buffer& content = futureContent.value();
+  ASSERT_EQ(expectedContent.totalSize(), content.totalSize());
+  EXPECT_TRUE(std::equal(static_cast<const char*>(expectedContent.data()),
+                         static_cast<const char*>(expectedContent.data()) + expectedContent.totalSize(),
+                         static_cast<const char*>(content.data())));
 
-  qi::Buffer buffer = testFile->read(fileSize);
-  EXPECT_EQ(TESTFILE_CONTENT.size(), buffer.totalSize());
-  checkIsTestFileContent(buffer);
+  const qi::Buffer smallContent = qi::copyToMemory(clientAcquireTestFile(SMALL_TEST_FILE_PATH)).value();
+  checkIsTestFileContent(smallContent);
+  EXPECT_EQ(TESTFILE_CONTENT.size(), smallContent.totalSize());
+
+  // Files bigger than the maximum size are not transferred.
+  qi::FileCopyToMemory tooBigCopy{ clientAcquireTestFile(BIG_TEST_FILE_PATH), static_cast<std::size_t>(fileSize - 1) };
+  EXPECT_TRUE(tooBigCopy.start().hasError());
+  EXPECT_EQ(0, tooBigCopy.receivedBytes());
+
+  // Canceling the content cancels the copy, throttled so that it cannot end before.
+  qi::TransferSchedulerLimits limits;
+  limits.maxBytesPerSecond = 256 * 1024;
+  limits.burstBytes = 512 * 1024;
+  qi::setTransferSchedulerLimits(limits);
+  {
+    qi::FileTransferOptions slowOptions;
+    slowOptions.allowStreaming = false;
+    slowOptions.minChunkSize = slowOptions.maxChunkSize = slowOptions.initialChunkSize = 512 * 1024;
+    qi::FileCopyToMemory canceledCopy{ clientAcquireTestFile(BIG_TEST_FILE_PATH),
+                                       static_cast<std::size_t>(fileSize), slowOptions };
+    qi::Future<qi::Buffer> futureCanceled = canceledCopy.start();
+    futureCanceled.cancel();
+    futureCanceled.wait();
+    EXPECT_TRUE(futureCanceled.isCanceled());
+  }
+  qi::setTransferSchedulerLimits({});
 }
 
-TEST_F(Test_ReadRemoteFile, filetransfert)
+TEST_F(Test_ReadRemoteFile, copyToRemoteFile)
 {
-  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "file.data";
-  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  static const qi::Path REMOTE_PATH = TEMPORARY_DIR.PATH / "uploaded.data";
+  boost::filesystem::remove(REMOTE_PATH);
 
+  qi::FilePtr testFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+  for (unsigned int writesInFlight : { 1u, 8u })
   {
-    qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+    qi::FileTransferOptions options;
+    options.maxReadsInFlight = writesInFlight;
+    qi::FileCopyToRemote fileCopy{ testFile, clientAcquireDestinationFile(REMOTE_PATH), options };
+    qi::Future<void> copyOpFt = fileCopy.start();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.hasValue());
 
-    copyToLocal(testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    qi::FilePtr copiedFile = qi::openLocalFile(REMOTE_PATH);
+    checkSameFilesContent(*testFile, *copiedFile);
+    copiedFile->close();
   }
   {
-    qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
-    EXPECT_TRUE(localFileCopy->isOpen());
-    checkIsTestFileContent(*localFileCopy);
-  }
+    // A canceled copy leaves the destination untouched.
+    qi::FileTransferOptions options;
+    options.maxReadsInFlight = 1;
+    options.initialChunkSize = 1;
+    qi::FileCopyToRemote fileCopy{ qi::openLocalFile(SMALL_TEST_FILE_PATH), clientAcquireDestinationFile(REMOTE_PATH),
+                                   options };
+    qi::Future<void> copyOpFt = fileCopy.start();
+    copyOpFt.cancel();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.isCanceled());
 
-  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    qi::FilePtr copiedFile = qi::openLocalFile(REMOTE_PATH);
+    checkSameFilesContent(*testFile, *copiedFile);
+    copiedFile->close();
+  }
+  boost::filesystem::remove(REMOTE_PATH);
 }
 
-TEST_F(Test_ReadRemoteFile, readInTheMiddle)
+TEST_F(Test_ReadRemoteFile, copyCacheSkipsTransfer)
 {
-  qi::FilePtr testFile = clientAcquireTestFile(SMALL_TEST_FILE_PATH);
+  const qi::Path cacheDir = TEMPORARY_DIR.PATH / "copycache";
+  const qi::Path firstCopyPath = TEMPORARY_DIR.PATH / "firstcopy.data";
+  const qi::Path secondCopyPath = TEMPORARY_DIR.PATH / "secondcopy.data";
+  qi::FileCopyCacheSettings settings;
+  settings.directory = cacheDir;
+  qi::setFileCopyCache(settings);
 
-  qi::Buffer bufferPartial = testFile->read(TESTFILE_PARTIAL_BEGIN_POSITION, TESTFILE_PARTIAL_SIZE);
-  checkIsTestFilePartialContent(bufferPartial);
+  for (const auto& copyPath : { firstCopyPath, secondCopyPath })
+  {
+    qi::FileCopyToLocal fileCopy{ clientAcquireTestFile(BIG_TEST_FILE_PATH), copyPath };
+    qi::Future<void> copyOpFt = fileCopy.start();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.hasValue());
+    if (copyPath == secondCopyPath)
+    {
+      EXPECT_EQ(0, fileCopy.receivedWireBytes());
+    }
+  }
 
-  qi::Buffer bufferMiddle = testFile->read(TESTFILE_MIDDLE_BEGIN_POSITION, TESTFILE_MIDDLE_SIZE);
-  checkIsTestFileMiddleContent(bufferMiddle);
+  qi::FileCopyCacheCounters counters = qi::fileCopyCacheCounters();
+  EXPECT_EQ(1u, counters.insertions);
+  EXPECT_EQ(1u, counters.hits);
+  EXPECT_EQ(1u, counters.misses);
+  EXPECT_EQ(static_cast<std::uint64_t>(boost::filesystem::file_size(BIG_TEST_FILE_PATH)), counters.bytesSaved);
+  {
+    qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
+    qi::FilePtr copiedFile = qi::openLocalFile(secondCopyPath);
+    checkSameFilesContent(*originalFile, *copiedFile);
+  }
+
+  // The cache is reloaded from its directory, the least recently used content is evicted to respect the bound.
+  settings.maxSizeBytes = counters.sizeBytes;
+  qi::setFileCopyCache(settings);
+  EXPECT_EQ(1u, qi::fileCopyCacheCounters().entryCount);
+  qi::copyToLocal(clientAcquireTestFile(SMALL_TEST_FILE_PATH), firstCopyPath);
+  counters = qi::fileCopyCacheCounters();
+  EXPECT_EQ(1u, counters.entryCount);
+  EXPECT_EQ(1u, counters.evictions);
+  EXPECT_EQ(TESTFILE_CONTENT.size(), counters.sizeBytes);
+
+  qi::setFileCopyCache({});
+  boost::filesystem::remove_all(cacheDir);
+  boost::filesystem::remove(firstCopyPath);
+  boost::filesystem::remove(secondCopyPath);
 }
 
-TEST_F(Test_ReadRemoteFile, bigFiletransfert)
+namespace
 {
-  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "bigfile.data";
-  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+// Reports the digest of another content.
+class WrongDigestFile : public MinimalFile
+{
+public:
+  using MinimalFile::MinimalFile;
 
+  std::string digest() override
   {
-    qi::FilePtr testFile = clientAcquireTestFile(BIG_TEST_FILE_PATH);
+    return "sha256-" + std::string(64, '0');
+  }
+};
+}
 
-    qi::FileCopyToLocal fileCopy{testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN};
-    fileCopy.notifier()->progress.connect(&printTranferProgress);
-    fileCopy.start().wait();
+TEST(TestFile, copyCacheOnlyKeepsVerifiedContents)
+{
+  const qi::Path cacheDir = TEMPORARY_DIR.PATH / "verifiedcopycache";
+  const qi::Path copyPath = TEMPORARY_DIR.PATH / "verifiedcopy.data";
+  qi::FileCopyCacheSettings settings;
+  settings.directory = cacheDir;
+  qi::setFileCopyCache(settings);
 
-    EXPECT_TRUE(printProgressHaveBeenCalled.load());
+  qi::FileTransferOptions options;
+  options.allowKernelCopy = false;
+  {
+    qi::FileCopyToLocal fileCopy{ qi::FilePtr(boost::make_shared<WrongDigestFile>(TESTFILE_CONTENT)), copyPath, options };
+    ASSERT_EQ(qi::FutureState_FinishedWithValue, fileCopy.start().wait(5000));
+  }
+  EXPECT_EQ(0u, qi::fileCopyCacheCounters().insertions);
+
+  {
+    qi::FileCopyToLocal fileCopy{ qi::FilePtr(boost::make_shared<MinimalFile>(TESTFILE_CONTENT)), copyPath, options };
+    ASSERT_EQ(qi::FutureState_FinishedWithValue, fileCopy.start().wait(5000));
   }
+  EXPECT_EQ(1u, qi::fileCopyCacheCounters().insertions);
+  checkSameFilesContent(*qi::openLocalFile(SMALL_TEST_FILE_PATH), *qi::openLocalFile(copyPath));
+
+  // The copy may share the cached file: rewriting it in place within the same second, with the same size,
+  // must not make the cache serve another content.
   {
-    qi::FilePtr originalFile = qi::openLocalFile(BIG_TEST_FILE_PATH);
-    qi::FilePtr localFileCopy = qi::openLocalFile(LOCAL_PATH_TO_RECEIVE_FILE_IN);
-    checkSameFilesContent(*originalFile, *localFileCopy);
+    boost::filesystem::fstream rewrittenCopy(copyPath, std::ios::in | std::ios::out | std::ios::binary);
+    rewrittenCopy << std::string(TESTFILE_CONTENT.size(), '?');
+  }
+  const qi::Path otherCopyPath = TEMPORARY_DIR.PATH / "otherverifiedcopy.data";
+  {
+    qi::FileCopyToLocal fileCopy{ qi::FilePtr(boost::make_shared<MinimalFile>(TESTFILE_CONTENT)), otherCopyPath, options };
+    ASSERT_EQ(qi::FutureState_FinishedWithValue, fileCopy.start().wait(5000));
+  }
+  checkSameFilesContent(*qi::openLocalFile(SMALL_TEST_FILE_PATH), *qi::openLocalFile(otherCopyPath));
+
+  qi::setFileCopyCache({});
+  boost::filesystem::remove_all(cacheDir);
+  boost::filesystem::remove(copyPath);
+  boost::filesystem::remove(otherCopyPath);
+}
+
+TEST_F(Test_ReadRemoteFile, syncToLocalTransfersOnlyChanges)
+{
+  const qi::Path sourcePath = TEMPORARY_DIR.PATH / "syncsource.data";
+  const qi::Path localPath = TEMPORARY_DIR.PATH / "synccopy.data";
+  boost::filesystem::remove(localPath);
+  boost::filesystem::copy_file(BIG_TEST_FILE_PATH, localPath);
+
+  // The new version has bytes inserted in the middle and appended.
+  std::string content;
+  {
+    boost::filesystem::ifstream previousVersion(BIG_TEST_FILE_PATH, std::ios::in | std::ios::binary);
+    content.assign(std::istreambuf_iterator<char>(previousVersion), std::istreambuf_iterator<char>());
+    content.insert(content.size() / 2, "inserted bytes");
+    content += "appended bytes";
+    boost::filesystem::ofstream newVersion(sourcePath, std::ios::out | std::ios::binary | std::ios::trunc);
+    newVersion << content;
+  }
+  const auto contentSize = static_cast<std::streamsize>(content.size());
+
+  for (bool hasLocalCopy : { true, false })
+  {
+    if (!hasLocalCopy)
+      boost::filesystem::remove(localPath);
+
+    qi::FileSyncToLocal fileSync{ clientAcquireTestFile(sourcePath), localPath };
+    qi::Future<void> syncOpFt = fileSync.start();
+    syncOpFt.wait();
+    EXPECT_TRUE(syncOpFt.hasValue());
+    if (hasLocalCopy)
+    {
+      EXPECT_LT(contentSize * 9 / 10, fileSync.reusedBytes());
+      EXPECT_GT(contentSize / 10, fileSync.receivedWireBytes());
+    }
+    else
+    {
+      EXPECT_EQ(0, fileSync.reusedBytes());
+      EXPECT_EQ(contentSize, fileSync.receivedWireBytes());
+    }
+
+    qi::FilePtr sourceFile = qi::openLocalFile(sourcePath);
+    qi::FilePtr syncedFile = qi::openLocalFile(localPath);
+    checkSameFilesContent(*sourceFile, *syncedFile);
+    EXPECT_FALSE(boost::filesystem::exists(qi::FileSyncToLocal::temporaryPath(localPath)));
   }
 
+  boost::filesystem::remove(localPath);
+  boost::filesystem::remove(sourcePath);
+}
+
+TEST_F(Test_ReadRemoteFile, emptyFiletransfert)
+{
+  const qi::Path emptyFilePath{ TEMPORARY_DIR.PATH / "empty_source.data" };
+  boost::filesystem::ofstream{ emptyFilePath, std::ios::out | std::ios::binary };
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "empty.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  {
+    qi::FilePtr testFile = clientAcquireTestFile(emptyFilePath);
+    copyToLocal(testFile, LOCAL_PATH_TO_RECEIVE_FILE_IN);
+  }
+  EXPECT_TRUE(boost::filesystem::exists(LOCAL_PATH_TO_RECEIVE_FILE_IN));
+  EXPECT_EQ(0u, boost::filesystem::file_size(LOCAL_PATH_TO_RECEIVE_FILE_IN));
   boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
 }
 
@@ -367,6 +2056,63 @@ TEST_F(Test_ReadRemoteFile, cancelFileTransfer)
   boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
 }
 
+TEST_F(Test_ReadRemoteFile, cancelDoesNotWaitForReadsInFlight)
+{
+  static const qi::Path LOCAL_PATH_TO_RECEIVE_FILE_IN = TEMPORARY_DIR.PATH / "slowbigfile.data";
+  boost::filesystem::remove(LOCAL_PATH_TO_RECEIVE_FILE_IN);
+
+  // A slow link: after the first one, each read waits about two seconds for the bandwidth.
+  qi::TransferSchedulerLimits limits;
+  limits.maxBytesPerSecond = 256 * 1024;
+  limits.burstBytes = 512 * 1024;
+  qi::setTransferSchedulerLimits(limits);
+
+  qi::FileTransferOptions options;
+  options.allowStreaming = false;
+  options.minChunkSize = options.maxChunkSize = options.initialChunkSize = 512 * 1024;
+
+  const auto expectPromptCancel = [](qi::FileOperation& fileOp) {
+    qi::Promise<std::chrono::steady_clock::time_point> canceledTime;
+    fileOp.notifier()->status.connect([&](qi::ProgressNotifier::Status status) {
+      if (status == qi::ProgressNotifier::Status_Canceled)
+        canceledTime.setValue(std::chrono::steady_clock::now());
+    });
+    qi::Future<void> copyOpFt = fileOp.start();
+
+    // Let the first reads wait for the bandwidth.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const auto cancelTime = std::chrono::steady_clock::now();
+    copyOpFt.cancel();
+    copyOpFt.wait();
+    EXPECT_TRUE(copyOpFt.isCanceled());
+    const std::chrono::duration<double> latency = canceledTime.future().value() - cancelTime;
+    EXPECT_GT(0.5, latency.count());
+  };
+
+  {
+    qi::FileCopyToLocal fileOp{ clientAcquireTestFile(BIG_TEST_FILE_PATH), LOCAL_PATH_TO_RECEIVE_FILE_IN, options };
+    expectPromptCancel(fileOp);
+  }
+  EXPECT_FALSE(boost::filesystem::exists(LOCAL_PATH_TO_RECEIVE_FILE_IN));
+
+  {
+    std::vector<qi::FileBatchCopyToLocal::Item> items;
+    items.emplace_back(clientAcquireTestFile(BIG_TEST_FILE_PATH), LOCAL_PATH_TO_RECEIVE_FILE_IN);
+    qi::FileBatchCopyToLocal fileOp{ items, options };
+    expectPromptCancel(fileOp);
+  }
+  EXPECT_FALSE(boost::filesystem::exists(LOCAL_PATH_TO_RECEIVE_FILE_IN));
+
+  {
+    qi::FileCopyToRemote fileOp{ clientAcquireTestFile(BIG_TEST_FILE_PATH),
+                                 clientAcquireDestinationFile(LOCAL_PATH_TO_RECEIVE_FILE_IN), options };
+    expectPromptCancel(fileOp);
+  }
+  qi::setTransferSchedulerLimits({});
+  // The canceled destination is never committed.
+  EXPECT_FALSE(boost::filesystem::exists(LOCAL_PATH_TO_RECEIVE_FILE_IN));
+}
+
 int main(int argc, char** argv)
 {
   ::TestMode::forceTestMode(TestMode::Mode_SD);